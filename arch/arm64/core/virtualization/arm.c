@@ -23,10 +23,15 @@
 #include <virtualization/arm/cpu.h>
 #include <virtualization/vdev/vgic_v3.h>
 #include <virtualization/arm/vtimer.h>
+#include <virtualization/arm/psci.h>
 #include <virtualization/os/os_linux.h>
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
+/* to be found in fpsimd.S */
+extern void vcpu_fpsimd_regs_save(struct z_arm64_fp_context *fp_regs);
+extern void vcpu_fpsimd_regs_restore(struct z_arm64_fp_context *fp_regs);
+
 static void hyp_memory_map(void)
 {
     /*TODO: support split mode.*/
@@ -150,7 +155,7 @@ static void arch_vcpu_sys_regs_init(struct vcpu *vcpu)
 {
     struct zvm_vcpu_context *aarch64_c = &vcpu->arch->ctxt;
 
-    aarch64_c->sys_regs[VCPU_MPIDR_EL1] = 0x81000000;   /* read_mpidr_el1(); */
+    aarch64_c->sys_regs[VCPU_MPIDR_EL1] = VCPU_MPIDR(vcpu->vcpu_id);
     aarch64_c->sys_regs[VCPU_CPACR_EL1] = 0x03 << 20;
     aarch64_c->sys_regs[VCPU_VPIDR] = 0x410fc050;
 
@@ -191,8 +196,36 @@ static void arch_vcpu_common_regs_init(struct vcpu *vcpu)
 
 static void arch_vcpu_fp_regs_init(struct vcpu *vcpu)
 {
-    /*TODO: support fpu later. */
-    ARG_UNUSED(vcpu);
+    memset(&vcpu->arch->ctxt.fp_regs, 0, sizeof(struct z_arm64_fp_context));
+    vcpu->arch->vcpu_fpsimd_loaded = false;
+}
+
+/**
+ * @brief Save vcpu's fp/simd context, only when the vcpu has loaded it
+ * to the pcpu.
+ */
+static void vcpu_fpsimd_save(struct vcpu *vcpu)
+{
+    if (!vcpu->arch->vcpu_fpsimd_loaded) {
+        return;
+    }
+
+    write_cpacr_el1(read_cpacr_el1() | CPACR_EL1_FPEN_NOTRAP);
+    isb();
+    vcpu_fpsimd_regs_save(&vcpu->arch->ctxt.fp_regs);
+    vcpu->arch->vcpu_fpsimd_loaded = false;
+}
+
+void arch_vcpu_fpsimd_load(struct vcpu *vcpu)
+{
+    if (vcpu->arch->vcpu_fpsimd_loaded) {
+        return;
+    }
+
+    write_cpacr_el1(read_cpacr_el1() | CPACR_EL1_FPEN_NOTRAP);
+    isb();
+    vcpu_fpsimd_regs_restore(&vcpu->arch->ctxt.fp_regs);
+    vcpu->arch->vcpu_fpsimd_loaded = true;
 }
 
 void arch_vcpu_context_save(struct vcpu *vcpu)
@@ -200,6 +233,7 @@ void arch_vcpu_context_save(struct vcpu *vcpu)
     vcpu_vgic_save(vcpu);
     vcpu_vtimer_save(vcpu);
     vcpu_sysreg_save(vcpu);
+    vcpu_fpsimd_save(vcpu);
 }
 
 void arch_vcpu_context_load(struct vcpu *vcpu)
@@ -210,6 +244,9 @@ void arch_vcpu_context_load(struct vcpu *vcpu)
     vcpu_sysreg_load(vcpu);
     vcpu_vtimer_load(vcpu);
     vcpu_vgic_load(vcpu);
+#ifndef CONFIG_ZVM_VCPU_LAZY_FPSIMD
+    arch_vcpu_fpsimd_load(vcpu);
+#endif
 
 #ifdef CONFIG_SCHED_CPU_MASK_PIN_ONLY
 	vcpu->arch->hcr_el2 &= ~HCR_TWE_BIT;
@@ -220,6 +257,19 @@ void arch_vcpu_context_load(struct vcpu *vcpu)
 #endif
 }
 
+void arch_vcpu_power_on(struct vcpu *vcpu, uint64_t entry, uint64_t context_id)
+{
+    arch_vcpu_common_regs_init(vcpu);
+    arch_vcpu_sys_regs_init(vcpu);
+    arch_vcpu_fp_regs_init(vcpu);
+
+    vcpu->arch->ctxt.regs.pc = entry;
+    vcpu->arch->ctxt.regs.esf_handle_regs.x0 = context_id;
+
+    /* A vcpu that powers itself on has its el1 registers on the pcpu. */
+    vcpu_sysreg_reload(vcpu);
+}
+
 int arch_vcpu_init(struct vcpu *vcpu)
 {
     int ret = 0;
@@ -238,11 +288,13 @@ int arch_vcpu_init(struct vcpu *vcpu)
     vcpu_arch->host_mdcr_el2 = 0;
     vcpu_arch->list_regs_map = 0;
     vcpu_arch->pause = 0;
-    vcpu_arch->vcpu_sys_register_loaded = false;
+    vcpu_sysreg_drop(vcpu);
+    vcpu_psci_init(vcpu);
 
     /* init vm_arch here */
     vm_arch->vtcr_el2 = (0x20 | BIT(6) | BIT(8) | BIT(10) | BIT(12) | BIT(13) | BIT(31));
-    vm_arch->vttbr = (vcpu->vm->vmid | vm_arch->vm_pgd_base);
+    vm_arch->vttbr = (((uint64_t)vcpu->vm->vmid << VTTBR_VMID_SHIFT) |
+                        vm_arch->vm_pgd_base);
 
     arch_vcpu_common_regs_init(vcpu);
     arch_vcpu_sys_regs_init(vcpu);
@@ -272,6 +324,11 @@ int arch_vcpu_init(struct vcpu *vcpu)
     return ret;
 }
 
+void arch_vcpu_deinit(struct vcpu *vcpu)
+{
+    vcpu_sysreg_drop(vcpu);
+}
+
 int zvm_arch_init(void *op)
 {
     ARG_UNUSED(op);
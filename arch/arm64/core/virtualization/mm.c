@@ -3,6 +3,7 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include <string.h>
 #include <cache.h>
 #include <device.h>
 #include <init.h>
@@ -21,19 +22,42 @@
 #include <sys/mem_manage.h>
 #include"../core/mmu.h"
 #include <virtualization/zvm.h>
+#include <virtualization/arm/cpu.h>
 #include <virtualization/arm/mm.h>
 #include <virtualization/vm_mm.h>
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
-static uint64_t vm_zephyr_xlat_tables[ZVM_ZEPHYR_VM_NUM][CONFIG_ZVM_ZEPHYR_MAX_XLAT_TABLES * Ln_XLAT_NUM_ENTRIES]\
-		__aligned(Ln_XLAT_NUM_ENTRIES * sizeof(uint64_t));
-uint16_t vm_zephyr_xlat_use_count[ZVM_ZEPHYR_VM_NUM][CONFIG_ZVM_ZEPHYR_MAX_XLAT_TABLES];
-static uint64_t vm_linux_xlat_tables[ZVM_LINUX_VM_NUM][CONFIG_ZVM_LINUX_MAX_XLAT_TABLES * Ln_XLAT_NUM_ENTRIES]\
-		__aligned(Ln_XLAT_NUM_ENTRIES * sizeof(uint64_t));
-uint16_t vm_linux_xlat_use_count[ZVM_LINUX_VM_NUM][CONFIG_ZVM_LINUX_MAX_XLAT_TABLES];
+#define VM_XLAT_TABLE_SIZE	(Ln_XLAT_NUM_ENTRIES * sizeof(uint64_t))
+
+/*
+ * Stage-2 tables of all the vms come from one pool, a vm only holds the
+ * tables its mappings need and gives them back when it is deleted.
+ */
+K_MEM_SLAB_DEFINE_STATIC(vm_xlat_slab, VM_XLAT_TABLE_SIZE,
+			CONFIG_ZVM_XLAT_TABLES, VM_XLAT_TABLE_SIZE);
+static uint16_t vm_xlat_use_count[CONFIG_ZVM_XLAT_TABLES];
+static uint16_t vm_xlat_owner[CONFIG_ZVM_XLAT_TABLES];
+/* tables held by each vm */
+static uint32_t vm_xlat_vm_tables[CONFIG_MAX_VM_NUM];
 static struct k_spinlock vm_xlat_lock;
 
+/*
+ * Stage-2 range changed in the current mapping batch of a vm, the tlb of
+ * the vm is invalidated once when the batch ends.
+ */
+struct vm_s2_tlb_batch {
+	uint64_t vttbr;
+	uintptr_t start;
+	uintptr_t end;
+	/* smallest block changed, one tlbi is needed for each of them */
+	size_t stride;
+	/* the whole vmid must be flushed */
+	bool full;
+	uint32_t depth;
+};
+static struct vm_s2_tlb_batch vm_s2_tlb_batch[CONFIG_MAX_VM_NUM];
+
 /**
  * @brief Gets a description of the virtual machine memory.
  */
@@ -130,30 +154,37 @@ static void arch_vm_mmap_pre(uintptr_t virt_addr, uintptr_t phys_addr, size_t si
 	return;
 }
 
+static inline unsigned int vm_table_index(uint64_t *pte, uint32_t vmid)
+{
+	unsigned int i;
+	ARG_UNUSED(vmid);
+
+	i = ((uintptr_t)pte - (uintptr_t)vm_xlat_slab.buffer) / VM_XLAT_TABLE_SIZE;
+	__ASSERT(i < CONFIG_ZVM_XLAT_TABLES, "table %p out of range", pte);
+	__ASSERT(vm_xlat_owner[i] == vmid, "table %p not owned by vm", pte);
+
+	return i;
+}
+
 static uint64_t *vm_new_table(uint32_t vmid)
 {
 	unsigned int i;
+	uint64_t *table;
 
-	/* Look for a free table. */
-	if(vmid < ZVM_ZEPHYR_VM_NUM){
-		for (i = 0U; i < CONFIG_ZVM_ZEPHYR_MAX_XLAT_TABLES; i++) {
-			if (vm_zephyr_xlat_use_count[vmid][i] == 0U) {
-				vm_zephyr_xlat_use_count[vmid][i] = 1U;
-				/* each table assign 512 entrys */
-				return &vm_zephyr_xlat_tables[vmid][i * Ln_XLAT_NUM_ENTRIES];
-			}
-		}
-	}else{
-		for (i = 0U; i < CONFIG_ZVM_LINUX_MAX_XLAT_TABLES; i++) {
-			if (vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i] == 0U) {
-				vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i] = 1U;
-				/* each table assign 512 entrys */
-				return &vm_linux_xlat_tables[vmid-ZVM_ZEPHYR_VM_NUM][i * Ln_XLAT_NUM_ENTRIES];
-			}
-		}
+	if (k_mem_slab_alloc(&vm_xlat_slab, (void **)&table, K_NO_WAIT)) {
+		ZVM_LOG_WARN("No stage-2 table left for vm%d, %d in use. \n",
+				vmid, k_mem_slab_num_used_get(&vm_xlat_slab));
+		return NULL;
 	}
+	/* The slab keeps its free list in the block, and starts uninitialized. */
+	memset(table, 0, VM_XLAT_TABLE_SIZE);
+
+	i = ((uintptr_t)table - (uintptr_t)vm_xlat_slab.buffer) / VM_XLAT_TABLE_SIZE;
+	vm_xlat_use_count[i] = 1U;
+	vm_xlat_owner[i] = vmid;
+	vm_xlat_vm_tables[vmid]++;
 
-	return NULL;
+	return table;
 }
 
 static inline bool vm_is_desc_block_aligned(uint64_t desc, unsigned int level_size)
@@ -207,33 +238,15 @@ static void vm_set_pte_table_desc(uint64_t *pte, uint64_t *table, unsigned int l
 	*pte = PTE_TABLE_DESC | (uint64_t)table;
 }
 
-static inline unsigned int vm_table_index(uint64_t *pte, uint32_t vmid)
-{
-	unsigned int i ;
-	if(vmid < ZVM_ZEPHYR_VM_NUM){
-		i = (pte - &vm_zephyr_xlat_tables[vmid][0]) / Ln_XLAT_NUM_ENTRIES;
-		__ASSERT(i < CONFIG_ZVM_ZEPHYR_MAX_XLAT_TABLES, "table %p out of range", pte);
-	}
-	else{
-		i = (pte - &vm_linux_xlat_tables[vmid-ZVM_ZEPHYR_VM_NUM][0]) / Ln_XLAT_NUM_ENTRIES;
-		__ASSERT(i < CONFIG_ZVM_LINUX_MAX_XLAT_TABLES, "table %p out of range", pte);
-	}
-
-	return i;
-}
-
 /* Makes a table free for reuse. */
 static void vm_free_table(uint64_t *table, uint32_t vmid)
 {
 	unsigned int i = vm_table_index(table, vmid);
 
-	if(vmid < ZVM_ZEPHYR_VM_NUM){
-		__ASSERT(vm_zephyr_xlat_use_count[vmid][i] == 1U, "table still in use");
-		vm_zephyr_xlat_use_count[vmid][i] = 0U;
-	}else{
-		__ASSERT(vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i] == 1U, "table still in use");
-		vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i] = 0U;
-	}
+	__ASSERT(vm_xlat_use_count[i] == 1U, "table still in use");
+	vm_xlat_use_count[i] = 0U;
+	vm_xlat_vm_tables[vmid]--;
+	k_mem_slab_free(&vm_xlat_slab, (void **)&table);
 }
 
 /* Adjusts usage count and returns current count. */
@@ -242,15 +255,9 @@ static int vm_table_usage(uint64_t *table, int adjustment, uint32_t vmid)
 	unsigned int i,table_use;
 	i = vm_table_index(table, vmid);
 
-	if(vmid < ZVM_ZEPHYR_VM_NUM){
-		vm_zephyr_xlat_use_count[vmid][i] += adjustment;
-		table_use = vm_zephyr_xlat_use_count[vmid][i];
-		__ASSERT(vm_zephyr_xlat_use_count[vmid][i] > 0, "usage count underflow");
-	}else{
-		vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i] += adjustment;
-		table_use = vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i];
-		__ASSERT(vm_linux_xlat_use_count[vmid-ZVM_ZEPHYR_VM_NUM][i] > 0, "usage count underflow");
-	}
+	vm_xlat_use_count[i] += adjustment;
+	table_use = vm_xlat_use_count[i];
+	__ASSERT(vm_xlat_use_count[i] > 0, "usage count underflow");
 
 	return table_use;
 }
@@ -260,7 +267,112 @@ static inline bool vm_is_table_unused(uint64_t *table, uint32_t vmid)
 	return vm_table_usage(table, 0, vmid) == 1;
 }
 
-static uint64_t *vm_expand_to_table(uint64_t *pte, unsigned int level, uint32_t vmid)
+/**
+ * @brief Record that the valid descriptor of [ipa, ipa + size) is changed.
+ */
+static void vm_s2_tlb_track(struct arm_mmu_ptables *ptables, uintptr_t ipa,
+			size_t size, uint32_t vmid)
+{
+	struct vm_s2_tlb_batch *batch = &vm_s2_tlb_batch[vmid];
+
+	if (batch->start == batch->end) {
+		batch->vttbr = ((uint64_t)vmid << VTTBR_VMID_SHIFT) |
+					(uint64_t)ptables->base_xlat_table;
+		batch->start = ipa;
+		batch->end = ipa + size;
+		batch->stride = size;
+		batch->full = false;
+		return;
+	}
+
+	batch->start = MIN(batch->start, ipa);
+	batch->end = MAX(batch->end, ipa + size);
+	batch->stride = MIN(batch->stride, size);
+}
+
+/**
+ * @brief Invalidate the stage-2 tlb entries of [start, end) in the vmid of
+ * @vttbr, ipa by ipa with @stride, or all the entries of the vmid.
+ */
+static void vm_s2_tlbi(uint64_t vttbr, uintptr_t start, uintptr_t end,
+			size_t stride, bool full)
+{
+	uint64_t old_vttbr, hcr;
+	uintptr_t ipa;
+
+	/* Make the descriptors visible to the table walkers first. */
+	__asm__ volatile("dsb ishst" : : : "memory");
+
+	/*
+	 * TLBI works on the vmid in VTTBR_EL2, and with TGE set the el1
+	 * operations would hit the host el2&0 regime instead of the vm.
+	 */
+	old_vttbr = read_vttbr_el2();
+	hcr = read_hcr_el2();
+	write_vttbr_el2(vttbr);
+	write_hcr_el2(hcr & ~HCR_TGE_BIT);
+	isb();
+
+	if (full) {
+		__asm__ volatile("tlbi vmalls12e1is" : : : "memory");
+	} else {
+		for (ipa = start; ipa < end; ipa += stride) {
+			__asm__ volatile("tlbi ipas2e1is, %0"
+					: : "r" ((uint64_t)ipa >> PAGE_SIZE_SHIFT) : "memory");
+		}
+		/* Combined stage-1 and stage-2 entries may hold the old ipa. */
+		__asm__ volatile("dsb ish" : : : "memory");
+		__asm__ volatile("tlbi vmalle1is" : : : "memory");
+	}
+	__asm__ volatile("dsb ish" : : : "memory");
+	isb();
+
+	write_hcr_el2(hcr);
+	write_vttbr_el2(old_vttbr);
+	isb();
+}
+
+/**
+ * @brief Invalidate the tlb entries of the range recorded for @vmid, unless
+ * a mapping batch is still open. A small range is invalidated ipa by ipa,
+ * a large one by flushing all the entries of the vmid.
+ */
+static void vm_s2_tlb_flush(uint32_t vmid)
+{
+	struct vm_s2_tlb_batch *batch = &vm_s2_tlb_batch[vmid];
+
+	if (batch->depth || batch->start == batch->end) {
+		return;
+	}
+
+	vm_s2_tlbi(batch->vttbr, batch->start, batch->end, batch->stride,
+			batch->full || (batch->end - batch->start) / batch->stride >
+				CONFIG_ZVM_S2_TLBI_RANGE_MAX_OPS);
+
+	batch->start = 0;
+	batch->end = 0;
+	batch->full = false;
+}
+
+/**
+ * @brief Break before make: clear the valid descriptor @pte at @level
+ * and drop its tlb entries before a new descriptor is written there, so
+ * the walkers never see two translations of the same ipa. It can not
+ * wait for the batch to end.
+ */
+static void vm_s2_break_pte(struct arm_mmu_ptables *ptables, uint64_t *pte,
+			uintptr_t ipa, unsigned int level, uint32_t vmid)
+{
+	size_t size = 1ULL << LEVEL_TO_VA_SIZE_SHIFT(level);
+
+	*pte = 0;
+	ipa &= ~(size - 1);
+	vm_s2_tlbi(((uint64_t)vmid << VTTBR_VMID_SHIFT) |
+			(uint64_t)ptables->base_xlat_table, ipa, ipa + size, size, false);
+}
+
+static uint64_t *vm_expand_to_table(struct arm_mmu_ptables *ptables, uint64_t *pte,
+			uintptr_t virt, unsigned int level, uint32_t vmid)
 {
 	uint64_t *table;
 
@@ -292,6 +404,9 @@ static uint64_t *vm_expand_to_table(uint64_t *pte, unsigned int level, uint32_t
 			table[i] = desc | (i << stride_shift);
 		}
 		vm_table_usage(table, Ln_XLAT_NUM_ENTRIES, vmid);
+
+		/* The block may be cached, break it before linking the table. */
+		vm_s2_break_pte(ptables, pte, virt, level, vmid);
 	} else {
 		/*
 		 * Adjust usage count for parent table's entry
@@ -301,6 +416,7 @@ static uint64_t *vm_expand_to_table(uint64_t *pte, unsigned int level, uint32_t
 	}
 
 	/* Link the new table in place of the pte it replaces */
+	__asm__ volatile("dsb ishst" : : : "memory");
 	vm_set_pte_table_desc(pte, table, level);
 	vm_table_usage(table, 1, vmid);
 
@@ -352,7 +468,7 @@ static int vm_set_mapping(struct arm_mmu_ptables *ptables,\
 		if ((size < level_size) || (virt & (level_size - 1)) ||
 		    !vm_is_desc_block_aligned(desc, level_size)) {
 			/* Range doesn't fit, create subtable */
-			table = vm_expand_to_table(pte, level, vmid);
+			table = vm_expand_to_table(ptables, pte, virt, level, vmid);
 			if (!table) {
 				ret = -ENOMEM;
 				break;
@@ -364,6 +480,12 @@ static int vm_set_mapping(struct arm_mmu_ptables *ptables,\
 		/* Adjust usage count for corresponding table */
 		if (vm_is_free_desc(*pte)) {
 			vm_table_usage(pte, 1, vmid);
+		} else if (desc) {
+			/* A valid translation is replaced, break before make. */
+			vm_s2_break_pte(ptables, pte, virt, level, vmid);
+		} else {
+			/* The old translation may be cached in tlb */
+			vm_s2_tlb_track(ptables, virt, level_size, vmid);
 		}
 		if (!desc) {
 			vm_table_usage(pte, -1, vmid);
@@ -374,10 +496,12 @@ static int vm_set_mapping(struct arm_mmu_ptables *ptables,\
 		/* recursively free unused tables if any */
 		while (level != BASE_XLAT_LEVEL &&
 		       vm_is_table_unused(pte, vmid)) {
-			vm_free_table(pte, vmid);
+			table = pte;
 			pte = ptes[--level];
-			vm_set_pte_block_desc(pte, 0, level);
+			/* Walkers may cache the table, drop it before reuse. */
+			vm_s2_break_pte(ptables, pte, virt, level, vmid);
 			vm_table_usage(pte, -1, vmid);
+			vm_free_table(table, vmid);
 		}
 
 move_on:
@@ -409,6 +533,7 @@ static int vm_remove_dev_map(struct arm_mmu_ptables *ptables, const char *name,
 
 	key = k_spin_lock(&vm_xlat_lock);
 	ret = vm_set_mapping(ptables, virt, size, 0, true, vmid);
+	vm_s2_tlb_flush(vmid);
 	k_spin_unlock(&vm_xlat_lock, key);
 	return ret;
 }
@@ -430,6 +555,7 @@ static int vm_add_dev_map(struct arm_mmu_ptables *ptables, const char *name,
 	key = k_spin_lock(&vm_xlat_lock);
 
 	ret = vm_set_mapping(ptables, virt, size, desc, may_overwrite, vmid);
+	vm_s2_tlb_flush(vmid);
 	k_spin_unlock(&vm_xlat_lock, key);
 	return ret;
 }
@@ -451,6 +577,7 @@ static int vm_add_map(struct arm_mmu_ptables *ptables, const char *name,
 	__ASSERT(((virt | phys | size) & (CONFIG_MMU_PAGE_SIZE - 1)) == 0,
 		 "address/size are not page aligned\n");
 	ret = vm_set_mapping(ptables, virt, size, desc, may_overwrite, vmid);
+	vm_s2_tlb_flush(vmid);
 
 	k_spin_unlock(&vm_xlat_lock, key);
 	return ret;
@@ -464,6 +591,7 @@ static int vm_remove_map(struct arm_mmu_ptables *ptables, const char *name,
 
 	key = k_spin_lock(&vm_xlat_lock);
 	ret = vm_set_mapping(ptables,virt,size,0,true,vmid);
+	vm_s2_tlb_flush(vmid);
 	k_spin_unlock(&vm_xlat_lock,key);
 	return ret;
 }
@@ -522,6 +650,26 @@ int arch_vm_mem_domain_partition_add(struct k_mem_domain *domain,
 				ptn->start, ptn->size, ptn->attr.attrs, vmid);
 }
 
+int arch_vm_mem_block_map(struct vm *vm, uint64_t hpa, uint64_t gpa,
+				uint64_t size, uint32_t attrs)
+{
+	struct arm_mmu_ptables *ptables;
+
+	ptables = &vm->vmem_domain->vm_mm_domain->arch.ptables;
+
+	return vm_add_map(ptables, "vm-mem-block", hpa, gpa, size, attrs, vm->vmid);
+}
+
+int arch_vm_mem_block_unmap(struct vm *vm, uint64_t gpa, uint64_t size)
+{
+	struct arm_mmu_ptables *ptables;
+
+	ptables = &vm->vmem_domain->vm_mm_domain->arch.ptables;
+
+	/* The tlb entries of the block are gone when this returns. */
+	return vm_remove_map(ptables, "vm-mem-block", gpa, size, vm->vmid);
+}
+
 int arch_vm_mem_domain_partition_remove(struct k_mem_domain *domain,
 				uint32_t partition_id, uint32_t vmid)
 {
@@ -534,6 +682,57 @@ int arch_vm_mem_domain_partition_remove(struct k_mem_domain *domain,
 	return ret;
 }
 
+void arch_vm_s2_tlb_batch_start(struct vm *vm)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&vm_xlat_lock);
+	vm_s2_tlb_batch[vm->vmid].depth++;
+	k_spin_unlock(&vm_xlat_lock, key);
+}
+
+void arch_vm_s2_tlb_batch_end(struct vm *vm)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&vm_xlat_lock);
+	__ASSERT(vm_s2_tlb_batch[vm->vmid].depth, "unbalanced stage-2 batch");
+	vm_s2_tlb_batch[vm->vmid].depth--;
+	vm_s2_tlb_flush(vm->vmid);
+	k_spin_unlock(&vm_xlat_lock, key);
+}
+
+int arch_vm_mem_domain_deinit(struct k_mem_domain *domain, uint32_t vmid)
+{
+	struct arm_mmu_ptables *domain_ptables = &domain->arch.ptables;
+	struct vm_s2_tlb_batch *batch = &vm_s2_tlb_batch[vmid];
+	k_spinlock_key_t key;
+	unsigned int i;
+	uint64_t *table;
+
+	key = k_spin_lock(&vm_xlat_lock);
+
+	/* The vmid is given to the next vm, none of its entries may stay. */
+	vm_s2_tlb_track(domain_ptables, 0, CONFIG_MMU_PAGE_SIZE, vmid);
+	batch->full = true;
+	__ASSERT(!batch->depth, "stage-2 batch still open");
+	vm_s2_tlb_flush(vmid);
+
+	/* Give back the tables left by the mappings that were not removed. */
+	for (i = 0U; i < CONFIG_ZVM_XLAT_TABLES && vm_xlat_vm_tables[vmid]; i++) {
+		if (vm_xlat_use_count[i] && vm_xlat_owner[i] == vmid) {
+			table = (uint64_t *)(vm_xlat_slab.buffer + i * VM_XLAT_TABLE_SIZE);
+			vm_xlat_use_count[i] = 0U;
+			vm_xlat_vm_tables[vmid]--;
+			k_mem_slab_free(&vm_xlat_slab, (void **)&table);
+		}
+	}
+	domain_ptables->base_xlat_table = NULL;
+
+	k_spin_unlock(&vm_xlat_lock, key);
+	return 0;
+}
+
 int arch_vm_mem_domain_init(struct k_mem_domain *domain, uint32_t vmid)
 {
 	struct arm_mmu_ptables *domain_ptables = &domain->arch.ptables;
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <sys/atomic.h>
+#include <arch/arm64/lib_helpers.h>
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/vm_cpu.h>
+#include <virtualization/arm/cpu.h>
+#include <virtualization/arm/psci.h>
+
+LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
+
+static struct vcpu *psci_find_vcpu(struct vm *vm, uint64_t mpidr)
+{
+    int i;
+
+    mpidr &= VCPU_MPIDR_AFF_MASK;
+    for (i = 0; i < vm->vcpu_num; i++) {
+        if (vm->vcpus[i] && VCPU_AFFINITY(vm->vcpus[i]->vcpu_id) == mpidr) {
+            return vm->vcpus[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief The vcpu is off and nobody halted or paused it. The vcpu's own
+ * state is tested, vm_status only changes after all vcpus are switched.
+ */
+static bool psci_vcpu_stay_off(struct vcpu *vcpu)
+{
+    return atomic_get(&vcpu->arch->psci_state) == ZVM_PSCI_STATE_OFF &&
+            !(vcpu->vcpu_state & (_VCPU_STATE_HALTED | _VCPU_STATE_PAUSED));
+}
+
+/**
+ * @brief Block the vcpu until another vcpu turns it on, or the vcpu is
+ * halted or paused. It sleeps on the wfi sem, so the kick of a vcpu
+ * state switch wakes it as well.
+ */
+static void psci_wait_power_on(struct vcpu *vcpu)
+{
+    enable_irq();
+    isb();
+    while (psci_vcpu_stay_off(vcpu)) {
+        k_sem_reset(&vcpu->wfi_sem);
+        atomic_set(&vcpu->wfi_waiting, 1);
+        /* Pairs with the barrier in vcpu_state_switch(). */
+        dmb();
+        if (psci_vcpu_stay_off(vcpu)) {
+            k_sem_take(&vcpu->wfi_sem, K_FOREVER);
+        }
+        atomic_set(&vcpu->wfi_waiting, 0);
+    }
+    disable_irq();
+    isb();
+}
+
+static int psci_cpu_on(struct vcpu *vcpu, uint64_t mpidr,
+                uint64_t entry, uint64_t context_id)
+{
+    k_spinlock_key_t key;
+    struct vcpu *target;
+    struct vm *vm = vcpu->vm;
+
+    target = psci_find_vcpu(vm, mpidr);
+    if (!target) {
+        return ZVM_PSCI_RET_INVALID_PARAMS;
+    }
+
+    if (!atomic_cas(&target->arch->psci_state, ZVM_PSCI_STATE_OFF,
+                    ZVM_PSCI_STATE_ON_PENDING)) {
+        return atomic_get(&target->arch->psci_state) == ZVM_PSCI_STATE_ON ?
+                ZVM_PSCI_RET_ALREADY_ON : ZVM_PSCI_RET_ON_PENDING;
+    }
+    target->arch->psci_entry = entry;
+    target->arch->psci_context_id = context_id;
+
+    key = k_spin_lock(&vm->spinlock);
+    if (target->vcpu_state == _VCPU_STATE_UNKNOWN) {
+        /* First power on, the vcpu thread starts from here. */
+        arch_vcpu_power_on(target, entry, context_id);
+        atomic_set(&target->arch->psci_state, ZVM_PSCI_STATE_ON);
+        vm_vcpu_run(target);
+        if (vm->vm_status == VM_STATE_PAUSE) {
+            vm_vcpu_pause(target);
+        }
+    } else {
+        /* The vcpu is in psci_wait_power_on(), it resets itself. */
+        vcpu_wfi_kick(target);
+    }
+    k_spin_unlock(&vm->spinlock, key);
+
+    return ZVM_PSCI_RET_SUCCESS;
+}
+
+static void psci_cpu_off(struct vcpu *vcpu)
+{
+    atomic_t *state = &vcpu->arch->psci_state;
+
+    atomic_set(state, ZVM_PSCI_STATE_OFF);
+    psci_wait_power_on(vcpu);
+    if (atomic_get(state) != ZVM_PSCI_STATE_ON_PENDING) {
+        return;
+    }
+
+    arch_vcpu_power_on(vcpu, vcpu->arch->psci_entry,
+                        vcpu->arch->psci_context_id);
+    atomic_set(state, ZVM_PSCI_STATE_ON);
+}
+
+/**
+ * @brief Every power state is entered as standby: the vcpu waits like
+ * wfi and returns success when it is woken up.
+ */
+static int psci_cpu_suspend(struct vcpu *vcpu)
+{
+    if (vcpu_irq_exit(vcpu)) {
+        return ZVM_PSCI_RET_SUCCESS;
+    }
+
+    enable_irq();
+    isb();
+    vcpu_wait_for_irq(vcpu);
+    disable_irq();
+    isb();
+
+    return ZVM_PSCI_RET_SUCCESS;
+}
+
+static int psci_affinity_info(struct vcpu *vcpu, uint64_t mpidr, uint64_t level)
+{
+    struct vcpu *target;
+
+    if (level) {
+        return ZVM_PSCI_RET_INVALID_PARAMS;
+    }
+
+    target = psci_find_vcpu(vcpu->vm, mpidr);
+    if (!target) {
+        return ZVM_PSCI_RET_INVALID_PARAMS;
+    }
+
+    return atomic_get(&target->arch->psci_state);
+}
+
+static int psci_system_off(struct vcpu *vcpu)
+{
+    ZVM_LOG_INFO("** vm %s powers off. \n", vcpu->vm->vm_name);
+    vm_vcpus_halt(vcpu->vm);
+
+    return ZVM_PSCI_RET_SUCCESS;
+}
+
+static int psci_features(uint64_t func)
+{
+    if (!ZVM_PSCI_IS_CALL(func)) {
+        return ZVM_PSCI_RET_NOT_SUPPORTED;
+    }
+
+    switch (func & ZVM_PSCI_FN_MASK) {
+    case ZVM_PSCI_FN_VERSION:
+    case ZVM_PSCI_FN_CPU_SUSPEND:
+    case ZVM_PSCI_FN_CPU_OFF:
+    case ZVM_PSCI_FN_CPU_ON:
+    case ZVM_PSCI_FN_AFFINITY_INFO:
+    case ZVM_PSCI_FN_MIGRATE_INFO_TYPE:
+    case ZVM_PSCI_FN_SYSTEM_OFF:
+    case ZVM_PSCI_FN_SYSTEM_RESET:
+    case ZVM_PSCI_FN_FEATURES:
+        /* Original power state format, no os-initiated mode. */
+        return ZVM_PSCI_RET_SUCCESS;
+    default:
+        return ZVM_PSCI_RET_NOT_SUPPORTED;
+    }
+}
+
+void vcpu_psci_init(struct vcpu *vcpu)
+{
+    atomic_set(&vcpu->arch->psci_state, vcpu->vcpu_id ?
+                ZVM_PSCI_STATE_OFF : ZVM_PSCI_STATE_ON);
+    vcpu->arch->psci_entry = 0;
+    vcpu->arch->psci_context_id = 0;
+}
+
+void vcpu_psci_handle(struct vcpu *vcpu, uint64_t *regs)
+{
+    int64_t ret;
+    uint64_t func = regs[0];
+    uint64_t arg_mask = (func & ZVM_PSCI_FN_SMC64_BIT) ? UINT64_MAX : UINT32_MAX;
+
+    switch (func & ZVM_PSCI_FN_MASK) {
+    case ZVM_PSCI_FN_VERSION:
+        ret = ZVM_PSCI_VERSION_VALUE;
+        break;
+    case ZVM_PSCI_FN_CPU_SUSPEND:
+        ret = psci_cpu_suspend(vcpu);
+        break;
+    case ZVM_PSCI_FN_CPU_OFF:
+        /* On success cpu_off does not return, the vcpu boots again. */
+        psci_cpu_off(vcpu);
+        return;
+    case ZVM_PSCI_FN_CPU_ON:
+        ret = psci_cpu_on(vcpu, regs[1] & arg_mask, regs[2] & arg_mask,
+                        regs[3] & arg_mask);
+        break;
+    case ZVM_PSCI_FN_AFFINITY_INFO:
+        ret = psci_affinity_info(vcpu, regs[1] & arg_mask, regs[2] & arg_mask);
+        break;
+    case ZVM_PSCI_FN_MIGRATE_INFO_TYPE:
+        ret = ZVM_PSCI_TOS_NOT_PRESENT;
+        break;
+    case ZVM_PSCI_FN_SYSTEM_RESET:
+        ZVM_LOG_WARN("Do not support vm reset, power off vm %s. \n",
+                    vcpu->vm->vm_name);
+        ret = psci_system_off(vcpu);
+        break;
+    case ZVM_PSCI_FN_SYSTEM_OFF:
+        ret = psci_system_off(vcpu);
+        break;
+    case ZVM_PSCI_FN_FEATURES:
+        ret = psci_features(regs[1] & UINT32_MAX);
+        break;
+    default:
+        ret = ZVM_PSCI_RET_NOT_SUPPORTED;
+        break;
+    }
+
+    regs[0] = ret;
+}
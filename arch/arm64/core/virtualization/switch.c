@@ -126,7 +126,9 @@ int arch_vcpu_run(struct vcpu *vcpu)
 {
     int ret;
     uint16_t exit_type = 0;
+    uint32_t start, entry, exit;
 
+    start = VM_EXIT_STAT_CYCLES();
     /* mask all interrupt here to disable interrupt */
     vm_disable_daif();
     ret = vm_flush_vgic(vcpu);
@@ -136,7 +138,9 @@ int arch_vcpu_run(struct vcpu *vcpu)
     switch_to_guest_sysreg(vcpu);
 
     /* Jump to the fire too! */
+    entry = VM_EXIT_STAT_CYCLES();
     exit_type = guest_vm_entry(vcpu, &vcpu->arch->host_ctxt);
+    exit = VM_EXIT_STAT_CYCLES();
     vcpu->exit_type = exit_type;
 
     switch_to_host_sysreg(vcpu);
@@ -162,6 +166,7 @@ int arch_vcpu_run(struct vcpu *vcpu)
 		return -ESRCH;
         break;
 	}
+    vm_exit_stat_account(vcpu, exit_type, start, entry, exit);
 
     if (vcpu->vm->vm_status == VM_STATE_HALT) {
         ret = -ESRCH;
@@ -15,11 +15,17 @@
 #include <virtualization/arm/switch.h>
 #include <virtualization/arm/sysreg.h>
 
-void vcpu_sysreg_load(struct vcpu *vcpu)
+/* The vcpu whose el1 system registers are live on each pcpu. */
+static struct vcpu *loaded_vcpu[CONFIG_MP_NUM_CPUS];
+
+/**
+ * @brief Move guest's el1 system registers to the pcpu. Registers that
+ * host code also touches (csselr_el1, par_el1) are not in this set.
+ */
+static void vcpu_el1_sysreg_load(struct vcpu *vcpu)
 {
     struct zvm_vcpu_context *g_context = &vcpu->arch->ctxt;
 
-    write_csselr_el1(g_context->sys_regs[VCPU_CSSELR_EL1]);
     write_vmpidr_el2(g_context->sys_regs[VCPU_MPIDR_EL1]);
     write_sctlr_el12(g_context->sys_regs[VCPU_SCTLR_EL1]);
     write_tcr_el12(g_context->sys_regs[VCPU_TCR_EL1]);
@@ -35,24 +41,19 @@ void vcpu_sysreg_load(struct vcpu *vcpu)
     write_contextidr_el12(g_context->sys_regs[VCPU_CONTEXTIDR_EL1]);
     write_amair_el12(g_context->sys_regs[VCPU_AMAIR_EL1]);
     write_cntkctl_el12(g_context->sys_regs[VCPU_CNTKCTL_EL1]);
-    write_par_el1(g_context->sys_regs[VCPU_PAR_EL1]);
     write_tpidr_el1(g_context->sys_regs[VCPU_TPIDR_EL1]);
     write_sp_el1(g_context->sys_regs[VCPU_SP_EL1]);
     write_elr_el12(g_context->sys_regs[VCPU_ELR_EL1]);
     write_spsr_el12(g_context->sys_regs[VCPU_SPSR_EL1]);
 
     vcpu->arch->vcpu_sys_register_loaded = true;
-    write_hstr_el2(BIT(15));
-    vcpu->arch->host_mdcr_el2 = read_mdcr_el2();
-    write_mdcr_el2(vcpu->arch->guest_mdcr_el2);
 }
 
-void vcpu_sysreg_save(struct vcpu *vcpu)
+static void vcpu_el1_sysreg_save(struct vcpu *vcpu)
 {
     struct zvm_vcpu_context *g_context = &vcpu->arch->ctxt;
 
     g_context->sys_regs[VCPU_MPIDR_EL1] = read_vmpidr_el2();
-    g_context->sys_regs[VCPU_CSSELR_EL1] = read_csselr_el1();
     g_context->sys_regs[VCPU_ACTLR_EL1] = read_actlr_el1();
 
     g_context->sys_regs[VCPU_SCTLR_EL1] = read_sctlr_el12();
@@ -70,13 +71,92 @@ void vcpu_sysreg_save(struct vcpu *vcpu)
     g_context->sys_regs[VCPU_AMAIR_EL1] = read_amair_el12();
     g_context->sys_regs[VCPU_CNTKCTL_EL1] = read_cntkctl_el12();
 
-    g_context->sys_regs[VCPU_PAR_EL1] = read_par_el1();
     g_context->sys_regs[VCPU_TPIDR_EL1] = read_tpidr_el1();
-    g_context->regs.esf_handle_regs.elr = read_elr_el12();
-    g_context->regs.esf_handle_regs.spsr = read_spsr_el12();
+    g_context->sys_regs[VCPU_SP_EL1] = read_sp_el1();
+    g_context->sys_regs[VCPU_ELR_EL1] = read_elr_el12();
+    g_context->sys_regs[VCPU_SPSR_EL1] = read_spsr_el12();
     vcpu->arch->vcpu_sys_register_loaded = false;
 }
 
+void vcpu_sysreg_load(struct vcpu *vcpu)
+{
+    int cpu = _current_cpu->id;
+    struct vcpu *last_vcpu = loaded_vcpu[cpu];
+    struct zvm_vcpu_context *g_context = &vcpu->arch->ctxt;
+
+    /**
+     * Same vcpu comes back and nobody used the pcpu's el1 registers in
+     * between, they are still what this vcpu left there.
+     */
+    if (last_vcpu != vcpu || !vcpu->arch->vcpu_sys_register_loaded) {
+        if (last_vcpu && last_vcpu != vcpu
+                && last_vcpu->arch->vcpu_sys_register_loaded) {
+            vcpu_el1_sysreg_save(last_vcpu);
+        }
+        vcpu_el1_sysreg_load(vcpu);
+        loaded_vcpu[cpu] = vcpu;
+    }
+
+    write_csselr_el1(g_context->sys_regs[VCPU_CSSELR_EL1]);
+    write_par_el1(g_context->sys_regs[VCPU_PAR_EL1]);
+
+    write_hstr_el2(BIT(15));
+    vcpu->arch->host_mdcr_el2 = read_mdcr_el2();
+    write_mdcr_el2(vcpu->arch->guest_mdcr_el2);
+}
+
+void vcpu_sysreg_save(struct vcpu *vcpu)
+{
+    struct zvm_vcpu_context *g_context = &vcpu->arch->ctxt;
+
+    g_context->sys_regs[VCPU_CSSELR_EL1] = read_csselr_el1();
+    g_context->sys_regs[VCPU_PAR_EL1] = read_par_el1();
+
+#ifndef CONFIG_ZVM_VCPU_LAZY_SYSREG
+    vcpu_el1_sysreg_save(vcpu);
+    loaded_vcpu[_current_cpu->id] = NULL;
+#endif
+}
+
+void vcpu_sysreg_drop(struct vcpu *vcpu)
+{
+    int i;
+
+    for (i = 0; i < CONFIG_MP_NUM_CPUS; i++) {
+        if (loaded_vcpu[i] == vcpu) {
+            loaded_vcpu[i] = NULL;
+        }
+    }
+    vcpu->arch->vcpu_sys_register_loaded = false;
+}
+
+void vcpu_sysreg_flush(struct vcpu *vcpu)
+{
+    int cpu = _current_cpu->id;
+
+    if (loaded_vcpu[cpu] != vcpu) {
+        return;
+    }
+    if (vcpu->arch->vcpu_sys_register_loaded) {
+        vcpu_el1_sysreg_save(vcpu);
+    }
+    loaded_vcpu[cpu] = NULL;
+}
+
+void vcpu_sysreg_reload(struct vcpu *vcpu)
+{
+    struct zvm_vcpu_context *g_context = &vcpu->arch->ctxt;
+
+    if (loaded_vcpu[_current_cpu->id] != vcpu
+            || !vcpu->arch->vcpu_sys_register_loaded) {
+        return;
+    }
+
+    vcpu_el1_sysreg_load(vcpu);
+    write_csselr_el1(g_context->sys_regs[VCPU_CSSELR_EL1]);
+    write_par_el1(g_context->sys_regs[VCPU_PAR_EL1]);
+}
+
 
 void switch_to_guest_sysreg(struct vcpu *vcpu)
 {
@@ -100,7 +180,12 @@ void switch_to_guest_sysreg(struct vcpu *vcpu)
     reg_val |= CPACR_EL1_TTA;
     reg_val &= ~CPACR_EL1_ZEN;
     reg_val |= CPTR_EL2_TAM;
-    reg_val |= CPACR_EL1_FPEN_NOTRAP;
+    /* trap guest's fp/simd access until its context is loaded */
+    if (vcpu->arch->vcpu_fpsimd_loaded) {
+        reg_val |= CPACR_EL1_FPEN_NOTRAP;
+    } else {
+        reg_val &= ~CPACR_EL1_FPEN_NOTRAP;
+    }
     write_cpacr_el1(reg_val);
     write_vbar_el2((uint64_t)_hyp_vector_table);
 
@@ -139,6 +224,9 @@ void switch_to_host_sysreg(struct vcpu *vcpu)
     write_hcr_el2(HCR_VHE_FLAGS);
     write_vbar_el2((uint64_t)_vector_table);
 
+    /* host code may use fp/simd, never trap it at el2 */
+    write_cpacr_el1(read_cpacr_el1() | CPACR_EL1_FPEN_NOTRAP);
+
     /* save vm's stage-2 pgd */
     vcpu->vm->arch->vtcr_el2 = read_vtcr_el2();
     vcpu->vm->arch->vttbr = read_vttbr_el2();
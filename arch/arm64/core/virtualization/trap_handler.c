@@ -7,17 +7,24 @@
 #include <zephyr.h>
 #include <init.h>
 #include <device.h>
+#include <arch/arm64/lib_helpers.h>
 #include <virtualization/zvm.h>
 #include <virtualization/vm_dev.h>
+#include <virtualization/vm_hypercall.h>
 #include <virtualization/arm/mm.h>
 #include <virtualization/arm/trap_handler.h>
 #include <virtualization/arm/cpu.h>
+#include <virtualization/arm/psci.h>
 #include <virtualization/arm/asm.h>
 #include <virtualization/arm/vtimer.h>
 #include <virtualization/vdev/vgic_v3.h>
+#include <virtualization/tools/latency_measure.h>
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
+/* ESR_EL2.ISS.TI for trapped wfi/wfe: 0 is wfi, 1 is wfe */
+#define ESR_WFX_ISS_TI_WFE      BIT(0)
+
 static uint64_t wzr_reg = 0;
 
 static inline uint64_t* find_index_reg(uint16_t index, arch_commom_regs_t *regs)
@@ -40,12 +47,20 @@ static int handle_ftrans_desc(int iss_dfsc, uint64_t pa_addr,
     int ret = 0;
     struct vcpu *vcpu = _current_vcpu;
 
-#ifdef CONFIG_VM_DYNAMIC_MEMORY
-    /* TODO: Add dynamic memory allocate. */
-#else
     uint16_t reg_index = dabt->srt;
     uint64_t *reg_value;
 
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    /* Guest ram is populated when it is first touched. */
+    ret = vm_mem_block_fault(vcpu->vm, pa_addr);
+    if (ret != -ESRCH) {
+        if (!ret) {
+            vcpu->arch->ctxt.regs.pc -= AARCH64_INST_ADJUST;
+        }
+        return ret;
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
     /* check that if it is a device memory fault */
     ret = handle_vm_device_emulate(vcpu->vm, pa_addr);
     if(ret){
@@ -60,7 +75,6 @@ static int handle_ftrans_desc(int iss_dfsc, uint64_t pa_addr,
         vm_mem_domain_partitions_add(vcpu->vm->vmem_domain);
         vcpu->arch->ctxt.regs.pc -= AARCH64_INST_ADJUST;
     }
-#endif
     return ret;
 }
 
@@ -124,6 +138,7 @@ static int cpu_wfi_wfe_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
 {
     int ret;
     struct vcpu *vcpu = _current_vcpu;
+    ARG_UNUSED(arch_ctxt);
 
     /* judge whether the vcpu has pending or active irq */
     ret = vcpu_irq_exit(vcpu);
@@ -131,8 +146,23 @@ static int cpu_wfi_wfe_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
         return 0;   /* There are some irq need to process */
     }
 
-    /* TODO: support wfi and wfe for system.*/
-	return 0;
+    /**
+     * Guest wfe is mostly a spinlock waiting for other vcpu, which
+     * sends an event rather than a virq, so just give up the pcpu.
+     */
+    if (esr_elx & ESR_WFX_ISS_TI_WFE) {
+        k_yield();
+        return 0;
+    }
+
+    /* Host must take vtimer and sgi interrupts while vcpu is idle. */
+    enable_irq();
+    isb();
+    ret = vcpu_wait_for_irq(vcpu);
+    disable_irq();
+    isb();
+
+	return ret;
 }
 
 static int cpu_dmcr_mrc_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
@@ -151,8 +181,14 @@ static int cpu_dmcrr_mrrc_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
 
 static int cpu_simd_fp_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
 {
-    ARG_UNUSED(arch_ctxt);
+    struct vcpu *vcpu = _current_vcpu;
     ARG_UNUSED(esr_elx);
+
+    /* First fp/simd access since vcpu switched in, load its context
+     * and re-execute the trapped instruction. */
+    arch_vcpu_fpsimd_load(vcpu);
+    arch_ctxt->pc -= AARCH64_INST_ADJUST;
+
 	return 0;
 }
 
@@ -165,11 +201,50 @@ static int cpu_il_exe_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
 
 static int cpu_hvc64_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
 {
-    ARG_UNUSED(arch_ctxt);
+    struct vcpu *vcpu = _current_vcpu;
+    /* x0-x3 are contiguous in the saved context */
+    uint64_t *regs = &arch_ctxt->esf_handle_regs.x0;
     ARG_UNUSED(esr_elx);
+
+    if (ZVM_PSCI_IS_CALL(regs[0])) {
+        vcpu_psci_handle(vcpu, regs);
+    } else {
 #ifdef CONFIG_ZVM_TIME_MEASURE
-    vm_irq_timing_print();
+        /* hvc out of the hypercall range still dumps the latency timing */
+        if (!ZVM_HC_IS_ZVM(regs[0])) {
+            vm_irq_timing_print();
+        }
 #endif
+        vm_hypercall_handle(vcpu, regs);
+    }
+
+    /**
+     * The preferred return address of hvc is the next instruction, or
+     * the entry that psci has just set.
+     */
+    arch_ctxt->pc -= AARCH64_INST_ADJUST;
+
+	return 0;
+}
+
+static int cpu_smc64_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_elx)
+{
+    struct vcpu *vcpu = _current_vcpu;
+    uint64_t *regs = &arch_ctxt->esf_handle_regs.x0;
+    ARG_UNUSED(esr_elx);
+
+    /**
+     * Trapped smc returns to itself, step over it first so that psci
+     * sees the same pc as from hvc. Only psci is served by smc.
+     */
+    arch_ctxt->pc += AARCH64_INST_ADJUST;
+    if (ZVM_PSCI_IS_CALL(regs[0])) {
+        vcpu_psci_handle(vcpu, regs);
+    } else {
+        regs[0] = ZVM_PSCI_RET_NOT_SUPPORTED;
+    }
+    arch_ctxt->pc -= AARCH64_INST_ADJUST;
+
 	return 0;
 }
 
@@ -188,6 +263,7 @@ static int cpu_system_msr_mrs_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_e
     }
 
     reg_name = this_esr & ESR_SYSINS_REGS_MASK;
+    vm_exit_stat_mark(vcpu, VM_EXIT_STAT_SYSREG, reg_name);
     switch (reg_name) {
     /* supporte sgi related register here */
     case ESR_SYSINSREG_SGI1R_EL1:
@@ -225,7 +301,30 @@ static int cpu_inst_abort_low_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_e
     uint64_t ipa_ddr;
     ipa_ddr = get_fault_ipa(read_hpfar_el2(), read_far_el2());
     ARG_UNUSED(arch_ctxt);
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    int ret;
+    uint64_t db_esr = esr_elx;
+    struct esr_dabt_area *iabt = (struct esr_dabt_area *)&db_esr;
+
+    /* Instruction fetch from a guest ram block not populated yet. */
+    switch (iabt->dfsc & ~(0x3)) {
+    case DFSC_FT_TRANS_L3:
+    case DFSC_FT_TRANS_L2:
+    case DFSC_FT_TRANS_L1:
+    case DFSC_FT_TRANS_L0:
+        ret = vm_mem_block_fault(_current_vcpu->vm, ipa_ddr);
+        if (ret) {
+            ZVM_LOG_WARN("VM's inst abort addr: 0x%llx ! \n", ipa_ddr);
+            return ret;
+        }
+        _current_vcpu->arch->ctxt.regs.pc -= AARCH64_INST_ADJUST;
+        break;
+    default:
+        break;
+    }
+#else
     ARG_UNUSED(esr_elx);
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
 	return 0;
 }
 
@@ -252,6 +351,8 @@ static int cpu_data_abort_low_sync(arch_commom_regs_t *arch_ctxt, uint64_t esr_e
 
     iss_dfsc = dabt->dfsc & ~(0x3);
     ipa_ddr = get_fault_ipa(read_hpfar_el2(), read_far_el2());
+    vm_exit_stat_mark(_current_vcpu, VM_EXIT_STAT_MMIO,
+            ipa_ddr & ~(BIT64(VM_EXIT_STAT_MMIO_SHIFT) - 1));
 
     switch (iss_dfsc) {
     /* translation fault level0-3*/
@@ -340,6 +441,9 @@ int arch_vm_trap_sync(struct vcpu *vcpu)
         case 0b010110: /* 0x16: "HVC instruction execution in AArch64 state" */
             err = cpu_hvc64_sync(arch_ctxt, esr_elx);
             break;
+        case 0b010111: /* 0x17: "SMC instruction execution in AArch64 state" */
+            err = cpu_smc64_sync(arch_ctxt, esr_elx);
+            break;
         case 0b011000: /* 0x18: "Trapped MSR, MRS or System instruction execution in
                 AArch64 state */
             err = cpu_system_msr_mrs_sync(arch_ctxt, esr_elx);
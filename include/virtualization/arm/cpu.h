@@ -20,7 +20,17 @@
 /* Ignored bit: HCR_TVM, and ignore HCR_TSW to avoid cache DC trap */
 #define HCR_VM_FLAGS (0UL | HCR_VM_BIT | HCR_FB_BIT |   HCR_AMO_BIT | \
 		HCR_FMO_BIT |  HCR_IMO_BIT | HCR_BSU_IS_BIT | HCR_TAC_BIT | HCR_E2H_BIT | \
-		    HCR_TIDCP_BIT | HCR_RW_BIT | HCR_PTW_BIT )
+		    HCR_TIDCP_BIT | HCR_RW_BIT | HCR_PTW_BIT | HCR_TSC_BIT )
+
+/**
+ * Vcpu affinity: aff0 holds 16 vcpus, the range of a sgi target list,
+ * and the next vcpus go to aff1.
+ */
+#define VCPU_AFF0_BITS      (4)
+#define VCPU_AFFINITY(id)   (((((uint64_t)(id)) >> VCPU_AFF0_BITS) << 8) | \
+                            ((uint64_t)(id) & BIT_MASK(VCPU_AFF0_BITS)))
+#define VCPU_MPIDR(id)      (BIT(31) | VCPU_AFFINITY(id))
+#define VCPU_MPIDR_AFF_MASK (0xff00ffffffUL)
 
 #define VTTBR_VMID_SHIFT	(48UL)
 #define VTTBR_VMID_MASK(size) (((1UL << (uint64_t)size) - 1UL) << VTTBR_VMID_SHIFT)
@@ -52,6 +62,14 @@
 #define ICH_LR5_EL2         S3_4_C12_C12_5
 #define ICH_LR6_EL2         S3_4_C12_C12_6
 #define ICH_LR7_EL2         S3_4_C12_C12_7
+#define ICH_LR8_EL2         S3_4_C12_C13_0
+#define ICH_LR9_EL2         S3_4_C12_C13_1
+#define ICH_LR10_EL2        S3_4_C12_C13_2
+#define ICH_LR11_EL2        S3_4_C12_C13_3
+#define ICH_LR12_EL2        S3_4_C12_C13_4
+#define ICH_LR13_EL2        S3_4_C12_C13_5
+#define ICH_LR14_EL2        S3_4_C12_C13_6
+#define ICH_LR15_EL2        S3_4_C12_C13_7
 
 /* commom reg macro */
 #define __SYSREG_c0  0
@@ -170,6 +188,7 @@ struct zvm_vcpu_context {
     struct arch_commom_regs regs;
     struct vcpu *running_vcpu;
     uint64_t sys_regs[VCPU_SYS_REG_NUM];
+    struct z_arm64_fp_context fp_regs;
 };
 typedef struct zvm_vcpu_context zvm_vcpu_context_t;
 
@@ -188,6 +207,8 @@ struct vcpu_arch {
     bool pause;
     bool first_run_vcpu;
     bool vcpu_sys_register_loaded;
+    /* vcpu's fp/simd context is on the pcpu's registers */
+    bool vcpu_fpsimd_loaded;
 
     /* HYP configuration. */
     uint64_t hcr_el2;
@@ -198,6 +219,11 @@ struct vcpu_arch {
     /* arm gic list register bitmap for recording used lr */
     uint64_t list_regs_map;
 
+    /* psci power state, and the entry cpu_on gives to an off vcpu */
+    atomic_t psci_state;
+    uint64_t psci_entry;
+    uint64_t psci_context_id;
+
     /* Exception information. */
     struct vcpu_fault_info fault;
 
@@ -219,8 +245,26 @@ int zvm_arch_init(void *op);
  * @brief init vcpu arch related struct here.
  */
 int arch_vcpu_init(struct vcpu *vcpu);
+
+/**
+ * @brief release the pcpu state that still refers to vcpu, before
+ * the vcpu is freed.
+ */
+void arch_vcpu_deinit(struct vcpu *vcpu);
 void arch_vcpu_context_save(struct vcpu *vcpu);
 void arch_vcpu_context_load(struct vcpu *vcpu);
 
+/**
+ * @brief Restore vcpu's fp/simd context to the pcpu, if it is not
+ * loaded yet.
+ */
+void arch_vcpu_fpsimd_load(struct vcpu *vcpu);
+
+/**
+ * @brief Reset vcpu's registers to boot from @entry with @context_id in
+ * x0, as psci cpu_on asks. The vcpu may be the running one.
+ */
+void arch_vcpu_power_on(struct vcpu *vcpu, uint64_t entry, uint64_t context_id);
+
 
 #endif  /*ZEPHYR_INCLUDE_ZVM_ARM_CPU_H_*/
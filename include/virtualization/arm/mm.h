@@ -121,12 +121,27 @@ int arch_unmap_vma_to_block(uintptr_t virt, size_t size);
 int arch_vm_mem_domain_partition_add(struct k_mem_domain *domain,
 				  uint32_t partition_id, uintptr_t phys_start, uint32_t vmid);
 
+/**
+ * @brief Map a block of guest ram at @gpa to @hpa for the vm.
+ */
+int arch_vm_mem_block_map(struct vm *vm, uint64_t hpa, uint64_t gpa,
+				uint64_t size, uint32_t attrs);
+int arch_vm_mem_block_unmap(struct vm *vm, uint64_t gpa, uint64_t size);
+
 /**
  * @brief remove a partition from the vm virtual memory domain.
  */
 int arch_vm_mem_domain_partition_remove(struct k_mem_domain *domain,
 					uint32_t partition_id, uint32_t vmid);
 
+/**
+ * @brief Defer the stage-2 tlb invalidation of the mapping changes of @vm
+ * until the batch ends, so the batch costs a single tlbi sequence. The
+ * batches can be nested.
+ */
+void arch_vm_s2_tlb_batch_start(struct vm *vm);
+void arch_vm_s2_tlb_batch_end(struct vm *vm);
+
 /**
  * @brief Architecture-specific hook for vm domain initialization.
  */
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ZEPHYR_INCLUDE_ZVM_ARM_PSCI_H_
+#define ZEPHYR_INCLUDE_ZVM_ARM_PSCI_H_
+
+#include <zephyr.h>
+#include <stdint.h>
+
+/**
+ * PSCI 1.0 function ids, the guest calls them through hvc or smc. The
+ * SMC64 bit gives the 64-bit version of the functions with address
+ * arguments, the 32-bit version only uses the low half of x1-x3.
+ */
+#define ZVM_PSCI_FN_BASE            (0x84000000UL)
+#define ZVM_PSCI_FN_SMC64_BIT       (0x40000000UL)
+#define ZVM_PSCI_FN_MASK            (0x0000001fUL)
+#define ZVM_PSCI_IS_CALL(id)        \
+        (((id) & ~(ZVM_PSCI_FN_SMC64_BIT | ZVM_PSCI_FN_MASK)) == ZVM_PSCI_FN_BASE)
+
+#define ZVM_PSCI_FN_VERSION             (0x00)
+#define ZVM_PSCI_FN_CPU_SUSPEND         (0x01)
+#define ZVM_PSCI_FN_CPU_OFF             (0x02)
+#define ZVM_PSCI_FN_CPU_ON              (0x03)
+#define ZVM_PSCI_FN_AFFINITY_INFO       (0x04)
+#define ZVM_PSCI_FN_MIGRATE_INFO_TYPE   (0x06)
+#define ZVM_PSCI_FN_SYSTEM_OFF          (0x08)
+#define ZVM_PSCI_FN_SYSTEM_RESET        (0x09)
+#define ZVM_PSCI_FN_FEATURES            (0x0a)
+
+#define ZVM_PSCI_VERSION_VALUE          ((1U << 16) | 0U)
+
+/* MIGRATE_INFO_TYPE: no trusted os that needs migration */
+#define ZVM_PSCI_TOS_NOT_PRESENT        (2)
+
+/* Return codes */
+#define ZVM_PSCI_RET_SUCCESS            (0)
+#define ZVM_PSCI_RET_NOT_SUPPORTED      (-1)
+#define ZVM_PSCI_RET_INVALID_PARAMS     (-2)
+#define ZVM_PSCI_RET_DENIED             (-3)
+#define ZVM_PSCI_RET_ALREADY_ON         (-4)
+#define ZVM_PSCI_RET_ON_PENDING         (-5)
+#define ZVM_PSCI_RET_INTERNAL_FAILURE   (-6)
+
+/* Vcpu power states, the values are what AFFINITY_INFO returns */
+#define ZVM_PSCI_STATE_ON               (0)
+#define ZVM_PSCI_STATE_OFF              (1)
+#define ZVM_PSCI_STATE_ON_PENDING       (2)
+
+struct vcpu;
+
+/**
+ * @brief Init the power state of vcpu, only the boot vcpu is on.
+ */
+void vcpu_psci_init(struct vcpu *vcpu);
+
+/**
+ * @brief Handle a psci call of vcpu.
+ * @param regs x0-x3 of the guest, x0 gets the result.
+ */
+void vcpu_psci_handle(struct vcpu *vcpu, uint64_t *regs);
+
+#endif /* ZEPHYR_INCLUDE_ZVM_ARM_PSCI_H_ */
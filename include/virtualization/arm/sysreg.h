@@ -17,9 +17,29 @@ void vcpu_sysreg_load(struct vcpu *vcpu);
 
 /**
  * @brief store system register to vcpu struct for keeping the VM state.
+ * With CONFIG_ZVM_VCPU_LAZY_SYSREG, el1 registers stay on the pcpu and
+ * are only saved when another vcpu is loaded there.
  */
 void vcpu_sysreg_save(struct vcpu *vcpu);
 
+/**
+ * @brief Forget vcpu's registers left on any pcpu, the in-memory copy is
+ * used on next load. Called when vcpu is reset or freed.
+ */
+void vcpu_sysreg_drop(struct vcpu *vcpu);
+
+/**
+ * @brief Save vcpu's el1 registers left on the current pcpu to memory,
+ * called on the old pcpu before the vcpu resumes on another one.
+ */
+void vcpu_sysreg_flush(struct vcpu *vcpu);
+
+/**
+ * @brief Write vcpu's el1 registers in memory to the pcpu again, when
+ * the running vcpu changes them, e.g. on its psci power on.
+ */
+void vcpu_sysreg_reload(struct vcpu *vcpu);
+
 /**
  * @brief Load guest system register.
 */
@@ -19,4 +19,7 @@ int vm_entry_irq_time(void);
 /*print vm irq timing measure value*/
 void vm_irq_timing_print(void);
 
+/* init the timing counter before measuring */
+void zvm_init_mtiming(void);
+
 #endif /* __LANTENCY_MEASURE_H_ */
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ZEPHYR_INCLUDE_ZVM_TOOLS_VM_EXIT_STAT_H_
+#define ZEPHYR_INCLUDE_ZVM_TOOLS_VM_EXIT_STAT_H_
+
+#include <zephyr.h>
+#include <stdint.h>
+#include <errno.h>
+
+struct vm;
+struct vcpu;
+
+/* ESR_EL2.EC has 6 bits */
+#define VM_EXIT_STAT_EC_NUM         (64)
+/* log2 buckets of exit handling cycles, the last one holds the rest */
+#define VM_EXIT_STAT_HIST_NUM       (16)
+/* distinct mmio pages or sysregs recorded for each vcpu */
+#define VM_EXIT_STAT_KEY_NUM        (16)
+/* mmio exits are bucketed by the 4K page of the fault ipa */
+#define VM_EXIT_STAT_MMIO_SHIFT     (12)
+
+/**
+ * @brief Exit reasons, from the exception type that guest_vm_entry returns.
+ */
+enum vm_exit_stat_reason {
+    VM_EXIT_STAT_SYNC = 0,
+    VM_EXIT_STAT_IRQ,
+    VM_EXIT_STAT_SERROR,
+    VM_EXIT_STAT_OTHER,
+    VM_EXIT_STAT_REASON_NUM,
+};
+
+/**
+ * @brief Keyed tables, which break down the sync exits further.
+ */
+enum vm_exit_stat_table {
+    VM_EXIT_STAT_MMIO = 0,
+    VM_EXIT_STAT_SYSREG,
+    VM_EXIT_STAT_TABLE_NUM,
+};
+
+struct vm_exit_stat_entry {
+    uint32_t count;
+    uint64_t cycles;
+};
+
+struct vm_exit_stat_slot {
+    uint64_t key;
+    struct vm_exit_stat_entry entry;
+};
+
+/**
+ * @brief Exit accounting of a vcpu. It is only updated by the vcpu
+ * thread itself, so a reader may see a slightly stale copy while
+ * the vcpu is running. Cycles are counted in k_cycle_get_32() units.
+ */
+struct vm_exit_stat {
+    /* time running guest code, and handling its exits in zvm */
+    uint64_t guest_cycles;
+    uint64_t hyp_cycles;
+    /* time the vcpu is idle in wfi, not counted in hyp_cycles */
+    uint64_t idle_cycles;
+
+    struct vm_exit_stat_entry reason[VM_EXIT_STAT_REASON_NUM];
+    uint32_t hist[VM_EXIT_STAT_REASON_NUM][VM_EXIT_STAT_HIST_NUM];
+    struct vm_exit_stat_entry ec[VM_EXIT_STAT_EC_NUM];
+
+    struct vm_exit_stat_slot table[VM_EXIT_STAT_TABLE_NUM][VM_EXIT_STAT_KEY_NUM];
+    /* exits that can not get a slot in the table */
+    uint32_t table_miss[VM_EXIT_STAT_TABLE_NUM];
+
+    /* state of the exit being handled */
+    struct vm_exit_stat_slot *mark;
+    uint32_t exit_idle;
+};
+
+#ifdef CONFIG_ZVM_EXIT_STAT
+
+#define VM_EXIT_STAT_CYCLES()   k_cycle_get_32()
+
+/**
+ * @brief Attribute the exit being handled to a key of the table,
+ * e.g. the fault ipa of a mmio exit or the esr encoding of a sysreg.
+ */
+void vm_exit_stat_mark(struct vcpu *vcpu, enum vm_exit_stat_table table, uint64_t key);
+
+/**
+ * @brief Record the cycles that vcpu waits for irq in the current exit.
+ */
+void vm_exit_stat_idle(struct vcpu *vcpu, uint32_t cycles);
+
+/**
+ * @brief Account an exit when it is handled. @start is the time vcpu
+ * begins to prepare the entry, @entry and @exit are the times around
+ * guest running.
+ */
+void vm_exit_stat_account(struct vcpu *vcpu, uint16_t exit_type,
+            uint32_t start, uint32_t entry, uint32_t exit);
+
+/**
+ * @brief Copy the exit statistics of a vcpu, for benchmarks and tools.
+ */
+int vm_exit_stat_get(struct vm *vm, uint16_t vcpu_id, struct vm_exit_stat *stat);
+
+/**
+ * @brief Clear the exit statistics of all the vcpus of a vm.
+ */
+int vm_exit_stat_reset(struct vm *vm);
+
+/**
+ * @brief Print the exit statistics of a vm.
+ */
+int vm_exit_stat_print(struct vm *vm);
+
+#else
+
+#define VM_EXIT_STAT_CYCLES()   (0)
+
+static inline void vm_exit_stat_mark(struct vcpu *vcpu,
+            enum vm_exit_stat_table table, uint64_t key)
+{
+    ARG_UNUSED(vcpu);
+    ARG_UNUSED(table);
+    ARG_UNUSED(key);
+}
+
+static inline void vm_exit_stat_idle(struct vcpu *vcpu, uint32_t cycles)
+{
+    ARG_UNUSED(vcpu);
+    ARG_UNUSED(cycles);
+}
+
+static inline void vm_exit_stat_account(struct vcpu *vcpu, uint16_t exit_type,
+            uint32_t start, uint32_t entry, uint32_t exit)
+{
+    ARG_UNUSED(vcpu);
+    ARG_UNUSED(exit_type);
+    ARG_UNUSED(start);
+    ARG_UNUSED(entry);
+    ARG_UNUSED(exit);
+}
+
+static inline int vm_exit_stat_get(struct vm *vm, uint16_t vcpu_id,
+            struct vm_exit_stat *stat)
+{
+    ARG_UNUSED(vm);
+    ARG_UNUSED(vcpu_id);
+    ARG_UNUSED(stat);
+    return -ENOTSUP;
+}
+
+static inline int vm_exit_stat_reset(struct vm *vm)
+{
+    ARG_UNUSED(vm);
+    return -ENOTSUP;
+}
+
+static inline int vm_exit_stat_print(struct vm *vm)
+{
+    ARG_UNUSED(vm);
+    return -ENOTSUP;
+}
+
+#endif /* CONFIG_ZVM_EXIT_STAT */
+
+#endif /* ZEPHYR_INCLUDE_ZVM_TOOLS_VM_EXIT_STAT_H_ */
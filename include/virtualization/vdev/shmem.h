@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ZEPHYR_INCLUDE_ZVM_VDEV_SHMEM_H_
+#define ZEPHYR_INCLUDE_ZVM_VDEV_SHMEM_H_
+
+#include <zephyr.h>
+#include <stdint.h>
+
+/**
+ * Inter-vm shared memory channels. Each channel is CONFIG_VM_SHMEM_SIZE
+ * bytes of host memory, mapped as normal memory at the same ipa in the
+ * stage-2 table of every vm, so guests exchange data without any copy
+ * in zvm. The doorbell page is emulated, a write to VM_SHMEM_DOORBELL
+ * injects CONFIG_VM_SHMEM_VIRQ into the peer vm and marks the channel
+ * in the peer's VM_SHMEM_PENDING register.
+ * Guests lay a ring of <virtualization/vdev/shmem_ring.h> in a channel.
+ */
+
+#define VM_SHMEM_MAGIC_VALUE    (0x4d48535aU)   /* "ZSHM" */
+#define VM_SHMEM_VERSION_VALUE  (1)
+
+/* Doorbell page registers, 32-bit access */
+#define VM_SHMEM_MAGIC          (0x00)
+#define VM_SHMEM_VERSION        (0x04)
+#define VM_SHMEM_VMID           (0x08)
+#define VM_SHMEM_CHANNELS       (0x0c)
+#define VM_SHMEM_CHANNEL_SIZE   (0x10)
+#define VM_SHMEM_BASE           (0x14)
+/* bitmap of vmids that have the channels mapped */
+#define VM_SHMEM_PEERS          (0x18)
+/* bitmap of channels rung to this vm, cleared by the read */
+#define VM_SHMEM_PENDING        (0x1c)
+/* write (channel << 16) | vmid, vmid VM_SHMEM_ALL_PEERS for all others */
+#define VM_SHMEM_DOORBELL       (0x20)
+#define VM_SHMEM_VIRQ           (0x24)
+
+#define VM_SHMEM_DOORBELL_SIZE  (0x1000)
+#define VM_SHMEM_ALL_PEERS      (0xffff)
+
+#define VM_SHMEM_CHANNEL_IPA(ch) \
+        (CONFIG_VM_SHMEM_IPA_BASE + (uint64_t)(ch) * CONFIG_VM_SHMEM_SIZE)
+
+struct vm;
+
+#ifdef CONFIG_VM_SHMEM
+
+/**
+ * @brief Map the channels and the doorbell to @vm, called when the vm
+ * devices are created.
+ */
+int vm_shmem_create(struct vm *vm);
+
+/**
+ * @brief Remove @vm from the peers, the mapping itself goes with the
+ * vm memory domain.
+ */
+void vm_shmem_remove(struct vm *vm);
+
+#else
+
+static inline int vm_shmem_create(struct vm *vm)
+{
+    ARG_UNUSED(vm);
+    return 0;
+}
+
+static inline void vm_shmem_remove(struct vm *vm)
+{
+    ARG_UNUSED(vm);
+}
+
+#endif /* CONFIG_VM_SHMEM */
+
+#endif /* ZEPHYR_INCLUDE_ZVM_VDEV_SHMEM_H_ */
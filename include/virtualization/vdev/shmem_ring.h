@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ZEPHYR_INCLUDE_ZVM_VDEV_SHMEM_RING_H_
+#define ZEPHYR_INCLUDE_ZVM_VDEV_SHMEM_RING_H_
+
+/**
+ * Lock-free single producer single consumer ring, laid out in a shared
+ * memory channel of vm_shmem. It only uses C11 style atomics of gcc, so
+ * both zephyr and linux guests can use this header as is.
+ *
+ * The producer owns @head and the consumer owns @tail, each of them on
+ * its own cache line. Slots hold a 32-bit length and the payload, and
+ * are published by a release store of @head, consumed by a release
+ * store of @tail. The producer rings the doorbell when the consumer
+ * had drained the ring before the push, the consumer drains the ring
+ * on the virq. A full fence on each side, between its own store and
+ * the load of the other index, keeps the last wakeup from being lost.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define VM_SHMEM_RING_MAGIC         (0x474e4952U)   /* "RING" */
+#define VM_SHMEM_RING_ALIGN         (64)
+
+struct vm_shmem_ring {
+    uint32_t magic;
+    /* bytes of a slot, including the length word */
+    uint32_t slot_size;
+    /* power of 2 */
+    uint32_t slot_num;
+    uint32_t reserved;
+
+    uint32_t head __attribute__((aligned(VM_SHMEM_RING_ALIGN)));
+    uint32_t tail __attribute__((aligned(VM_SHMEM_RING_ALIGN)));
+
+    uint8_t slots[] __attribute__((aligned(VM_SHMEM_RING_ALIGN)));
+};
+
+struct vm_shmem_slot {
+    uint32_t len;
+    uint8_t data[];
+};
+
+static inline struct vm_shmem_slot *vm_shmem_ring_slot(struct vm_shmem_ring *ring,
+            uint32_t idx)
+{
+    return (struct vm_shmem_slot *)&ring->slots[(size_t)(idx & (ring->slot_num - 1)) *
+            ring->slot_size];
+}
+
+/**
+ * @brief Format a ring in @size bytes of shared memory, done by the
+ * producer before it tells the consumer about the channel.
+ * @return 0 on success, -1 if the memory can not hold two slots.
+ */
+static inline int vm_shmem_ring_init(struct vm_shmem_ring *ring, size_t size,
+            uint32_t slot_size)
+{
+    uint32_t num = 1;
+    size_t space = size - offsetof(struct vm_shmem_ring, slots);
+
+    slot_size = (slot_size + sizeof(uint32_t) + VM_SHMEM_RING_ALIGN - 1) &
+            ~(uint32_t)(VM_SHMEM_RING_ALIGN - 1);
+    if (size <= offsetof(struct vm_shmem_ring, slots) || space / slot_size < 2) {
+        return -1;
+    }
+    while ((size_t)num * 2 * slot_size <= space) {
+        num *= 2;
+    }
+
+    ring->slot_size = slot_size;
+    ring->slot_num = num;
+    ring->reserved = 0;
+    __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->magic, VM_SHMEM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static inline uint32_t vm_shmem_ring_used(struct vm_shmem_ring *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+            __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Copy @len bytes into the next slot, producer only.
+ * @return 1 if the consumer had drained the ring once the slot was
+ * published, so it needs a doorbell, 0 if not, -1 if the ring is full
+ * or @len is too big.
+ */
+static inline int vm_shmem_ring_push(struct vm_shmem_ring *ring,
+            const void *data, uint32_t len)
+{
+    struct vm_shmem_slot *slot;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= ring->slot_num || len > ring->slot_size - sizeof(uint32_t)) {
+        return -1;
+    }
+
+    slot = vm_shmem_ring_slot(ring, head);
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    /* The consumer may have gone idle since @tail was loaded above. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    return head == tail;
+}
+
+/**
+ * @brief Copy the oldest slot out to @data of @size bytes, consumer only.
+ * @return length of the slot, or -1 if the ring is empty or @size is
+ * smaller than the slot, which is left in the ring then.
+ */
+static inline int vm_shmem_ring_pop(struct vm_shmem_ring *ring,
+            void *data, uint32_t size)
+{
+    uint32_t len, head;
+    struct vm_shmem_slot *slot;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    /* Pairs with the fence of push, orders the last @tail store. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return -1;
+    }
+
+    slot = vm_shmem_ring_slot(ring, tail);
+    len = slot->len;
+    if (len > size) {
+        return -1;
+    }
+    memcpy(data, slot->data, len);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return (int)len;
+}
+
+#endif /* ZEPHYR_INCLUDE_ZVM_VDEV_SHMEM_RING_H_ */
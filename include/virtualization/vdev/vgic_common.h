@@ -43,6 +43,10 @@ struct virt_dev;
 
 #define VGIC_RESERVED		0x0F30
 #define VGIC_INMIRn			0x0f80
+#define VGICD_IROUTER_SPI	(GIC_DIST_IROUTER + VM_LOCAL_VIRQ_NR * 8)
+#define VGICD_IROUTER_END	(GIC_DIST_IROUTER + VM_GLOBAL_VIRQ_NR * 8)
+/* GICD_IROUTER.IRM: route to any pe, instead of the given affinity */
+#define VGICD_IROUTER_IRM	BIT(31)
 #define VGICD_PIDR2			0xFFE8
 
 /* Vgic control block flag */
@@ -149,6 +153,12 @@ int set_virq_to_vcpu(struct vcpu *vcpu, uint32_t virq_num);
  */
 int set_virq_to_vm(struct vm *vm, uint32_t virq_num);
 
+/**
+ * @brief Make vcpu see its new pending virqs soon: wake it from wfi, or
+ * kick it out of the guest when it runs on another pcpu.
+ */
+void vgic_vcpu_kick(struct vcpu *vcpu);
+
 
 int virt_irq_sync_vgic(struct vcpu *vcpu);
 
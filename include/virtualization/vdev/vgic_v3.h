@@ -11,6 +11,7 @@
 #include <kernel.h>
 #include <devicetree.h>
 #include <spinlock.h>
+#include <sys/math_extras.h>
 #include <drivers/interrupt_controller/gic.h>
 #include <arch/arm64/sys_io.h>
 #include <virtualization/vm_dev.h>
@@ -22,6 +23,12 @@
 #define SGI_SIG_TO_LIST		(0)
 #define SGI_SIG_TO_OTHERS	(1)
 
+/* Fields of the guest's ICC_SGI1R_EL1 value */
+#define VGIC_SGIR_AFF_MASK	(0xff)
+#define VGIC_SGIR_RS_SHIFT	(44)
+#define VGIC_SGIR_RS_MASK	(0xf)
+#define VGIC_SGIR_AFF23_MASK	((0xffUL << SGIR_AFF2_SHIFT) | (0xffUL << SGIR_AFF3_SHIFT))
+
 /* vgic macro here */
 #define VGIC_MAX_VCPU       64
 #define VGIC_UNDEFINE_ADDR  0xFFFFFFFF
@@ -80,14 +87,8 @@
  * @brief vcpu vgicv3 register interface.
  */
 struct gicv3_vcpuif_ctxt {
-   	uint64_t ich_lr0_el2;
-	uint64_t ich_lr1_el2;
-	uint64_t ich_lr2_el2;
-	uint64_t ich_lr3_el2;
-	uint64_t ich_lr4_el2;
-	uint64_t ich_lr5_el2;
-	uint64_t ich_lr6_el2;
-	uint64_t ich_lr7_el2;
+	/* only the lrs set in list_regs_map are valid. */
+	uint64_t ich_lr_el2[VGIC_LR_MAX_NUM];
 
 	uint32_t ich_ap0r2_el2;
 	uint32_t ich_ap1r2_el2;
@@ -215,70 +216,33 @@ int vgic_gicrrd_mem_write(struct vcpu *vcpu, struct virt_gic_gicr *gicr,
 int get_vcpu_gicr_type(struct virt_gic_gicr *gicr, uint32_t addr, uint32_t *offset);
 
 /**
- * @brief raise a sgi signal to a vcpu.
+ * @brief raise a sgi signal to the vcpus that the guest's
+ * ICC_SGI1R_EL1 value @sgi_value targets.
  */
 int vgicv3_raise_sgi(struct vcpu *vcpu, unsigned long sgi_value);
 
+/**
+ * @brief Send the kick sgi to pcpu @cpu only, the vcpu running there
+ * exits the guest and flushes its pending virqs.
+ */
+void vgicv3_kick_pcpu(uint16_t cpu);
+
 /**
  * @brief init vgicv3 device for the vm.
 */
 struct vgicv3_dev *vgicv3_dev_init(struct vm *vm);
 
-static ALWAYS_INLINE uint64_t gicv3_read_lr(uint8_t register_id)
-{
-	switch (register_id) {
-	case 0:
-		return read_sysreg(ICH_LR0_EL2);
-	case 1:
-		return read_sysreg(ICH_LR1_EL2);
-	case 2:
-		return read_sysreg(ICH_LR2_EL2);
-	case 3:
-		return read_sysreg(ICH_LR3_EL2);
-	case 4:
-		return read_sysreg(ICH_LR4_EL2);
-	case 5:
-		return read_sysreg(ICH_LR5_EL2);
-	case 6:
-		return read_sysreg(ICH_LR6_EL2);
-	case 7:
-		return read_sysreg(ICH_LR7_EL2);
-	default:
-		return 0;
-	}
-}
+/**
+ * @brief Mask of the list registers that hardware implemented,
+ * it is read from ICH_VTR_EL2 once when vgic is inited.
+ */
+extern uint32_t vgicv3_lrs_mask;
 
-static ALWAYS_INLINE void gicv3_write_lr(uint8_t register_id, uint64_t value)
-{
-	switch (register_id) {
-	case 0:
-		write_sysreg(value, ICH_LR0_EL2);
-		break;
-	case 1:
-		write_sysreg(value, ICH_LR1_EL2);
-		break;
-	case 2:
-		write_sysreg(value, ICH_LR2_EL2);
-		break;
-	case 3:
-		write_sysreg(value, ICH_LR3_EL2);
-		break;
-	case 4:
-		write_sysreg(value, ICH_LR4_EL2);
-		break;
-	case 5:
-		write_sysreg(value, ICH_LR5_EL2);
-		break;
-	case 6:
-		write_sysreg(value, ICH_LR6_EL2);
-		break;
-	case 7:
-		write_sysreg(value, ICH_LR7_EL2);
-		break;
-	default:
-		return;
-	}
-}
+/**
+ * @brief read/write a list register by its index.
+ */
+uint64_t gicv3_read_lr(uint8_t register_id);
+void gicv3_write_lr(uint8_t register_id, uint64_t value);
 
 /**
  * @brief Get virq state from register.
@@ -287,7 +251,7 @@ static ALWAYS_INLINE uint8_t gicv3_get_lr_state(struct vcpu *vcpu, struct virt_i
 {
 	uint64_t value;
 
-	if (desc->id >=  VGIC_TYPER_LR_NUM) {
+	if (desc->id >= VGIC_LR_MAX_NUM) {
 		return 0;
 	}
 	value = gicv3_read_lr(desc->id);
@@ -299,15 +263,14 @@ static ALWAYS_INLINE uint8_t gicv3_get_lr_state(struct vcpu *vcpu, struct virt_i
 /**
  * @brief Find the idle list register.
 */
-static ALWAYS_INLINE uint8_t gicv3_get_idle_lr(struct vcpu *vcpu)
+static ALWAYS_INLINE int gicv3_get_idle_lr(struct vcpu *vcpu)
 {
-	uint8_t i;
-	for (i=0; i<VGIC_TYPER_LR_NUM; i++) {
-		if (!VGIC_LIST_REGS_TEST(i, vcpu)) {
-			return i;
-		}
+	uint32_t idle = ~(uint32_t)vcpu->arch->list_regs_map & vgicv3_lrs_mask;
+
+	if (!idle) {
+		return -1;
 	}
-	return -1;
+	return u32_count_trailing_zeros(idle);
 }
 
 /**
@@ -45,6 +45,11 @@ struct virtio_queue {
 	physical_addr_t		guest_addr;
 	physical_addr_t		host_addr;
 	physical_size_t		total_size;
+
+	/* Private mapping of vring, used when the vring is out of
+	   the guest ram mapping. Released at queue cleanup.  */
+	uint8_t			*host_map_base;
+	physical_size_t		host_map_size;
 };
 
 struct virtio_device_id {
@@ -71,6 +76,8 @@ struct virtio_transport {
 	const char *name;
 
 	int  (*notify)(struct virtio_device *, uint32_t vq);
+	/* Tell the guest that the device configuration changed. */
+	int  (*config_notify)(struct virtio_device *);
 };
 
 struct virtio_emulator {
@@ -228,6 +235,17 @@ uint32_t virtio_buf_to_iovec_write(struct virtio_device *dev,
 				  uint32_t iov_cnt, void *buf,
 				  uint32_t buf_len);
 
+/** Copy contents from guest IO vectors of @src_dev to guest IO vectors
+ *  of @dst_dev, skipping @src_off and @dst_off bytes of them
+ */
+uint32_t virtio_iovec_to_iovec_copy(struct virtio_device *dst_dev,
+				   struct virtio_iovec *dst_iov,
+				   uint32_t dst_cnt, uint32_t dst_off,
+				   struct virtio_device *src_dev,
+				   struct virtio_iovec *src_iov,
+				   uint32_t src_cnt, uint32_t src_off,
+				   uint32_t len);
+
 /** Fill guest IO vectors with zeros */
 void virtio_iovec_fill_zeros(struct virtio_device *dev,
 				 struct virtio_iovec *iov,
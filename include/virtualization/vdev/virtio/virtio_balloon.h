@@ -0,0 +1,73 @@
+/**
+ * @file virtio_balloon.h
+ * @brief VirtIO balloon device defines
+ * The source has been largely adapted from Linux 4.19 or higher:
+ * /include/uapi/linux/virtio_balloon.h
+ */
+
+#ifndef __ZVM_VIRTIO_BALLOON_H__
+#define __ZVM_VIRTIO_BALLOON_H__
+
+#include <stdint.h>
+
+/* Feature bits */
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST	0 /* Tell before reclaiming pages */
+#define VIRTIO_BALLOON_F_STATS_VQ	1 /* Memory Stats virtqueue */
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM	2 /* Deflate balloon on OOM */
+
+/* Size of a PFN in the balloon interface. */
+#define VIRTIO_BALLOON_PFN_SHIFT	12
+
+struct virtio_balloon_config {
+	/* Number of pages host wants Guest to give up. */
+	uint32_t num_pages;
+	/* Number of pages we've actually got in balloon. */
+	uint32_t actual;
+} __attribute__((packed));
+
+#define VIRTIO_BALLOON_S_SWAP_IN	0   /* Amount of memory swapped in */
+#define VIRTIO_BALLOON_S_SWAP_OUT	1   /* Amount of memory swapped out */
+#define VIRTIO_BALLOON_S_MAJFLT		2   /* Number of major faults */
+#define VIRTIO_BALLOON_S_MINFLT		3   /* Number of minor faults */
+#define VIRTIO_BALLOON_S_MEMFREE	4   /* Total amount of free memory */
+#define VIRTIO_BALLOON_S_MEMTOT		5   /* Total amount of memory */
+#define VIRTIO_BALLOON_S_AVAIL		6   /* Available memory as in /proc */
+#define VIRTIO_BALLOON_S_CACHES		7   /* Disk caches */
+#define VIRTIO_BALLOON_S_HTLB_PGALLOC	8  /* Hugetlb page allocations */
+#define VIRTIO_BALLOON_S_HTLB_PGFAIL	9  /* Hugetlb page allocation failures */
+#define VIRTIO_BALLOON_S_NR		10
+
+struct virtio_balloon_stat {
+	uint16_t tag;
+	uint64_t val;
+} __attribute__((packed));
+
+/* What the host knows about the balloon of a vm. */
+struct virtio_balloon_info {
+	/* pages asked by the host and given by the guest */
+	uint32_t target_pages;
+	uint32_t actual_pages;
+	/* pages the guest gave that stayed mapped, a vdev buffer used them */
+	uint32_t busy_pages;
+	/* latest memory statistics of the guest, in bytes or counts */
+	bool stats_valid;
+	uint64_t stats[VIRTIO_BALLOON_S_NR];
+};
+
+struct vm;
+
+/**
+ * @brief Ask the guest of @vm to keep @pages 4K pages in its balloon,
+ * the memory behind them goes back to the host pool.
+ */
+int virtio_balloon_set_target(struct vm *vm, uint32_t pages);
+
+/**
+ * @brief Get the balloon state of @vm, and ask the guest to refresh its
+ * memory statistics for the next call.
+ */
+int virtio_balloon_get_info(struct vm *vm, struct virtio_balloon_info *info);
+
+extern struct virtio_emulator virtio_balloon;
+
+#endif /* __ZVM_VIRTIO_BALLOON_H__ */
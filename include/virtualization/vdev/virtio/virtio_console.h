@@ -0,0 +1,63 @@
+/**
+ * @file virtio_console.h
+ * @brief VirtIO console device defines
+ * The source has been largely adapted from Linux 4.19 or higher:
+ * /include/uapi/linux/virtio_console.h
+ */
+
+#ifndef __ZVM_VIRTIO_CONSOLE_H__
+#define __ZVM_VIRTIO_CONSOLE_H__
+
+#include <stdint.h>
+
+/* Feature bits */
+#define VIRTIO_CONSOLE_F_SIZE	0	/* Does host provide console size? */
+#define VIRTIO_CONSOLE_F_MULTIPORT 1	/* Does host provide multiple ports? */
+#define VIRTIO_CONSOLE_F_EMERG_WRITE 2 /* Does host support emergency write? */
+
+#define VIRTIO_CONSOLE_BAD_ID		(~(uint32_t)0)
+
+struct virtio_console_config {
+	/* colums of the screens */
+	uint16_t cols;
+	/* rows of the screens */
+	uint16_t rows;
+	/* max. number of ports this device can hold */
+	uint32_t max_nr_ports;
+	/* emergency write register */
+	uint32_t emerg_wr;
+} __attribute__((packed));
+
+/*
+ * A message that's passed between the Host and the Guest for a
+ * particular port.
+ */
+struct virtio_console_control {
+	uint32_t id;		/* Port number */
+	uint16_t event;		/* The kind of control event (see below) */
+	uint16_t value;		/* Extra information for the key */
+} __attribute__((packed));
+
+/* Some events for control messages */
+#define VIRTIO_CONSOLE_DEVICE_READY	0
+#define VIRTIO_CONSOLE_PORT_ADD		1
+#define VIRTIO_CONSOLE_PORT_REMOVE	2
+#define VIRTIO_CONSOLE_PORT_READY	3
+#define VIRTIO_CONSOLE_CONSOLE_PORT	4
+#define VIRTIO_CONSOLE_RESIZE		5
+#define VIRTIO_CONSOLE_PORT_OPEN	6
+#define VIRTIO_CONSOLE_PORT_NAME	7
+
+struct shell;
+struct vm;
+
+/**
+ * @brief Attach @shell to @port of the virtio console of @vm. The output
+ * buffered in the port is printed first, then the input of the shell
+ * goes to the port until Ctrl-] is typed.
+ */
+int virtio_console_attach(const struct shell *shell, struct vm *vm, uint32_t port);
+
+extern struct virtio_emulator virtio_console;
+
+#endif /* __ZVM_VIRTIO_CONSOLE_H__ */
@@ -154,7 +154,7 @@ static inline void vring_init(struct vring *vr,
 	vr->desc = base;
 	vr->desc_base_gpa = base_pa;
 
-	vr->avail = (struct vring_avail *)((struct vring_desc *)base + num * sizeof(struct vring_desc));
+	vr->avail = (struct vring_avail *)((uint8_t *)base + num * sizeof(struct vring_desc));
 	vr->avail_base_gpa = base_pa + num * sizeof(struct vring_desc);
 
 	vr->used = (void *)(((unsigned long)&vr->avail->ring[num] + sizeof(uint16_t)
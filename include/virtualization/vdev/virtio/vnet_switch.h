@@ -0,0 +1,82 @@
+/**
+ * @file vnet_switch.h
+ * @brief Software L2 switch between the virtual network ports of vms.
+ */
+
+#ifndef ZEPHYR_INCLUDE_ZVM_VNET_SWITCH_H_
+#define ZEPHYR_INCLUDE_ZVM_VNET_SWITCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <kernel.h>
+#include <sys/dlist.h>
+#include <virtualization/vdev/virtio/virtio.h>
+
+#define VNET_ETH_ALEN		6
+#define VNET_ETH_HLEN		14
+
+/* A frame sent by a port, it stays in the guest buffers of the sender. */
+struct vnet_frame {
+	struct virtio_device *dev;
+	struct virtio_iovec *iov;
+	uint32_t iov_cnt;
+	/* first byte of the ethernet frame in @iov */
+	uint32_t offset;
+	uint32_t len;
+	/* queue pair of the sender, the receiver keeps the flow on one queue */
+	uint16_t queue;
+	uint8_t eth_hdr[VNET_ETH_HLEN];
+};
+
+struct vnet_port {
+	uint8_t mac[VNET_ETH_ALEN];
+
+	/* Drain the queues kicked by the guest, run in the switch thread. */
+	void (*transmit)(struct vnet_port *port);
+	/* Copy @frame to the guest, -ENOBUFS if it has no rx buffer. */
+	int (*receive)(struct vnet_port *port, struct vnet_frame *frame);
+	/* Signal the guest about the frames received since last flush. */
+	void (*flush)(struct vnet_port *port);
+
+	void *priv;
+	bool dirty;
+	struct k_work work;
+	sys_dnode_t node;
+};
+
+/**
+ * @brief Attach @port to the switch, its callbacks must be set.
+ */
+int vnet_switch_port_add(struct vnet_port *port);
+
+/**
+ * @brief Detach @port from the switch, it is not called back after.
+ */
+void vnet_switch_port_remove(struct vnet_port *port);
+
+/**
+ * @brief Schedule the transmit of @port in the switch thread.
+ */
+void vnet_switch_kick(struct vnet_port *port);
+
+/**
+ * @brief Forward @frame of @src to the ports by its destination mac,
+ * unknown unicast and multicast frames are flooded. Called from the
+ * transmit callback only.
+ */
+void vnet_switch_forward(struct vnet_port *src, struct vnet_frame *frame);
+
+/**
+ * @brief Flush the ports that received frames, so a batch of frames
+ * costs one virq for each receiver. Called from the transmit callback.
+ */
+void vnet_switch_flush(void);
+
+/**
+ * @brief Serialize with the switch thread, for example when the queues
+ * of a port are set up or reset.
+ */
+void vnet_switch_lock(void);
+void vnet_switch_unlock(void);
+
+#endif /* ZEPHYR_INCLUDE_ZVM_VNET_SWITCH_H_ */
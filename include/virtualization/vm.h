@@ -18,6 +18,7 @@
 #include <virtualization/arm/mm.h>
 #include <virtualization/arm/cpu.h>
 #include <virtualization/vm_mm.h>
+#include <virtualization/tools/vm_exit_stat.h>
 
 #define DEFAULT_VM          (0)
 #define VM_NAME_LEN         (32)
@@ -81,6 +82,42 @@ struct zvm_host_data {
     struct k_spinlock hdata_lock;
 };
 
+/**
+ * @brief Halt-poll window and statistics of a vcpu, only updated by
+ * the vcpu thread itself.
+ */
+struct vcpu_halt_poll {
+    /* current window and the policy bounds of it */
+    uint32_t poll_ns;
+    uint32_t min_ns;
+    uint32_t max_ns;
+
+    /* wakeups seen while polling, and polls ending in sleep */
+    uint32_t success;
+    uint32_t fail;
+    uint64_t total_ns;
+};
+
+/**
+ * @brief Placement of a vcpu, the pcpu it is pinned to and the time it
+ * used in the last balance period. Only the vcpu balancer and the
+ * migration handoff touch it, see vm_sched.c.
+ */
+struct vcpu_sched_info {
+    sys_dnode_t node;
+    uint16_t pcpu;
+    bool rt;
+
+    /* run and steal time of the last period, in permille of a pcpu */
+    uint16_t load;
+    uint16_t steal;
+    uint64_t last_run_cycles;
+    uint64_t last_steal_ns;
+
+    /* target pcpu + 1 of a migration, with the VCPU_MIGRATE_* flags */
+    atomic_t migrate;
+};
+
 /**
  * @brief Information describes vcpu.
  *  @TODO We support SMP later.
@@ -110,6 +147,25 @@ struct vcpu {
     /* vcpu's thread wait queue */
     _wait_q_t *t_wq;
 
+    /* vcpu thread sleeps on it when guest is idle in wfi */
+    struct k_sem wfi_sem;
+    atomic_t wfi_waiting;
+    struct vcpu_halt_poll halt_poll;
+
+#ifdef CONFIG_ZVM_EXIT_STAT
+    struct vm_exit_stat exit_stat;
+#endif
+
+#ifdef CONFIG_ZVM_STEAL_TIME
+    /* 64-bit cycles when the vcpu starts, and the cycles blocked in wfi */
+    uint64_t steal_start;
+    uint64_t wait_cycles;
+#endif
+
+#ifdef CONFIG_ZVM_VCPU_SCHED
+    struct vcpu_sched_info sched;
+#endif
+
     sys_dlist_t vcpu_lists;
 };
 typedef struct vcpu vcpu_t;
@@ -231,6 +287,12 @@ int z_parse_run_vm_args(size_t argc, char **argv, struct getopt_state *state);
 int z_parse_pause_vm_args(size_t argc, char **argv, struct getopt_state *state);
 int z_parse_delete_vm_args(size_t argc, char **argv, struct getopt_state *state);
 int z_parse_info_vm_args(size_t argc, char **argv, struct getopt_state *state);
+int z_parse_stat_vm_args(size_t argc, char **argv, struct getopt_state *state,
+                bool *clear);
+int z_parse_console_vm_args(size_t argc, char **argv, struct getopt_state *state,
+                uint32_t *port);
+int z_parse_balloon_vm_args(size_t argc, char **argv, struct getopt_state *state,
+                int64_t *target_mb);
 
 int z_list_vms_info(uint16_t vmid);
 
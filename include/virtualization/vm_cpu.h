@@ -45,6 +45,27 @@ int vm_vcpu_halt(struct vcpu *vcpu);
 int z_vcpu_run(struct vcpu *vcpu);
 
 int vcpu_irq_exit(struct vcpu *vcpu);
+
+/**
+ * @brief Block the vcpu thread until a virq is sent to it, used when
+ * guest is idle in wfi.
+ */
+int vcpu_wait_for_irq(struct vcpu *vcpu);
+
+/**
+ * @brief Wake up the vcpu if it is blocked in vcpu_wait_for_irq().
+ * @return true if the vcpu was waiting.
+ */
+bool vcpu_wfi_kick(struct vcpu *vcpu);
+
+/**
+ * @brief Get the time that vcpu is runnable but other threads run on
+ * its pcpu, since it starts. The time to wake up from wfi is not
+ * counted in.
+ * @return steal time in ns, 0 if steal time is not supported.
+ */
+uint64_t vcpu_steal_time_ns(struct vcpu *vcpu);
+
 int vcpu_state_switch(struct k_thread *thread, uint16_t new_state);
 
 void do_vcpu_swap(struct k_thread *new_thread, struct k_thread *old_thread);
@@ -55,4 +76,58 @@ void do_asm_vcpu_swap(struct k_thread *new_thread, struct k_thread *old_thread);
  */
 int vcpu_ipi_scheduler(uint32_t cpu_mask, uint32_t timeout);
 
+/* The vcpu has left its pcpu for a migration, and the target may resume it. */
+#define VCPU_MIGRATE_CLAIMED    BIT(16)
+#define VCPU_MIGRATE_PARKED     BIT(17)
+#define VCPU_MIGRATE_CPU_MASK   BIT_MASK(16)
+
+#ifdef CONFIG_ZVM_VCPU_SCHED
+/**
+ * @brief Choose the pcpu of a new vcpu by load. Rt vcpus get a pcpu
+ * of their own, the others go to the least loaded pcpu without a rt vcpu.
+ * @return pcpu id, -ESRCH if no pcpu is suitable.
+ */
+int vcpu_sched_place(struct vcpu *vcpu);
+
+/**
+ * @brief Give back the pcpu of a vcpu before it is freed.
+ */
+void vcpu_sched_remove(struct vcpu *vcpu);
+#else
+static inline int vcpu_sched_place(struct vcpu *vcpu)
+{
+    ARG_UNUSED(vcpu);
+    return 0;
+}
+
+static inline void vcpu_sched_remove(struct vcpu *vcpu)
+{
+    ARG_UNUSED(vcpu);
+}
+#endif /* CONFIG_ZVM_VCPU_SCHED */
+
+#ifdef CONFIG_ZVM_VCPU_BALANCE
+/**
+ * @brief Called by the vcpu thread between two guest entries, it leaves
+ * the pcpu here when the balancer asks it to migrate.
+ */
+void vcpu_sched_migrate_point(struct vcpu *vcpu);
+
+/**
+ * @brief Called when the vcpu thread is switched out and its context is
+ * saved, a migrating vcpu is then handed to its target pcpu.
+ */
+void vcpu_sched_handoff(struct vcpu *vcpu);
+#else
+static inline void vcpu_sched_migrate_point(struct vcpu *vcpu)
+{
+    ARG_UNUSED(vcpu);
+}
+
+static inline void vcpu_sched_handoff(struct vcpu *vcpu)
+{
+    ARG_UNUSED(vcpu);
+}
+#endif /* CONFIG_ZVM_VCPU_BALANCE */
+
 #endif /* ZEPHYR_INCLUDE_ZVM_VM_CPU_H_ */
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ZEPHYR_INCLUDE_ZVM_VM_HYPERCALL_H_
+#define ZEPHYR_INCLUDE_ZVM_VM_HYPERCALL_H_
+
+#include <zephyr.h>
+#include <stdint.h>
+
+/**
+ * ZVM hypercall ABI, the guest issues "hvc #0" with:
+ *  x0:     function id, ZVM_HC_ID(func)
+ *  x1-x3:  arguments of the function
+ * and gets back:
+ *  x0:     0 on success, or a negative errno value
+ *  x1-x3:  results of the function
+ * Other registers are preserved.
+ *
+ * The function ids are in the SMCCC vendor specific hypervisor service
+ * range (fast call, SMC64, owner 6), so they do not clash with the
+ * standard services a guest may call through hvc. An id that is not
+ * known returns ZVM_HC_NOT_SUPPORTED, the SMCCC NOT_SUPPORTED value.
+ * A minor version bump only adds functions, so a guest checks the
+ * major version and the function count of ZVM_HC_VERSION. This header
+ * has no host dependency, guests may include it for the ids.
+ */
+#define ZVM_HC_VERSION_MAJOR    (1)
+#define ZVM_HC_VERSION_MINOR    (0)
+#define ZVM_HC_VERSION_VALUE    ((ZVM_HC_VERSION_MAJOR << 16) | ZVM_HC_VERSION_MINOR)
+
+#define ZVM_HC_FUNC_BASE        (0xc6000000UL)
+#define ZVM_HC_FUNC_MASK        (0x0000ffffUL)
+#define ZVM_HC_ID(func)         (ZVM_HC_FUNC_BASE | (func))
+#define ZVM_HC_IS_ZVM(id)       (((id) & ~ZVM_HC_FUNC_MASK) == ZVM_HC_FUNC_BASE)
+
+#define ZVM_HC_NOT_SUPPORTED    (-1L)
+
+/* Bytes of guest buffer taken by one console write call */
+#define ZVM_HC_CONSOLE_MAX      (256)
+
+/**
+ * @brief Hypercall functions.
+ *
+ * ZVM_HC_VERSION: x1 = version, x2 = number of functions.
+ * ZVM_HC_YIELD: give the pcpu to another thread, x1 is a hint of the
+ *      vcpu id the caller waits for, or -1.
+ * ZVM_HC_SEND_IPI: x1 = bitmap of target vcpu ids, x2 = sgi id.
+ *      Returns x1 = bitmap of the vcpus that got the sgi.
+ * ZVM_HC_CONSOLE_WRITE: x1 = gpa of the buffer, x2 = length. Returns
+ *      x1 = bytes written, at most ZVM_HC_CONSOLE_MAX.
+ * ZVM_HC_STEAL_TIME: x1 = ns the vcpu was runnable but not running
+ *      since it started.
+ */
+enum zvm_hc_func {
+    ZVM_HC_VERSION = 0,
+    ZVM_HC_YIELD,
+    ZVM_HC_SEND_IPI,
+    ZVM_HC_CONSOLE_WRITE,
+    ZVM_HC_STEAL_TIME,
+    ZVM_HC_FUNC_NUM,
+};
+
+/* Registers x0-x3 that pass the args and results */
+#define ZVM_HC_REGS_NUM         (4)
+
+struct vcpu;
+
+#ifdef CONFIG_ZVM_HYPERCALL
+
+/**
+ * @brief Handle a hypercall of vcpu.
+ * @param regs x0-x3 of the guest, which are replaced by the results.
+ */
+void vm_hypercall_handle(struct vcpu *vcpu, uint64_t *regs);
+
+#else
+
+static inline void vm_hypercall_handle(struct vcpu *vcpu, uint64_t *regs)
+{
+    ARG_UNUSED(vcpu);
+    regs[0] = ZVM_HC_NOT_SUPPORTED;
+}
+
+#endif /* CONFIG_ZVM_HYPERCALL */
+
+#endif /* ZEPHYR_INCLUDE_ZVM_VM_HYPERCALL_H_ */
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <sys/dlist.h>
+#include <sys/atomic.h>
 #include <arch/arm64/lib_helpers.h>
 #include <virtualization/zvm.h>
 #include <virtualization/arm/trap_handler.h>
@@ -18,14 +19,15 @@
  * Software irq flags, which is used to
  * set the status of virt irq desc:
  * @VIRQ_HW_FLAG: this irq desc has a related hardware device,
- * not a fully emualted interrupt.
+ * not a fully emualted interrupt. Only passthrough devices set
+ * it, their list registers link pirq_num.
  * @VIRQ_PENDING_FLAG: irq desc is pending, and when eret to
  * vm, this irq will assert. (1)This flag is set when virt irq is
  * set to vm or virt irq is not process by vm(but vm exit). (2)This
  * flag is unset when virt irq is inject to hardware device, which
  * will assert vm's irq.
 */
-#define VIRQ_HW_FLAG                BIT(0)      /*@TODO: HW_FLAG may not enbaled for each spi.*/
+#define VIRQ_HW_FLAG                BIT(0)
 #define VIRQ_PENDING_FLAG		    BIT(1)
 #define VIRQ_ACTIVED_FLAG           BIT(2)
 #define VIRQ_ENABLED_FLAG		    BIT(3)
@@ -48,6 +50,17 @@
 #define VM_LOCAL_VIRQ_NR	(VM_SGI_VIRQ_NR + VM_PPI_VIRQ_NR)
 #define VM_GLOBAL_VIRQ_NR   (VM_LOCAL_VIRQ_NR + VM_SPI_VIRQ_NR)
 
+/**
+ * Pending virqs are queued in per-priority bitmaps: a virq's level is
+ * its gic priority >> VM_VIRQ_PRIO_SHIFT, and level 0 is the highest.
+*/
+#define VM_VIRQ_PRIO_SHIFT      (3)
+#define VM_VIRQ_PRIO_LEVELS     (256 >> VM_VIRQ_PRIO_SHIFT)
+#define VM_VIRQ_MAP_WORDS       ((VM_GLOBAL_VIRQ_NR + 31) / 32)
+
+/* Max list register number of the gic virtual cpu interface. */
+#define VGIC_LR_MAX_NUM         (16)
+
 struct vm;
 struct vcpu;
 struct virt_dev;
@@ -79,8 +92,6 @@ struct virt_irq_desc {
     */
     uint32_t pirq_num;
     uint32_t virq_num;
-
-    sys_dnode_t desc_node;
 };
 
 /**
@@ -99,8 +110,24 @@ struct vcpu_virt_irq_block {
 
     struct k_spinlock spinlock;
 
-    sys_dlist_t active_irqs;
-    sys_dlist_t pending_irqs;
+    /**
+     * Pending virqs not yet in a list register, indexed by virq_num.
+     * pending_levels has a bit for each non-empty priority level and
+     * pending_words a bit for each non-empty word of that level.
+    */
+    uint32_t pending_levels;
+    uint8_t pending_words[VM_VIRQ_PRIO_LEVELS];
+    uint32_t pending_map[VM_VIRQ_PRIO_LEVELS][VM_VIRQ_MAP_WORDS];
+
+    /* virq desc held by each occupied list register. */
+    struct virt_irq_desc *lr_desc[VGIC_LR_MAX_NUM];
+
+    /**
+     * Sgis posted by other vcpus without taking the spinlock, a bit
+     * for each sgi id. They are moved to the pending bitmaps when
+     * this vcpu flushes its list registers.
+    */
+    atomic_t sgi_posted;
 };
 
 /**
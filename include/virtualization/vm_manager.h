@@ -102,4 +102,24 @@ int zvm_pause_guest(size_t argc, char **argv);
 int zvm_delete_guest(size_t argc, char **argv);
 int zvm_info_guest(size_t argc, char **argv);
 
+/**
+ * @brief Show the vcpu exit statistics of vm, "zvm stat -n <vmid>",
+ * and "-c" clears them after printing.
+ */
+int zvm_stat_guest(size_t argc, char **argv);
+
+struct shell;
+
+/**
+ * @brief Attach the shell to the virtio console of vm,
+ * "zvm console -n <vmid> [-p <port>]".
+ */
+int zvm_console_guest(const struct shell *shell, size_t argc, char **argv);
+
+/**
+ * @brief Set the balloon target of vm and show its memory statistics,
+ * "zvm balloon -n <vmid> [-m <MB>]".
+ */
+int zvm_balloon_guest(const struct shell *shell, size_t argc, char **argv);
+
 #endif /* ZEPHYR_INCLUDE_ZVM_VM_MANAGER_H_ */
@@ -39,6 +39,7 @@
 
 /* For clear warning for unknow reason */
 struct vm;
+struct virt_dev;
 
 /**
  * @brief vm_mem_block record the translation relation of virt addr to phy addr
@@ -73,6 +74,14 @@ struct vm_mem_partition {
     uint64_t part_hpa_base;
     uint64_t part_hpa_size;
 
+    /**
+     * Host virtual address of this vpart, mapped once when the
+     * vpart is added to the domain. Only guest ram is mapped, and
+     * part_hva_size may be smaller than part_hpa_size.
+    */
+    uint64_t part_hva_base;
+    uint64_t part_hva_size;
+
     /* the vm_mem_partition node link to vm mm */
     sys_dnode_t vpart_node;
 
@@ -83,11 +92,36 @@ struct vm_mem_partition {
     struct  vm_mem_domain   *vmem_domain;
 
 #ifdef CONFIG_VM_DYNAMIC_MEMORY
-    /* base address of memory allocated by kmalloc */
-    uint64_t part_kpa_base;
+    /**
+     * Guest ram is populated block by block when it is first touched,
+     * blk_hva is NULL for the other vparts. Each entry is the hypervisor
+     * address of a block, NULL until the block is allocated.
+    */
+    atomic_ptr_t *blk_hva;
+    uint64_t blk_size;
+    uint32_t blk_num;
+    /* 4K pages of each block given to the balloon, and a bit for each page */
+    uint16_t *blk_ballooned;
+    uint32_t *blk_balloon_map;
+    /* Host users holding a pointer into each block, see vm_gpa_hva_get() */
+    uint32_t *blk_pins;
+    /* Serializes a block mapping against its reclaim. */
+    struct k_spinlock blk_lock;
 #endif
 };
 
+/**
+ * @brief vm_mem_region is one entry of vm's gpa index, it may be a guest
+ * ram vpart or a device region. vdev is NULL for guest ram.
+ */
+struct vm_mem_region {
+    uint64_t gpa_base;
+    uint64_t gpa_size;
+
+    struct vm_mem_partition *vpart;
+    struct virt_dev *vdev;
+};
+
 /**
  * @brief vm_mem_domain describe the full virtual address space of the vm.
  */
@@ -105,6 +139,15 @@ struct vm_mem_domain {
     sys_dlist_t idle_vpart_list;
     sys_dlist_t mapped_vpart_list;
 
+    /**
+     * gpa index for all the vpart, sorted by gpa_base.
+     * last_region cache the last lookup result.
+    */
+    struct vm_mem_region regions[CONFIG_VM_MEM_REGION_NUM];
+    uint16_t region_num;
+    uint16_t last_region;
+    struct k_spinlock region_lock;
+
     struct k_spinlock spin_mmlock;
     struct vm *vm;
 };
@@ -121,10 +164,22 @@ int map_vpart_to_block(struct vm_mem_domain *vmem_domain, struct vm_mem_partitio
 int unmap_vpart_to_block(struct vm_mem_domain *vmem_domain, struct vm_mem_partition *vpart);
 
 /**
- * @brief Create the vdev memory partition.
+ * @brief Create the vdev memory partition, and add it to the gpa index.
  */
 int vm_vdev_mem_create(struct vm_mem_domain *vmem_domain, uint64_t hpbase,
-                    uint64_t ipbase, uint64_t size, uint32_t attrs);
+                    uint64_t ipbase, uint64_t size, uint32_t attrs,
+                    struct virt_dev *vdev);
+
+/**
+ * @brief Find the region which contains @gpa in vm's gpa index.
+ *
+ * @param vmem_dm : vm's mm struct
+ * @param gpa : guest physical address
+ * @param region : store a copy of the found region
+ * @return int : 0--success, -ESRCH for no region.
+ */
+int vm_mem_region_lookup(struct vm_mem_domain *vmem_dm, uint64_t gpa,
+                    struct vm_mem_region *region);
 
 /**
  * @brief Init vm mm struct for this vm.
@@ -161,14 +216,64 @@ int vm_mem_apart_remove(struct vm_mem_domain *vmem_dm);
  */
 int arch_vm_mem_domain_init(struct k_mem_domain *domain, uint32_t vmid);
 
+/**
+ * @brief release vm's stage-2 tables and tlb entries
+ */
+int arch_vm_mem_domain_deinit(struct k_mem_domain *domain, uint32_t vmid);
+
 /**
  * @brief translate guest physical address to host physical address
- * 
+ *
  * @param vm the pointer to guest
  * @param gpa guset physical address need to be translate
- * @return uint64_t host physical address
+ * @param vpart if not NULL, store the vpart which contains gpa
+ * @return uint64_t host physical address, -ESRCH if not found
  */
-uint64_t vm_gpa_to_hpa(struct vm *vm, uint64_t gpa, struct vm_mem_partition *vpart);
+uint64_t vm_gpa_to_hpa(struct vm *vm, uint64_t gpa, struct vm_mem_partition **vpart);
+
+/**
+ * @brief translate guest physical address to hypervisor virtual address
+ * through the persistent mapping of guest ram.
+ *
+ * @param vm the pointer to guest
+ * @param gpa guset physical address need to be translate
+ * @param len the access length, [gpa, gpa + len) must be mapped
+ * @return void* host pointer, NULL if the range is not mapped
+ */
+void *vm_gpa_to_hva(struct vm *vm, uint64_t gpa, size_t len);
+
+/**
+ * @brief Translate like vm_gpa_to_hva(), and keep the guest ram under the
+ * pointer from being reclaimed by the balloon until vm_gpa_hva_put().
+ * A pointer that is used after the current access must come from here.
+ */
+void *vm_gpa_hva_get(struct vm *vm, uint64_t gpa, size_t len);
+
+/**
+ * @brief Release the pointer of @gpa got by vm_gpa_hva_get().
+ */
+void vm_gpa_hva_put(struct vm *vm, uint64_t gpa);
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+/**
+ * @brief Populate the guest ram block which contains @gpa: allocate and
+ * zero it from the memory pool, then map it in stage-2.
+ *
+ * @return int : 0--success, -ESRCH if @gpa is not demand populated ram,
+ * -ENOMEM if the memory pool is exhausted.
+ */
+int vm_mem_block_fault(struct vm *vm, uint64_t gpa);
+
+/**
+ * @brief Take the 4K page at @gpa from the guest (@inflate) or give it
+ * back. When all the pages of a block are taken, the block is unmapped
+ * from stage-2 and returned to the memory pool.
+ *
+ * @return int : 0--success, -ESRCH if @gpa is not demand populated ram,
+ * -EBUSY if the host holds a pointer into the block of @gpa.
+ */
+int vm_mem_page_balloon(struct vm *vm, uint64_t gpa, bool inflate);
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
 
 void vm_host_memory_read(uint64_t hpa, void *dst, size_t len);
 void vm_host_memory_write(uint64_t hpa, void *src, size_t len);
@@ -176,4 +281,10 @@ void vm_host_memory_write(uint64_t hpa, void *src, size_t len);
 void vm_guest_memory_read(struct vm *vm, uint64_t gpa, void *dst, size_t len);
 void vm_guest_memory_write(struct vm *vm, uint64_t gpa, void *src, size_t len);
 
+/**
+ * @brief Write a boot image to guest memory and clean it from the data
+ * cache, for a guest that starts with its caches off.
+ */
+void vm_guest_memory_load(struct vm *vm, uint64_t gpa, void *src, size_t len);
+
 #endif /* ZEPHYR_INCLUDE_ZVM_VM_MM_H_ */
@@ -223,48 +223,6 @@ struct zvm_dev_lists* get_zvm_dev_lists(void);
 int vm_create(struct z_vm_info *zvi, struct vm *vm);
 int load_os_image(struct vm *vm);
 
-static ALWAYS_INLINE int rt_get_idle_cpu(void){
-    for (int i = 0; i < CONFIG_MP_NUM_CPUS; i++) {
-#ifdef CONFIG_SMP
-        /* In SMP, _current is a field read from _current_cpu, which
-        * can race with preemption before it is read.  We must lock
-        * local interrupts when reading it.
-        */
-	    unsigned int k = arch_irq_lock();
-#endif
-        k_tid_t tid = _kernel.cpus[i].current;
-#ifdef CONFIG_SMP
-	    arch_irq_unlock(k);
-#endif
-        int prio = k_thread_priority_get(tid);
-        if (prio == K_IDLE_PRIO || (prio < K_IDLE_PRIO && prio > VCPU_RT_PRIO)) {
-            return i;
-        }
-    }
-    return -ESRCH;
-}
-
-static ALWAYS_INLINE int nrt_get_idle_cpu(void) {
-    for (int i = 0; i < CONFIG_MP_NUM_CPUS; i++) {
-#ifdef CONFIG_SMP
-        /* In SMP, _current is a field read from _current_cpu, which
-        * can race with preemption before it is read.  We must lock
-        * local interrupts when reading it.
-        */
-        unsigned int k = arch_irq_lock();
-#endif
-        k_tid_t tid = _kernel.cpus[i].current;
-#ifdef CONFIG_SMP
-	    arch_irq_unlock(k);
-#endif
-        int prio = k_thread_priority_get(tid);
-        if (prio == K_IDLE_PRIO) {
-            return i;
-        }
-    }
-    return -ESRCH;
-}
-
 static ALWAYS_INLINE bool is_vmid_full(void){
     return zvm_overall_info->alloced_vmid == BIT_MASK(CONFIG_MAX_VM_NUM);
 }
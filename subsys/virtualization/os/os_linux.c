@@ -42,29 +42,20 @@ int load_linux_image(struct vm_mem_domain *vmem_domain)
     ARG_UNUSED(dbuf);
     ARG_UNUSED(sbuf);
     int ret = 0;
-    uint64_t lbase_size,limage_base,limage_size;
-    struct _dnode *d_node, *ds_node;
-    struct vm_mem_partition *vpart;
-    struct vm_mem_block *blk;
+    uint64_t limage_base,limage_size;
     struct vm *this_vm = vmem_domain->vm;
-    ARG_UNUSED(blk);
-    ARG_UNUSED(this_vm);
 
 #ifndef  CONFIG_VM_DYNAMIC_MEMORY
     ARG_UNUSED(this_vm);
+    ARG_UNUSED(limage_base);
+    ARG_UNUSED(limage_size);
     return ret;
 #endif /* CONFIG_VM_DYNAMIC_MEMORY */
 
-    lbase_size =  LINUX_VMSYS_SIZE;
     limage_base = zvm_mapped_linux_image();
     limage_size = LINUX_VM_IMAGE_SIZE;
-    SYS_DLIST_FOR_EACH_NODE_SAFE(&vmem_domain->mapped_vpart_list,d_node,ds_node){
-        vpart = CONTAINER_OF(d_node,struct vm_mem_partition,vpart_node);
-        if(vpart->part_hpa_size == lbase_size){
-            memcpy((void *)vpart->part_hpa_base, (const void *)limage_base, limage_size);
-            break;
-        }
-    }
+    /* Only the ram blocks holding the image are populated here. */
+    vm_guest_memory_load(this_vm, LINUX_VMSYS_BASE, (void *)limage_base, limage_size);
 
     return ret;
 }
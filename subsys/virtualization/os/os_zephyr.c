@@ -44,29 +44,20 @@ int load_zephyr_image(struct vm_mem_domain *vmem_domain)
     ARG_UNUSED(dbuf);
     ARG_UNUSED(sbuf);
     int ret = 0;
-    uint64_t zbase_size,zimage_base,zimage_size;
-    struct _dnode *d_node, *ds_node;
-    struct vm_mem_partition *vpart;
-    struct vm_mem_block *blk;
+    uint64_t zimage_base,zimage_size;
     struct vm *this_vm = vmem_domain->vm;
-    ARG_UNUSED(blk);
-    ARG_UNUSED(this_vm);
 
 #ifndef  CONFIG_VM_DYNAMIC_MEMORY
     ARG_UNUSED(this_vm);
+    ARG_UNUSED(zimage_base);
+    ARG_UNUSED(zimage_size);
     return ret;
 #endif /* CONFIG_VM_DYNAMIC_MEMORY */
 
-    zbase_size = ZEPHYR_VMSYS_SIZE;
     zimage_base = zvm_mapped_zephyr_image();
     zimage_size = ZEPHYR_VM_IMAGE_SIZE;
-    SYS_DLIST_FOR_EACH_NODE_SAFE(&vmem_domain->mapped_vpart_list,d_node,ds_node){
-        vpart = CONTAINER_OF(d_node,struct vm_mem_partition,vpart_node);
-        if(vpart->part_hpa_size == zbase_size){
-            memcpy((void *)vpart->part_hpa_base,(const void *)zimage_base,zimage_size);
-            break;
-        }
-    }
+    /* Only the ram blocks holding the image are populated here. */
+    vm_guest_memory_load(this_vm, ZEPHYR_VMSYS_BASE, (void *)zimage_base, zimage_size);
 
     return ret;
 }
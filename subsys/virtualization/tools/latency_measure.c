@@ -6,10 +6,7 @@
 
 #include <zephyr.h>
 #include <timing/timing.h>
-
-#define TICK_SYNCH()  k_sleep(K_TICKS(1))
-
-static volatile int flag_var;
+#include <virtualization/tools/latency_measure.h>
 
 static timing_t timestamp_start;
 static timing_t timestamp_end;
@@ -29,6 +26,8 @@ int vm_exit_irq_time(void)
     key = k_spin_lock(&time_start_lock);
     timestamp_start = timing_counter_get();
     k_spin_unlock(&time_start_lock, key);
+
+    return 0;
 }
 
 /* call this function when irq entry */
@@ -36,8 +35,10 @@ int vm_entry_irq_time(void)
 {
     k_spinlock_key_t key;
     key = k_spin_lock(&time_end_lock);
-    timestamp_start = timing_counter_get();
+    timestamp_end = timing_counter_get();
     k_spin_unlock(&time_end_lock, key);
+
+    return 0;
 }
 
 
@@ -45,9 +46,11 @@ int vm_entry_irq_time(void)
 void vm_irq_timing_print(void)
 {
     uint32_t diff = 0;
-    k_spinlock_key_t key;
+    k_spinlock_key_t key, end_key;
     key = k_spin_lock(&time_start_lock);
+    end_key = k_spin_lock(&time_end_lock);
     diff = timing_cycles_get(&timestamp_start, &timestamp_end);
+    k_spin_unlock(&time_end_lock, end_key);
     k_spin_unlock(&time_start_lock, key);
 
     printk("The IRQ switch laytency: \n");
@@ -55,30 +58,10 @@ void vm_irq_timing_print(void)
 }
 
 /**
- * @brief The test main function
- *
- * @return 0 on success
- */
-int int_to_vm_thread(void)
-{
-	uint32_t diff;
-
-	timing_start();
-	TICK_SYNCH();
-	make_int();
-	if (flag_var == 1) {
-		diff = timing_cycles_get(&timestamp_start, &timestamp_end);
-		PRINT_STATS("Switch from ISR back to interrupted thread", diff);
-	}
-	timing_stop();
-	return 0;
-}
-
-
-/**
- * @brief init measure timing.
+ * @brief init measure timing, the counter is valid after timing_start().
  */
 void zvm_init_mtiming(void)
 {
     timing_init();
+    timing_start();
 }
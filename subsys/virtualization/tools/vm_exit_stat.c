@@ -0,0 +1,191 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <string.h>
+#include <sys/math_extras.h>
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/arm/asm.h>
+#include <virtualization/arm/cpu.h>
+#include <virtualization/tools/vm_exit_stat.h>
+
+LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
+
+static const char *const vm_exit_stat_reason_name[VM_EXIT_STAT_REASON_NUM] = {
+    "sync", "irq", "serror", "other"
+};
+
+static const char *const vm_exit_stat_table_name[VM_EXIT_STAT_TABLE_NUM] = {
+    "mmio", "sysreg"
+};
+
+static ALWAYS_INLINE void vm_exit_stat_add(struct vm_exit_stat_entry *entry, uint32_t cycles)
+{
+    entry->count++;
+    entry->cycles += cycles;
+}
+
+static enum vm_exit_stat_reason vm_exit_stat_get_reason(uint16_t exit_type)
+{
+    switch (exit_type) {
+    case ARM_VM_EXCEPTION_SYNC:
+        return VM_EXIT_STAT_SYNC;
+    case ARM_VM_EXCEPTION_IRQ:
+    case ARM_VM_EXCEPTION_IRQ_IN_SYNC:
+        return VM_EXIT_STAT_IRQ;
+    case ARM_VM_EXCEPTION_SERROR:
+        return VM_EXIT_STAT_SERROR;
+    default:
+        return VM_EXIT_STAT_OTHER;
+    }
+}
+
+void vm_exit_stat_mark(struct vcpu *vcpu, enum vm_exit_stat_table table, uint64_t key)
+{
+    int i;
+    struct vm_exit_stat_slot *slot;
+    struct vm_exit_stat *stat = &vcpu->exit_stat;
+
+    for (i = 0; i < VM_EXIT_STAT_KEY_NUM; i++) {
+        slot = &stat->table[table][i];
+        if (slot->entry.count && slot->key != key) {
+            continue;
+        }
+        slot->key = key;
+        stat->mark = slot;
+        return;
+    }
+    stat->table_miss[table]++;
+}
+
+void vm_exit_stat_idle(struct vcpu *vcpu, uint32_t cycles)
+{
+    vcpu->exit_stat.exit_idle += cycles;
+}
+
+void vm_exit_stat_account(struct vcpu *vcpu, uint16_t exit_type,
+            uint32_t start, uint32_t entry, uint32_t exit)
+{
+    uint32_t handle, bucket;
+    enum vm_exit_stat_reason reason;
+    struct vm_exit_stat *stat = &vcpu->exit_stat;
+
+    /* idle time is taken out from the exit handling */
+    handle = VM_EXIT_STAT_CYCLES() - exit;
+    handle = handle > stat->exit_idle ? handle - stat->exit_idle : 0;
+
+    stat->guest_cycles += exit - entry;
+    stat->hyp_cycles += (entry - start) + handle;
+    stat->idle_cycles += stat->exit_idle;
+
+    reason = vm_exit_stat_get_reason(exit_type);
+    vm_exit_stat_add(&stat->reason[reason], handle);
+    bucket = 31 - u32_count_leading_zeros(handle | 1);
+    stat->hist[reason][MIN(bucket, VM_EXIT_STAT_HIST_NUM - 1)]++;
+
+    if (reason == VM_EXIT_STAT_SYNC) {
+        vm_exit_stat_add(&stat->ec[GET_ESR_EC(vcpu->arch->fault.esr_el2)], handle);
+    }
+    if (stat->mark) {
+        vm_exit_stat_add(&stat->mark->entry, handle);
+    }
+
+    stat->mark = NULL;
+    stat->exit_idle = 0;
+}
+
+int vm_exit_stat_get(struct vm *vm, uint16_t vcpu_id, struct vm_exit_stat *stat)
+{
+    if (!vm || !vm->vcpus || vcpu_id >= vm->vcpu_num || !vm->vcpus[vcpu_id]) {
+        return -EINVAL;
+    }
+    memcpy(stat, &vm->vcpus[vcpu_id]->exit_stat, sizeof(struct vm_exit_stat));
+
+    return 0;
+}
+
+int vm_exit_stat_reset(struct vm *vm)
+{
+    uint32_t i;
+
+    if (!vm || !vm->vcpus) {
+        return -EINVAL;
+    }
+    for (i = 0; i < vm->vcpu_num; i++) {
+        if (vm->vcpus[i]) {
+            memset(&vm->vcpus[i]->exit_stat, 0, sizeof(struct vm_exit_stat));
+        }
+    }
+
+    return 0;
+}
+
+static void vm_exit_stat_print_entry(const char *name, uint64_t key,
+            struct vm_exit_stat_entry *entry)
+{
+    if (!entry->count) {
+        return;
+    }
+    printk("|   %-8s 0x%-12llx count %-10u avg %llu cycles \n", name, key,
+            entry->count, entry->cycles / entry->count);
+}
+
+static void vm_exit_stat_print_vcpu(struct vcpu *vcpu)
+{
+    int i, j;
+    struct vm_exit_stat *stat = &vcpu->exit_stat;
+
+    printk("|** vcpu%d: guest %llu cycles, hyp %llu cycles, idle %llu cycles \n",
+            vcpu->vcpu_id, stat->guest_cycles, stat->hyp_cycles, stat->idle_cycles);
+
+    for (i = 0; i < VM_EXIT_STAT_REASON_NUM; i++) {
+        if (!stat->reason[i].count) {
+            continue;
+        }
+        vm_exit_stat_print_entry(vm_exit_stat_reason_name[i], i, &stat->reason[i]);
+        printk("|     hist(2^n cycles):");
+        for (j = 0; j < VM_EXIT_STAT_HIST_NUM; j++) {
+            printk(" %u", stat->hist[i][j]);
+        }
+        printk("\n");
+    }
+
+    for (i = 0; i < VM_EXIT_STAT_EC_NUM; i++) {
+        vm_exit_stat_print_entry("ec", i, &stat->ec[i]);
+    }
+
+    for (i = 0; i < VM_EXIT_STAT_TABLE_NUM; i++) {
+        for (j = 0; j < VM_EXIT_STAT_KEY_NUM; j++) {
+            vm_exit_stat_print_entry(vm_exit_stat_table_name[i],
+                    stat->table[i][j].key, &stat->table[i][j].entry);
+        }
+        if (stat->table_miss[i]) {
+            printk("|   %-8s %u exits are not recorded \n",
+                    vm_exit_stat_table_name[i], stat->table_miss[i]);
+        }
+    }
+}
+
+int vm_exit_stat_print(struct vm *vm)
+{
+    uint32_t i;
+
+    if (!vm || !vm->vcpus) {
+        return -EINVAL;
+    }
+
+    printk("\n|********************* VM%d EXIT STAT ******************|\n", vm->vmid);
+    for (i = 0; i < vm->vcpu_num; i++) {
+        if (vm->vcpus[i]) {
+            vm_exit_stat_print_vcpu(vm->vcpus[i]);
+        }
+    }
+    printk("|*****************************************************|\n");
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <init.h>
+#include <device.h>
+#include <sys/atomic.h>
+#include <sys/mem_manage.h>
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/vm_dev.h>
+#include <virtualization/vm_mm.h>
+#include <virtualization/arm/mm.h>
+#include <virtualization/vdev/virt_device.h>
+#include <virtualization/vdev/vgic_common.h>
+#include <virtualization/vdev/shmem.h>
+
+LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
+
+BUILD_ASSERT(CONFIG_VM_SHMEM_SIZE % CONFIG_MMU_PAGE_SIZE == 0,
+	"shared memory channel must be page aligned");
+BUILD_ASSERT(CONFIG_MAX_VM_NUM <= 32, "peers bitmap is 32-bit");
+
+#define VM_SHMEM_POOL_SIZE	(CONFIG_VM_SHMEM_CHANNELS * CONFIG_VM_SHMEM_SIZE)
+
+struct vm_shmem_dev {
+	/* vmids that have the channels mapped */
+	atomic_t peers;
+	/* channels rung to each vm */
+	atomic_t pending[CONFIG_MAX_VM_NUM];
+};
+
+static uint8_t vm_shmem_pool[VM_SHMEM_POOL_SIZE] __aligned(CONFIG_MMU_PAGE_SIZE);
+
+static struct vm_shmem_dev vm_shmem_data;
+
+static void vm_shmem_ring(struct vm *vm, uint32_t channel)
+{
+	atomic_or(&vm_shmem_data.pending[vm->vmid], BIT(channel));
+	set_virq_to_vm(vm, CONFIG_VM_SHMEM_VIRQ);
+}
+
+static int vm_shmem_doorbell(struct vm *src, uint32_t value)
+{
+	uint32_t i, peers;
+	uint32_t channel = value >> 16;
+	uint32_t vmid = value & 0xffff;
+	struct vm *dst;
+
+	if (channel >= CONFIG_VM_SHMEM_CHANNELS) {
+		return -EINVAL;
+	}
+
+	peers = (uint32_t)atomic_get(&vm_shmem_data.peers);
+	if (vmid != VM_SHMEM_ALL_PEERS) {
+		if (vmid >= CONFIG_MAX_VM_NUM || !(peers & BIT(vmid))) {
+			return -ENODEV;
+		}
+		peers = BIT(vmid);
+	} else {
+		peers &= ~BIT(src->vmid);
+	}
+
+	for (i = 0; i < CONFIG_MAX_VM_NUM; i++) {
+		if (!(peers & BIT(i))) {
+			continue;
+		}
+		dst = get_vm_by_id(i);
+		if (dst) {
+			vm_shmem_ring(dst, channel);
+		}
+	}
+
+	return 0;
+}
+
+static int vm_shmem_vdev_read(struct virt_dev *vdev, uint64_t addr, uint64_t *value)
+{
+	struct vm *vm = vdev->vm;
+
+	switch (addr - vdev->vm_vdev_vaddr) {
+	case VM_SHMEM_MAGIC:
+		*value = VM_SHMEM_MAGIC_VALUE;
+		break;
+	case VM_SHMEM_VERSION:
+		*value = VM_SHMEM_VERSION_VALUE;
+		break;
+	case VM_SHMEM_VMID:
+		*value = vm->vmid;
+		break;
+	case VM_SHMEM_CHANNELS:
+		*value = CONFIG_VM_SHMEM_CHANNELS;
+		break;
+	case VM_SHMEM_CHANNEL_SIZE:
+		*value = CONFIG_VM_SHMEM_SIZE;
+		break;
+	case VM_SHMEM_BASE:
+		*value = CONFIG_VM_SHMEM_IPA_BASE;
+		break;
+	case VM_SHMEM_PEERS:
+		*value = (uint32_t)atomic_get(&vm_shmem_data.peers);
+		break;
+	case VM_SHMEM_PENDING:
+		*value = (uint32_t)atomic_clear(&vm_shmem_data.pending[vm->vmid]);
+		break;
+	case VM_SHMEM_VIRQ:
+		*value = CONFIG_VM_SHMEM_VIRQ;
+		break;
+	default:
+		*value = 0;
+		break;
+	}
+
+	return 0;
+}
+
+static int vm_shmem_vdev_write(struct virt_dev *vdev, uint64_t addr, uint64_t *value)
+{
+	switch (addr - vdev->vm_vdev_vaddr) {
+	case VM_SHMEM_DOORBELL:
+		return vm_shmem_doorbell(vdev->vm, (uint32_t)*value);
+	default:
+		/* Read only registers, ignore the write. */
+		break;
+	}
+
+	return 0;
+}
+
+static int vm_shmem_vdev_init(const struct device *dev, struct vm *vm,
+			struct virt_dev *vdev_desc)
+{
+	int ret;
+	struct virt_dev *vdev;
+	ARG_UNUSED(vdev_desc);
+
+	/* The channels are guest ram for every peer, no trap on them. */
+	ret = vm_vdev_mem_create(vm->vmem_domain, z_mem_phys_addr(vm_shmem_pool),
+			CONFIG_VM_SHMEM_IPA_BASE, VM_SHMEM_POOL_SIZE,
+			MT_VM_NORMAL_MEM, NULL);
+	if (ret) {
+		ZVM_LOG_WARN("Map shared memory channels to vm error\n");
+		return ret;
+	}
+
+	vdev = vm_virt_dev_add(vm, dev->name, false, false,
+			CONFIG_VM_SHMEM_DOORBELL_BASE, CONFIG_VM_SHMEM_DOORBELL_BASE,
+			VM_SHMEM_DOORBELL_SIZE, 0, CONFIG_VM_SHMEM_VIRQ);
+	if (!vdev) {
+		ZVM_LOG_WARN("Init shared memory doorbell error\n");
+		return -ENODEV;
+	}
+	vdev->priv_data = &vm_shmem_data;
+	vdev->priv_vdev = (void *)dev;
+
+	atomic_clear(&vm_shmem_data.pending[vm->vmid]);
+	atomic_or(&vm_shmem_data.peers, BIT(vm->vmid));
+
+	return 0;
+}
+
+static int vm_shmem_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
+	memset(vm_shmem_pool, 0, sizeof(vm_shmem_pool));
+
+	return 0;
+}
+
+static const struct virt_device_api vm_shmem_api = {
+	.init_fn = vm_shmem_vdev_init,
+	.virt_device_read = vm_shmem_vdev_read,
+	.virt_device_write = vm_shmem_vdev_write,
+};
+
+DEVICE_DEFINE(vm_shmem, "VM_SHMEM",
+		&vm_shmem_init,
+		NULL,
+		&vm_shmem_data,
+		NULL, POST_KERNEL,
+		CONFIG_VM_SHMEM_INIT_PRIORITY,
+		&vm_shmem_api);
+
+int vm_shmem_create(struct vm *vm)
+{
+	const struct device *dev = DEVICE_GET(vm_shmem);
+
+	return ((const struct virt_device_api * const)(dev->api))->init_fn(dev, vm, NULL);
+}
+
+void vm_shmem_remove(struct vm *vm)
+{
+	atomic_and(&vm_shmem_data.peers, ~BIT(vm->vmid));
+	atomic_clear(&vm_shmem_data.pending[vm->vmid]);
+}
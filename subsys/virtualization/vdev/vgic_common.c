@@ -14,6 +14,7 @@
 #include <arch/cpu.h>
 #include <arch/arm64/lib_helpers.h>
 #include <arch/common/sys_bitops.h>
+#include <sys/math_extras.h>
 #include <dt-bindings/interrupt-controller/arm-gic.h>
 #include <drivers/interrupt_controller/gic.h>
 #include <logging/log.h>
@@ -180,9 +181,76 @@ static int vgic_virq_set_priority(struct vcpu *vcpu, uint32_t virt_irq, int prio
 	return 0;
 }
 
+BUILD_ASSERT(VM_VIRQ_MAP_WORDS <= sizeof(((struct vcpu_virt_irq_block *)0)->pending_words[0]) * 8,
+		"pending_words has a bit for each word of a level");
+BUILD_ASSERT(VM_VIRQ_PRIO_LEVELS <= sizeof(((struct vcpu_virt_irq_block *)0)->pending_levels) * 8,
+		"pending_levels has a bit for each priority level");
+
+/**
+ * @brief Queue a virq on its priority level of the vcpu's pending bitmaps.
+ */
+static void vgic_virq_pending_push(struct vcpu_virt_irq_block *vb, struct virt_irq_desc *desc)
+{
+	uint32_t level = desc->prio >> VM_VIRQ_PRIO_SHIFT;
+	uint32_t word = desc->virq_num >> 5;
+	uint32_t bit = BIT(desc->virq_num & 0x1F);
+
+	if (vb->pending_map[level][word] & bit) {
+		return;
+	}
+	vb->pending_map[level][word] |= bit;
+	vb->pending_words[level] |= BIT(word);
+	vb->pending_levels |= BIT(level);
+	vb->virq_pending_counts++;
+}
+
+/**
+ * @brief Dequeue the pending virq with the highest priority, the
+ * caller should make sure that virq_pending_counts is not zero.
+ */
+static struct virt_irq_desc *vgic_virq_pending_pop(struct vcpu *vcpu)
+{
+	uint32_t level, word, bit;
+	struct vcpu_virt_irq_block *vb = &vcpu->virq_block;
+
+	level = u32_count_trailing_zeros(vb->pending_levels);
+	word = u32_count_trailing_zeros(vb->pending_words[level]);
+	bit = u32_count_trailing_zeros(vb->pending_map[level][word]);
+
+	vb->pending_map[level][word] &= ~BIT(bit);
+	if (!vb->pending_map[level][word]) {
+		vb->pending_words[level] &= ~BIT(word);
+		if (!vb->pending_words[level]) {
+			vb->pending_levels &= ~BIT(level);
+		}
+	}
+	vb->virq_pending_counts--;
+
+	return vgic_get_virt_irq_desc(vcpu, (word << 5) + bit);
+}
+
+/**
+ * @brief Pend the virq unless its lr already has it pending, the
+ * caller holds the spinlock of @vb. Return true if it is pended.
+ */
+static bool vgic_virq_mark_pending(struct vcpu_virt_irq_block *vb, struct virt_irq_desc *desc)
+{
+	switch (desc->virq_states) {
+	case VIRQ_STATE_INVALID:
+	/* vm is still handling the last one, pend it again. */
+	case VIRQ_STATE_ACTIVE:
+		desc->virq_flags |= VIRQ_PENDING_FLAG;
+		vgic_virq_pending_push(vb, desc);
+		return true;
+	case VIRQ_STATE_PENDING:
+	case VIRQ_STATE_ACTIVE_AND_PENDING:
+	default:
+		return false;
+	}
+}
+
 static int vgic_set_virq(struct vcpu *vcpu, struct virt_irq_desc *desc)
 {
-	uint8_t lr_state;
     k_spinlock_key_t key;
     struct vcpu_virt_irq_block *vb = &vcpu->virq_block;
 
@@ -193,55 +261,81 @@ static int vgic_set_virq(struct vcpu *vcpu, struct virt_irq_desc *desc)
     }
 
     key = k_spin_lock(&vb->spinlock);
-	lr_state = desc->virq_states;
-
-	switch (lr_state) {
-	case VIRQ_STATE_INVALID:
-        desc->virq_flags |= VIRQ_PENDING_FLAG;
-        if (!sys_dnode_is_linked(&desc->desc_node)) {
-            sys_dlist_append(&vb->pending_irqs, &desc->desc_node);
-            vb->virq_pending_counts++;
-        }
-        if (desc->virq_num < VM_LOCAL_VIRQ_NR) {
-			/* get the src vcpu  */
-            desc->src_cpu = get_current_vcpu_id();
-        }
-		break;
-	case VIRQ_STATE_ACTIVE:
-        desc->virq_flags |= VIRQ_ACTIVED_FLAG;
-		/* if vm interrupt is not in active list */
-        if (!sys_dnode_is_linked(&desc->desc_node)) {
-            sys_dlist_append(&vb->pending_irqs, &desc->desc_node);
-            vb->virq_pending_counts++;
-        }
-		break;
-	case VIRQ_STATE_PENDING:
-		break;
-	case VIRQ_STATE_ACTIVE_AND_PENDING:
-		break;
+	if (vgic_virq_mark_pending(vb, desc) &&
+		desc->virq_num < VM_SGI_VIRQ_NR && _current_vcpu) {
+		/* get the src vcpu  */
+		desc->src_cpu = get_current_vcpu_id();
 	}
     k_spin_unlock(&vb->spinlock, key);
 
-	/**
-	 * @Bug: Occur bug here: without judgement, wakeup_target_vcpu
-	 * will introduce a pause vm error !
-	 * When vcpu is not bind to current cpu, we should inform the
-	 * dest pcpu. In this situation, vCPU may run on the other pcpus
-	 * or it is in a idle states. So, we should consider all the
-	 * situations.
-	*/
-	if(vcpu->work->vcpu_thread != _current){
-		if(zvm_thread_active_elsewhere(vcpu->work->vcpu_thread)){
-#if defined(CONFIG_SMP) &&  defined(CONFIG_SCHED_IPI_SUPPORTED)
-			ZVM_LOG_INFO("Ready to send arch_sched_ipi \n");
-			arch_sched_ipi();
-#endif
-		}else{
-			wakeup_target_vcpu(vcpu, desc);
+	vgic_vcpu_kick(vcpu);
+
+    return 0;
+}
+
+/**
+ * @brief Find the vcpu that GICD_IROUTER value @irouter routes to, a
+ * route to any pe goes to the default vcpu.
+ */
+static struct vcpu *vgic_irouter_to_vcpu(struct vm *vm, uint64_t irouter)
+{
+	int i;
+	uint64_t aff = irouter & VCPU_MPIDR_AFF_MASK;
+
+	if (irouter & VGICD_IROUTER_IRM) {
+		return vm->vcpus[DEFAULT_VCPU];
+	}
+	for (i = 0; i < vm->vcpu_num; i++) {
+		if (vm->vcpus[i] && VCPU_AFFINITY(vm->vcpus[i]->vcpu_id) == aff) {
+			return vm->vcpus[i];
 		}
 	}
 
-    return 0;
+	return NULL;
+}
+
+/**
+ * @brief Route a spi to the vcpu in GICD_IROUTER<n>, virqs raised later
+ * by set_virq_to_vm() go to that vcpu.
+ */
+static int vgic_virq_set_route(struct vcpu *vcpu, uint32_t offset, uint64_t irouter)
+{
+	struct vcpu *target;
+	struct virt_irq_desc *desc;
+
+	/* the high word only has aff3, which no vcpu uses */
+	if (offset & 0x4) {
+		return 0;
+	}
+	desc = vgic_get_virt_irq_desc(vcpu, (offset - GIC_DIST_IROUTER) / 8);
+	if (!desc) {
+		return -ENOENT;
+	}
+
+	target = vgic_irouter_to_vcpu(vcpu->vm, irouter);
+	if (!target) {
+		ZVM_LOG_WARN("No vcpu has affinity 0x%llx for virq %d. \n",
+					irouter, desc->virq_num);
+		return -EINVAL;
+	}
+	desc->vcpu_id = target->vcpu_id;
+
+	return 0;
+}
+
+static uint64_t vgic_virq_get_route(struct vcpu *vcpu, uint32_t offset)
+{
+	struct virt_irq_desc *desc;
+
+	if (offset & 0x4) {
+		return 0;
+	}
+	desc = vgic_get_virt_irq_desc(vcpu, (offset - GIC_DIST_IROUTER) / 8);
+	if (!desc) {
+		return 0;
+	}
+
+	return VCPU_AFFINITY(desc->vcpu_id);
 }
 
 /**
@@ -283,6 +377,9 @@ static int vgic_gicd_mem_read(struct vcpu *vcpu, struct virt_gic_gicd *gicd,
 		case GICD_ICFGRn...(GIC_DIST_BASE + 0x0cfc - 1):
 			virt_irq_get_type(vcpu, offset, value);
 			break;
+		case (GIC_DIST_BASE + VGICD_IROUTER_SPI)...(GIC_DIST_BASE + VGICD_IROUTER_END - 1):
+			*v = vgic_virq_get_route(vcpu, offset - GIC_DIST_BASE);
+			break;
 		case (GIC_DIST_BASE + VGICD_PIDR2):
 			*value = vgic_sysreg_read32(gicd->gicd_regs_base, VGICD_PIDR2);
 			break;
@@ -339,6 +436,9 @@ static int vgic_gicd_mem_write(struct vcpu *vcpu, struct virt_gic_gicd *gicd,
 		case (GIC_DIST_BASE+VGIC_RESERVED)...(GIC_DIST_BASE+VGIC_INMIRn - 1):
 			vgic_sysreg_write32(*value, gicd->gicd_base, offset-GIC_DIST_BASE);
 			break;
+		case (GIC_DIST_BASE + VGICD_IROUTER_SPI)...(GIC_DIST_BASE + VGICD_IROUTER_END - 1):
+			vgic_virq_set_route(vcpu, offset - GIC_DIST_BASE, *v);
+			break;
 		default:
 			break;
 	}
@@ -408,29 +508,79 @@ void arch_vdev_irq_disable(struct vcpu *vcpu)
     }
 }
 
+BUILD_ASSERT(CONFIG_MAX_VCPU_PER_VM <= 32, "vcpu mask of sgi is 32 bits");
+
+/**
+ * @brief Decode the vcpus that the guest's ICC_SGI1R_EL1 value targets,
+ * the vcpus have the affinity of VCPU_AFFINITY(vcpu_id).
+ */
+static uint32_t vgic_sgi_target_mask(struct vcpu *vcpu, unsigned long sgi_value)
+{
+	uint32_t aff0, aff1, rs, tgt, vcpu_id;
+	uint32_t mask = 0;
+	struct vm *vm = vcpu->vm;
+
+	if (((sgi_value >> SGIR_IRM_SHIFT) & SGIR_IRM_MASK) == SGI_SIG_TO_OTHERS) {
+		return BIT_MASK(vm->vcpu_num) & ~BIT(vcpu->vcpu_id);
+	}
+
+	/* No vcpu has aff2 or aff3 */
+	if (sgi_value & VGIC_SGIR_AFF23_MASK) {
+		return 0;
+	}
+
+	aff1 = (sgi_value >> SGIR_AFF1_SHIFT) & VGIC_SGIR_AFF_MASK;
+	rs = (sgi_value >> VGIC_SGIR_RS_SHIFT) & VGIC_SGIR_RS_MASK;
+	tgt = sgi_value & SGIR_TGT_MASK;
+	while (tgt) {
+		aff0 = (rs << 4) + u32_count_trailing_zeros(tgt);
+		tgt &= tgt - 1;
+		if (aff0 >= BIT(VCPU_AFF0_BITS)) {
+			continue;
+		}
+		vcpu_id = (aff1 << VCPU_AFF0_BITS) | aff0;
+		if (vcpu_id < vm->vcpu_num) {
+			mask |= BIT(vcpu_id);
+		}
+	}
+
+	return mask;
+}
+
 int vgicv3_raise_sgi(struct vcpu *vcpu, unsigned long sgi_value)
 {
-	int i;
-	uint32_t sgi_id, sgi_mode;
+	uint32_t sgi_id, targets, id;
 	struct vcpu *target;
+	struct virt_irq_desc *desc;
 	struct vm *vm = vcpu->vm;
 
-	sgi_id = (sgi_value & (0xf << 24)) >> 24;
-	__ASSERT_NO_MSG(GIC_IS_SGI(sgi_id));
+	sgi_id = (sgi_value >> SGIR_INTID_SHIFT) & SGIR_INTID_MASK;
+	targets = vgic_sgi_target_mask(vcpu, sgi_value);
 
-	sgi_mode = sgi_value & (1UL << 40) ? SGI_SIG_TO_OTHERS : SGI_SIG_TO_LIST;
-	if (sgi_mode == SGI_SIG_TO_OTHERS) {
-		for (i = 0; i < vm->vcpu_num; i++) {
-			target = vm->vcpus[i];
-			if (target == vcpu) {
-				continue;
-			}
-			set_virq_to_vcpu(vcpu, sgi_id);
+	/* Self ipi, the lrs of this pcpu are flushed right before eret. */
+	if (targets & BIT(vcpu->vcpu_id)) {
+		targets &= ~BIT(vcpu->vcpu_id);
+		set_virq_to_vcpu(vcpu, sgi_id);
+	}
+
+	/**
+	 * Other vcpus only get a bit posted, they pend it on their own
+	 * flush, so the sender never contends for their spinlocks.
+	*/
+	while (targets) {
+		id = u32_count_trailing_zeros(targets);
+		targets &= targets - 1;
+		target = vm->vcpus[id];
+		if (!target) {
+			continue;
 		}
-		return 0;
-	} else {
-		ZVM_LOG_WARN("Unsupported sgi signal.");
-		return -EVIRQ;
+
+		desc = &target->virq_block.vcpu_virt_irq_desc[sgi_id];
+		if (!is_vm_irq_valid(vm, desc->virq_flags)) {
+			continue;
+		}
+		atomic_or(&target->virq_block.sgi_posted, BIT(sgi_id));
+		vgic_vcpu_kick(target);
 	}
 
 	return 0;
@@ -574,7 +724,8 @@ int set_virq_to_vm(struct vm *vm, uint32_t virq_num)
         return -ENODEV;
     }
 
-    target_vcpu = vm->vcpus[desc->vcpu_id];
+    /* spi goes to the vcpu that guest routes it to by GICD_IROUTER */
+    target_vcpu = desc->vcpu_id < vm->vcpu_num ? vm->vcpus[desc->vcpu_id] : vcpu;
     ret = vgic_set_virq(target_vcpu, desc);
     if (ret >= 0) {
 		return VM_IRQ_TO_VM_SUCCESS;
@@ -583,60 +734,87 @@ int set_virq_to_vm(struct vm *vm, uint32_t virq_num)
 	return ret;
 }
 
+void vgic_vcpu_kick(struct vcpu *vcpu)
+{
+	struct k_thread *thread = vcpu->work->vcpu_thread;
+
+	/* vcpu is idle in wfi, the sem wakes it whatever pcpu it is on. */
+	if (vcpu_wfi_kick(vcpu) || thread == _current) {
+		return;
+	}
+
+	/**
+	 * A vcpu running on another pcpu only sees the virq after a guest
+	 * exit, so kick that pcpu alone rather than waiting for its next
+	 * vtimer tick. Waking a running vcpu would introduce a pause vm
+	 * error, only a vcpu that is not running is made ready.
+	*/
+	if (zvm_thread_active_elsewhere(thread)) {
+		vgicv3_kick_pcpu(vcpu->cpu);
+	} else {
+		wakeup_target_vcpu(vcpu, NULL);
+	}
+}
+
 int virt_irq_sync_vgic(struct vcpu *vcpu)
 {
 	uint8_t lr_state;
-	uint64_t elrsr, eisr;
+	uint32_t used, elrsr, lr;
 	k_spinlock_key_t key;
 	struct virt_irq_desc *desc;
-    struct _dnode *d_node, *ds_node;
 	struct vcpu_virt_irq_block *vb = &vcpu->virq_block;
 
-	key = k_spin_lock(&vb->spinlock);
-	if (vb->virq_pending_counts == 0) {
-		k_spin_unlock(&vb->spinlock, key);
+	/* list_regs_map is only changed by this vcpu's own thread. */
+	used = (uint32_t)vcpu->arch->list_regs_map;
+	if (!used) {
 		return 0;
 	}
 
-	/* Get the maintain or valid irq */
-	elrsr = read_elrsr_el2();
-	eisr = read_eisr_el2();
-	elrsr |= eisr;
-	elrsr &= vcpu->arch->list_regs_map;
+	key = k_spin_lock(&vb->spinlock);
+	/* The empty lrs have been done by vm, there is no need to read them. */
+	elrsr = (uint32_t)read_elrsr_el2() & used;
+
+	while (used) {
+		lr = u32_count_trailing_zeros(used);
+		used &= ~BIT(lr);
+		desc = vb->lr_desc[lr];
+
+		if (elrsr & BIT(lr)) {
+			lr_state = VIRQ_STATE_INVALID;
+		} else {
+			lr_state = gicv3_get_lr_state(vcpu, desc);
+			/**
+			 * if this sync is not irq trap, keep the active virq in lr.
+			 * A hw virq always stays, the physical irq is deactivated
+			 * only when the guest deactivates it in the lr.
+			 */
+			if (lr_state == VIRQ_STATE_ACTIVE && vcpu->exit_type == ARM_VM_EXCEPTION_IRQ
+				&& !(desc->virq_flags & VIRQ_HW_FLAG)) {
+				lr_state = VIRQ_STATE_INVALID;
+				gicv3_write_lr(lr, 0);
+			}
+		}
 
-    SYS_DLIST_FOR_EACH_NODE_SAFE(&vb->active_irqs, d_node, ds_node) {
-        desc = CONTAINER_OF(d_node, struct virt_irq_desc, desc_node);
-		/* A valid interrupt? store it again! */
-		if(!VGIC_ELRSR_REG_TEST(desc->id, elrsr)){
+		desc->virq_states = lr_state;
+		if (lr_state != VIRQ_STATE_INVALID) {
 			continue;
 		}
 
-        lr_state = gicv3_get_lr_state(vcpu, desc);
-		switch (lr_state) {
-		/* vm interrupt is done or need pending again when it is active  */
-		case VIRQ_STATE_ACTIVE:
-			/* if this sync is not irq trap */
-			if(vcpu->exit_type != ARM_VM_EXCEPTION_IRQ){
-				desc->virq_states = lr_state;
-				break;
-			}
-		case VIRQ_STATE_INVALID:
-			gicv3_update_lr(vcpu, desc, ACTION_CLEAR_VIRQ, 0);
-			vcpu->arch->hcr_el2 &= ~(uint64_t)HCR_VI_BIT;
-			sys_dlist_remove(&desc->desc_node);
-			/* if software irq is still triggered */
-			if (desc->vdev_trigger) {
-				/* This means vm interrupt is done, but host interrupt is pending */
-				sys_dlist_append(&vb->pending_irqs, &desc->desc_node);
-			}
-			vb->virq_pending_counts--;
-		/* vm interrupt is still pending, no need to inject again. */
-		case VIRQ_STATE_PENDING:
-		case VIRQ_STATE_ACTIVE_AND_PENDING:
-			desc->virq_states = lr_state;
-			break;
+		/* vm interrupt is done, release the list register. */
+		VGIC_LIST_REGS_UNSET(lr, vcpu);
+		vb->lr_desc[lr] = NULL;
+		desc->id = VM_INVALID_DESC_ID;
+		vcpu->arch->hcr_el2 &= ~(uint64_t)HCR_VI_BIT;
+
+		/**
+		 * If software irq is still triggered, or the virq is set again
+		 * when it is in lr, it is pending again.
+		*/
+		if (desc->vdev_trigger || (desc->virq_flags & VIRQ_PENDING_FLAG)) {
+			desc->virq_flags |= VIRQ_PENDING_FLAG;
+			vgic_virq_pending_push(vb, desc);
 		}
-    }
+	}
 	k_spin_unlock(&vb->spinlock, key);
 
 	return 0;
@@ -644,63 +822,60 @@ int virt_irq_sync_vgic(struct vcpu *vcpu)
 
 int virt_irq_flush_vgic(struct vcpu *vcpu)
 {
-	int ret;
+	int ret, lr;
+	uint32_t posted, sgi;
 	k_spinlock_key_t key;
 	struct virt_irq_desc *desc;
-    struct _dnode *d_node, *ds_node;
 	struct vcpu_virt_irq_block *vb = &vcpu->virq_block;
 
 	key = k_spin_lock(&vb->spinlock);
-	if (vb->virq_pending_counts == 0) {
-		/* No pending irq, just return! */
-		k_spin_unlock(&vb->spinlock, key);
-		return 0;
+	/* pend the sgis that other vcpus posted to this vcpu. */
+	posted = (uint32_t)atomic_clear(&vb->sgi_posted);
+	while (posted) {
+		sgi = u32_count_trailing_zeros(posted);
+		posted &= posted - 1;
+		vgic_virq_mark_pending(vb, &vb->vcpu_virt_irq_desc[sgi]);
 	}
 
-	/* no idle list register */
-	if(vcpu->arch->list_regs_map == ((1<<VGIC_TYPER_LR_NUM) -1) ){
-		k_spin_unlock(&vb->spinlock, key);
-		ZVM_LOG_WARN("There is no idle list register! ");
-		return 0;
-	}
+	while (vb->virq_pending_counts) {
+		lr = gicv3_get_idle_lr(vcpu);
+		if (lr < 0) {
+			/* no idle list register, left the rest pending. */
+			break;
+		}
 
-    SYS_DLIST_FOR_EACH_NODE_SAFE(&vb->pending_irqs, d_node, ds_node) {
-        desc = CONTAINER_OF(d_node, struct virt_irq_desc, desc_node);
+		desc = vgic_virq_pending_pop(vcpu);
+		if (!desc) {
+			continue;
+		}
 
-		/* if there the vm interrupt is not deactived, avoid inject it again */
-		if(!(desc->virq_states==VIRQ_STATE_INVALID || desc->virq_states==VIRQ_STATE_ACTIVE)){
+		/**
+		 * The virq is still in a lr and active in vm, keep the pending
+		 * flag and it will be pended again when the lr is released.
+		*/
+		if (desc->id != VM_INVALID_DESC_ID) {
 			continue;
 		}
 
-        if (desc->virq_flags & VIRQ_PENDING_FLAG || desc->virq_flags & VIRQ_ACTIVED_FLAG) {
-			switch (VGIC_VIRQ_LEVEL_SORT(desc->virq_num)) {
-			case VGIC_VIRQ_IN_SGI:
-				vgic_set_sgi2vcpu(vcpu, desc);
-			case VGIC_VIRQ_IN_PPI:
-			default:
-				break;
-			}
-			desc->id = gicv3_get_idle_lr(vcpu);
-			if(desc->id < 0){
-				ZVM_LOG_WARN("No idle list register for virq: %d. \n", desc->id);
-				break;
-			}
-            ret = gicv3_inject_virq(vcpu, desc);
-            if (ret) {
-				k_spin_unlock(&vb->spinlock, key);
-                return ret;
-            }
-            desc->virq_states = VIRQ_STATE_PENDING;
-            desc->virq_flags &= (uint32_t)~VIRQ_PENDING_FLAG;
-            sys_dlist_remove(&desc->desc_node);
-            sys_dlist_append(&vb->active_irqs, &desc->desc_node);
-        }else {
-			ZVM_LOG_WARN("Some thing wrong, virq-id %d is not pending but in the list. \n", desc->id);
-			gicv3_update_lr(vcpu, desc, ACTION_CLEAR_VIRQ, 0);
+		switch (VGIC_VIRQ_LEVEL_SORT(desc->virq_num)) {
+		case VGIC_VIRQ_IN_SGI:
+			vgic_set_sgi2vcpu(vcpu, desc);
+		case VGIC_VIRQ_IN_PPI:
+		default:
+			break;
+		}
+
+		desc->id = lr;
+		ret = gicv3_inject_virq(vcpu, desc);
+		if (ret) {
 			desc->id = VM_INVALID_DESC_ID;
-			sys_dlist_remove(&desc->desc_node);
+			k_spin_unlock(&vb->spinlock, key);
+			return ret;
 		}
-    }
+		vb->lr_desc[lr] = desc;
+		desc->virq_states = VIRQ_STATE_PENDING;
+		desc->virq_flags &= (uint32_t)~VIRQ_PENDING_FLAG;
+	}
 	k_spin_unlock(&vb->spinlock, key);
 
 	return 0;
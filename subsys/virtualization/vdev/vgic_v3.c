@@ -13,6 +13,7 @@
 #include <arch/cpu.h>
 #include <arch/arm64/lib_helpers.h>
 #include <arch/common/sys_bitops.h>
+#include <sys/math_extras.h>
 #include <dt-bindings/interrupt-controller/arm-gic.h>
 #include <drivers/interrupt_controller/gic.h>
 #include <logging/log.h>
@@ -28,6 +29,9 @@
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
+BUILD_ASSERT(CONFIG_MAX_VCPU_PER_VM <= VGIC_RDIST_SIZE/VGIC_RD_SGI_SIZE,
+		"The vgic has less redistributors than the vcpus of a vm");
+
 #define DEV_CFG(dev) \
 	((const struct virt_device_config * const)(dev)->config)
 #define DEV_DATA(dev) \
@@ -36,38 +40,125 @@ LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 #define DEV_VGICV3(dev) \
 	((const struct gicv3_vdevice * const)(DEV_CFG(dev)->device_config))
 
+uint32_t vgicv3_lrs_mask;
+
+/* pcpus whose list registers have been cleared since reset. */
+static bool vgicv3_lrs_clean[CONFIG_MP_NUM_CPUS];
+
+/* Host sgi that kicks a vcpu out of the guest, sgi 0-2 are used by smp. */
+#define VGICV3_KICK_SGI		(3)
+
+/* mpidr of the pcpus that have the kick sgi enabled */
+static uint64_t vgicv3_pcpu_mpidr[CONFIG_MP_NUM_CPUS];
+static bool vgicv3_kick_ready[CONFIG_MP_NUM_CPUS];
+
+#define VGICV3_LR_ACCESSOR(n)						\
+static uint64_t vgicv3_read_lr##n(void)				\
+{									\
+	return read_sysreg(ICH_LR##n##_EL2);				\
+}									\
+static void vgicv3_write_lr##n(uint64_t value)			\
+{									\
+	write_sysreg(value, ICH_LR##n##_EL2);				\
+}
+
+VGICV3_LR_ACCESSOR(0)
+VGICV3_LR_ACCESSOR(1)
+VGICV3_LR_ACCESSOR(2)
+VGICV3_LR_ACCESSOR(3)
+VGICV3_LR_ACCESSOR(4)
+VGICV3_LR_ACCESSOR(5)
+VGICV3_LR_ACCESSOR(6)
+VGICV3_LR_ACCESSOR(7)
+VGICV3_LR_ACCESSOR(8)
+VGICV3_LR_ACCESSOR(9)
+VGICV3_LR_ACCESSOR(10)
+VGICV3_LR_ACCESSOR(11)
+VGICV3_LR_ACCESSOR(12)
+VGICV3_LR_ACCESSOR(13)
+VGICV3_LR_ACCESSOR(14)
+VGICV3_LR_ACCESSOR(15)
+
+static uint64_t (*const vgicv3_lr_read[VGIC_LR_MAX_NUM])(void) = {
+	vgicv3_read_lr0,
+	vgicv3_read_lr1,
+	vgicv3_read_lr2,
+	vgicv3_read_lr3,
+	vgicv3_read_lr4,
+	vgicv3_read_lr5,
+	vgicv3_read_lr6,
+	vgicv3_read_lr7,
+	vgicv3_read_lr8,
+	vgicv3_read_lr9,
+	vgicv3_read_lr10,
+	vgicv3_read_lr11,
+	vgicv3_read_lr12,
+	vgicv3_read_lr13,
+	vgicv3_read_lr14,
+	vgicv3_read_lr15
+};
+
+static void (*const vgicv3_lr_write[VGIC_LR_MAX_NUM])(uint64_t) = {
+	vgicv3_write_lr0,
+	vgicv3_write_lr1,
+	vgicv3_write_lr2,
+	vgicv3_write_lr3,
+	vgicv3_write_lr4,
+	vgicv3_write_lr5,
+	vgicv3_write_lr6,
+	vgicv3_write_lr7,
+	vgicv3_write_lr8,
+	vgicv3_write_lr9,
+	vgicv3_write_lr10,
+	vgicv3_write_lr11,
+	vgicv3_write_lr12,
+	vgicv3_write_lr13,
+	vgicv3_write_lr14,
+	vgicv3_write_lr15
+};
+
+uint64_t gicv3_read_lr(uint8_t register_id)
+{
+	return vgicv3_lr_read[register_id]();
+}
+
+void gicv3_write_lr(uint8_t register_id, uint64_t value)
+{
+	vgicv3_lr_write[register_id](value);
+}
+
 /**
- * @brief load list register for vcpu interface.
+ * @brief clear all the implemented list registers of this pcpu.
  */
-static void vgicv3_lrs_load(struct gicv3_vcpuif_ctxt *ctxt)
+static void vgicv3_lrs_clear(void)
 {
-    uint32_t rg_cout = VGIC_TYPER_LR_NUM;
+	uint32_t lr, lrs = vgicv3_lrs_mask;
 
-    if (rg_cout > VGIC_TYPER_LR_NUM) {
-        ZVM_LOG_WARN("System list registers do not support! \n");
-        return;
-    }
+	while (lrs) {
+		lr = u32_count_trailing_zeros(lrs);
+		lrs &= ~BIT(lr);
+		gicv3_write_lr(lr, 0);
+	}
+}
 
-	switch (rg_cout) {
-	case 8:
-		write_sysreg(ctxt->ich_lr7_el2, ICH_LR7_EL2);
-	case 7:
-		write_sysreg(ctxt->ich_lr6_el2, ICH_LR6_EL2);
-	case 6:
-		write_sysreg(ctxt->ich_lr5_el2, ICH_LR5_EL2);
-	case 5:
-		write_sysreg(ctxt->ich_lr4_el2, ICH_LR4_EL2);
-	case 4:
-		write_sysreg(ctxt->ich_lr3_el2, ICH_LR3_EL2);
-	case 3:
-		write_sysreg(ctxt->ich_lr2_el2, ICH_LR2_EL2);
-	case 2:
-		write_sysreg(ctxt->ich_lr1_el2, ICH_LR1_EL2);
-	case 1:
-		write_sysreg(ctxt->ich_lr0_el2, ICH_LR0_EL2);
-		break;
-	default:
-		break;
+/**
+ * @brief load list register for vcpu interface, only the occupied
+ * lrs are restored, the others are left empty by the last save.
+ */
+static void vgicv3_lrs_load(struct vcpu *vcpu, struct gicv3_vcpuif_ctxt *ctxt)
+{
+	uint32_t lr, used = (uint32_t)vcpu->arch->list_regs_map;
+	int cpu = arch_curr_cpu()->id;
+
+	if (!vgicv3_lrs_clean[cpu]) {
+		vgicv3_lrs_clear();
+		vgicv3_lrs_clean[cpu] = true;
+	}
+
+	while (used) {
+		lr = u32_count_trailing_zeros(used);
+		used &= ~BIT(lr);
+		gicv3_write_lr(lr, ctxt->ich_lr_el2[lr]);
 	}
 }
 
@@ -100,35 +191,19 @@ static void vgicv3_ctrls_load(struct gicv3_vcpuif_ctxt *ctxt)
 	write_sysreg(ctxt->ich_hcr_el2, ICH_HCR_EL2);
 }
 
-static void vgicv3_lrs_save(struct gicv3_vcpuif_ctxt *ctxt)
+/**
+ * @brief save the occupied list registers and clear them, so that
+ * the next vcpu on this pcpu starts with empty lrs.
+ */
+static void vgicv3_lrs_save(struct vcpu *vcpu, struct gicv3_vcpuif_ctxt *ctxt)
 {
-	uint32_t rg_cout = VGIC_TYPER_LR_NUM;
-
-    if (rg_cout > VGIC_TYPER_LR_NUM) {
-        ZVM_LOG_WARN("System list registers do not support! \n");
-        return;
-    }
+	uint32_t lr, used = (uint32_t)vcpu->arch->list_regs_map;
 
-	switch (rg_cout) {
-	case 8:
-		ctxt->ich_lr7_el2 = read_sysreg(ICH_LR7_EL2);
-	case 7:
-		ctxt->ich_lr6_el2 = read_sysreg(ICH_LR6_EL2);
-	case 6:
-		ctxt->ich_lr5_el2 = read_sysreg(ICH_LR5_EL2);
-	case 5:
-		ctxt->ich_lr4_el2 = read_sysreg(ICH_LR4_EL2);
-	case 4:
-		ctxt->ich_lr3_el2 = read_sysreg(ICH_LR3_EL2);
-	case 3:
-		ctxt->ich_lr2_el2 = read_sysreg(ICH_LR2_EL2);
-	case 2:
-		ctxt->ich_lr1_el2 = read_sysreg(ICH_LR1_EL2);
-	case 1:
-		ctxt->ich_lr0_el2 = read_sysreg(ICH_LR0_EL2);
-		break;
-	default:
-		break;
+	while (used) {
+		lr = u32_count_trailing_zeros(used);
+		used &= ~BIT(lr);
+		ctxt->ich_lr_el2[lr] = gicv3_read_lr(lr);
+		gicv3_write_lr(lr, 0);
 	}
 }
 
@@ -136,34 +211,13 @@ static void vgicv3_lrs_init(void)
 {
     uint32_t rg_cout = VGIC_TYPER_LR_NUM;
 
-    if (rg_cout > VGIC_TYPER_LR_NUM) {
+    if (rg_cout > VGIC_LR_MAX_NUM) {
         ZVM_LOG_WARN("System list registers do not support! \n");
-        return;
+        rg_cout = VGIC_LR_MAX_NUM;
     }
+	vgicv3_lrs_mask = BIT_MASK(rg_cout);
 
-	rg_cout = rg_cout>8 ? 8 : rg_cout;
-
-	switch (rg_cout) {
-	case 8:
-		write_sysreg(0, ICH_LR7_EL2);
-	case 7:
-		write_sysreg(0, ICH_LR6_EL2);
-	case 6:
-		write_sysreg(0, ICH_LR5_EL2);
-	case 5:
-		write_sysreg(0, ICH_LR4_EL2);
-	case 4:
-		write_sysreg(0, ICH_LR3_EL2);
-	case 3:
-		write_sysreg(0, ICH_LR2_EL2);
-	case 2:
-		write_sysreg(0, ICH_LR1_EL2);
-	case 1:
-		write_sysreg(0, ICH_LR0_EL2);
-		break;
-	default:
-		break;
-	}
+	vgicv3_lrs_clear();
 }
 
 static void vgicv3_prios_save(struct gicv3_vcpuif_ctxt *ctxt)
@@ -201,26 +255,27 @@ int gicv3_inject_virq(struct vcpu *vcpu, struct virt_irq_desc *desc)
 	uint64_t value = 0;
 	struct gicv3_list_reg *lr = (struct gicv3_list_reg *)&value;
 
-	if (desc->id >= VGIC_TYPER_LR_NUM) {
+	if (desc->id >= VGIC_LR_MAX_NUM || !(BIT(desc->id) & vgicv3_lrs_mask)) {
 		ZVM_LOG_WARN("invalid virq id %d, It is used by other device! \n", desc->id);
 		return -EINVAL;
 	}
 
-	/* List register is not activated. */
-	if (VGIC_LIST_REGS_TEST(desc->id, vcpu)) {
-		value = gicv3_read_lr(desc->id);
-		lr = (struct gicv3_list_reg *)&value;
-		if (lr->vINTID == desc->virq_num) {
-			desc->virq_flags |= VIRQ_PENDING_FLAG;
-		}
-	}
-
 	lr->vINTID = desc->virq_num;
-	lr->pINTID = desc->pirq_num;
 	lr->priority = desc->prio;
 	lr->group = LIST_REG_GROUP1;
-	lr->hw = LIST_REG_HW_VIRQ;
 	lr->state = VIRQ_STATE_PENDING;
+	/**
+	 * Link the virq to its physical irq, the guest's deactivation then
+	 * deactivates the physical irq as well, without a trap to zvm.
+	 * A fully emulated virq has no physical irq to deactivate.
+	 */
+	if ((desc->virq_flags & VIRQ_HW_FLAG) && desc->pirq_num >= VM_SGI_VIRQ_NR) {
+		lr->pINTID = desc->pirq_num;
+		lr->hw = LIST_REG_HW_VIRQ;
+	} else {
+		lr->pINTID = 0;
+		lr->hw = LIST_REG_NHW_VIRQ;
+	}
 	gicv3_update_lr(vcpu, desc, ACTION_SET_VIRQ, value);
 	return 0;
 }
@@ -366,9 +421,47 @@ int get_vcpu_gicr_type(struct virt_gic_gicr *gicr,
 	return TYPE_GIC_INVAILD;
 }
 
+/**
+ * @brief The exit from guest is all that a kick needs, pending virqs are
+ * flushed to list registers before the vcpu enters again.
+ */
+static void vgicv3_kick_isr(const void *arg)
+{
+	ARG_UNUSED(arg);
+}
+
+void vgicv3_kick_pcpu(uint16_t cpu)
+{
+	uint64_t mpidr;
+
+	if (cpu >= CONFIG_MP_NUM_CPUS || !vgicv3_kick_ready[cpu]) {
+		return;
+	}
+
+	/**
+	 * Written by hand, gic_raise_sgi() broadcasts to all the other cpus.
+	 * MPIDR_AFFLVL() masks 16 bits, the fields of SGI1R are 8 bits each.
+	 */
+	mpidr = vgicv3_pcpu_mpidr[cpu];
+	__DSB();
+	write_sysreg(GICV3_SGIR_VALUE(MPIDR_AFFLVL(mpidr, 3), MPIDR_AFFLVL(mpidr, 2),
+				MPIDR_AFFLVL(mpidr, 1), VGICV3_KICK_SGI, SGIR_IRM_TO_AFF,
+				BIT(mpidr & 0xff)), ICC_SGI1R);
+	__ISB();
+}
+
 int vgicv3_state_load(struct vcpu *vcpu, struct gicv3_vcpuif_ctxt *ctxt)
 {
-    vgicv3_lrs_load(ctxt);
+	int cpu = _current_cpu->id;
+
+	/* Sgi is enabled per redistributor, do it on the first vcpu load. */
+	if (!vgicv3_kick_ready[cpu]) {
+		vgicv3_pcpu_mpidr[cpu] = GET_MPIDR();
+		irq_enable(VGICV3_KICK_SGI);
+		vgicv3_kick_ready[cpu] = true;
+	}
+
+    vgicv3_lrs_load(vcpu, ctxt);
     vgicv3_prios_load(ctxt);
     vgicv3_ctrls_load(ctxt);
 
@@ -378,7 +471,7 @@ int vgicv3_state_load(struct vcpu *vcpu, struct gicv3_vcpuif_ctxt *ctxt)
 
 int vgicv3_state_save(struct vcpu *vcpu, struct gicv3_vcpuif_ctxt *ctxt)
 {
-    vgicv3_lrs_save(ctxt);
+    vgicv3_lrs_save(vcpu, ctxt);
     vgicv3_prios_save(ctxt);
     vgicv3_ctrls_save(ctxt);
 
@@ -422,7 +515,7 @@ static int vdev_gicv3_init(struct vm *vm, struct vgicv3_dev *gicv3_vdev, uint32_
 	/* GICD PIDR2 */
 	vgic_sysreg_write32(0x3<<4, gicd->gicd_regs_base, VGICD_PIDR2);
     spi_num = ((VM_GLOBAL_VIRQ_NR + 32) >> 5) - 1;
-	tmp_typer = (vm->vcpu_num << 5) | (9 << 19) | spi_num;
+	tmp_typer = ((MIN(vm->vcpu_num, 8) - 1) << 5) | (9 << 19) | spi_num;
 	vgic_sysreg_write32(tmp_typer, gicd->gicd_regs_base, VGICD_TYPER);
 	/* Init spinlock */
 	ZVM_SPINLOCK_INIT(&gicd->gicd_lock);
@@ -457,14 +550,15 @@ static int vdev_gicv3_init(struct vm *vm, struct vgicv3_dev *gicv3_vdev, uint32_
 		/* Init spinlock */
 		ZVM_SPINLOCK_INIT(&gicr->gicr_lock);
 
+		/* affinity matches the vcpu's mpidr, so the guest finds its gicr */
+		tmp_typer = (VCPU_AFFINITY(i) << 32) |
+					((uint64_t)i << GICR_TYPER_PROCESSOR_NUMBER_SHIFT);
 		if(i >= vm->vcpu_num - 1){
 			/* set last gicr region flag here, means it is the last gicr region */
-			vgic_sysreg_write64(GICR_TYPER_LAST_FLAG, gicr->gicr_rd_reg_base, VGICR_TYPER);
-			vgic_sysreg_write64(GICR_TYPER_LAST_FLAG, gicr->gicr_sgi_reg_base, VGICR_TYPER);
-		}else{
-			vgic_sysreg_write64((uint64_t)i << 32, gicr->gicr_rd_reg_base, VGICR_TYPER);
-			vgic_sysreg_write64((uint64_t)i << 32, gicr->gicr_sgi_reg_base, VGICR_TYPER);
+			tmp_typer |= GICR_TYPER_LAST_FLAG;
 		}
+		vgic_sysreg_write64(tmp_typer, gicr->gicr_rd_reg_base, VGICR_TYPER);
+		vgic_sysreg_write64(tmp_typer, gicr->gicr_sgi_reg_base, VGICR_TYPER);
 
 		gicv3_vdev->gicr[i] = gicr;
     }
@@ -530,6 +624,8 @@ static int vm_vgicv3_init(const struct device *dev, struct vm *vm, struct virt_d
 */
 static int vgicv3_init(const struct device *dev)
 {
+	IRQ_CONNECT(VGICV3_KICK_SGI, IRQ_DEFAULT_PRIORITY, vgicv3_kick_isr, NULL, 0);
+
 	return 0;
 }
 
@@ -8,6 +8,8 @@
 #include <zephyr.h>
 #include <spinlock.h>
 #include <sys/dlist.h>
+#include <sys/mem_manage.h>
+#include <arch/arm64/lib_helpers.h>
 
 #include <virtualization/vm.h>
 #include <virtualization/vdev/virtio/virtio.h>
@@ -81,23 +83,22 @@ uint32_t virtio_queue_max_desc(struct virtio_queue *vq)
 int virtio_queue_get_desc(struct virtio_queue *vq, uint16_t indx,
 			      struct vring_desc *desc)
 {
-	physical_addr_t desc_gpa;
-
 	if (!vq || !vq->guest || !desc) {
 		return -EINVAL;
 	}
 
-	desc_gpa = vq->vring.desc_base_gpa + indx * sizeof(*desc);
-	vm_guest_memory_read(vq->guest, desc_gpa, desc, sizeof(*desc));
+	if (indx >= vq->desc_count) {
+		return -EINVAL;
+	}
+
+	*desc = vq->vring.desc[indx];
 
 	return 0;
 }
 
 uint16_t virtio_queue_pop(struct virtio_queue *vq)
 {
-	uint16_t val;
 	uint32_t idx;
-	physical_addr_t avail_gpa;
 
 	if (!vq || !vq->guest) {
 		return -EINVAL;
@@ -106,23 +107,20 @@ uint16_t virtio_queue_pop(struct virtio_queue *vq)
 	idx = vq->last_avail_idx & (vq->desc_count- 1);
 	vq->last_avail_idx++;
 
-	avail_gpa = vq->vring.avail_base_gpa + offsetof(struct vring_avail, ring[idx]);
-	vm_guest_memory_read(vq->guest, avail_gpa, (void *)&val, sizeof(val));
-
-	return val;
+	return vq->vring.avail->ring[idx];
 }
 
 bool virtio_queue_available(struct virtio_queue *vq)
 {
 	uint16_t val;
-	physical_addr_t avail_gpa;
 
 	if (!vq || !vq->guest) {
 		return false;
 	}
 
-	avail_gpa = vq->vring.avail_base_gpa + offsetof(struct vring_avail, idx);
-	vm_guest_memory_read(vq->guest, avail_gpa, (void *)&val, sizeof(val));
+	val = *(volatile uint16_t *)&vq->vring.avail->idx;
+	/* The avail ring entries must be read after the avail idx. */
+	dmb();
 
 	return val != vq->last_avail_idx;
 }
@@ -130,7 +128,6 @@ bool virtio_queue_available(struct virtio_queue *vq)
 bool virtio_queue_should_signal(struct virtio_queue *vq)
 {
 	uint16_t old_idx, new_idx, event_idx;
-	physical_addr_t used_gpa, avail_gpa;
 
 	if (!vq || !vq->guest) {
 		return false;
@@ -138,11 +135,10 @@ bool virtio_queue_should_signal(struct virtio_queue *vq)
 
 	old_idx = vq->last_used_signalled;
 
-	used_gpa = vq->vring.used_base_gpa + offsetof(struct vring_used, idx);
-	vm_guest_memory_read(vq->guest, used_gpa, (void *)&new_idx, sizeof(new_idx));
-
-	avail_gpa = vq->vring.avail_base_gpa + offsetof(struct vring_avail, ring[vq->vring.num]);
-	vm_guest_memory_read(vq->guest, avail_gpa, (void *)&event_idx, sizeof(event_idx));
+	/* The used idx update must be visible before reading used_event. */
+	dmb();
+	new_idx = *(volatile uint16_t *)&vq->vring.used->idx;
+	event_idx = *(volatile uint16_t *)&vring_used_event(&vq->vring);
 
 	if (vring_need_event(event_idx, new_idx, old_idx)) {
 		vq->last_used_signalled = new_idx;
@@ -154,40 +150,30 @@ bool virtio_queue_should_signal(struct virtio_queue *vq)
 
 void virtio_queue_set_avail_event(struct virtio_queue *vq)
 {
-	uint16_t val;
-	physical_addr_t avail_evt_pa;
-
 	if (!vq || !vq->guest) {
 		return;
 	}
 
-	val = vq->last_avail_idx;
-	avail_evt_pa = vq->vring.used_base_gpa + offsetof(struct vring_used, ring[vq->vring.num]);
-	vm_guest_memory_write(vq->guest, avail_evt_pa, (void *)&val, sizeof(val));
+	*(volatile uint16_t *)&vring_avail_event(&vq->vring) = vq->last_avail_idx;
 }
 
 void virtio_queue_set_used_elem(struct virtio_queue *vq, uint32_t head, uint32_t len)
 {
 	uint16_t used_idx;
-	struct vring_used_elem used_elem;
-	physical_addr_t used_idx_pa, used_elem_pa;
+	struct vring_used_elem *used_elem;
 
 	if (!vq || !vq->guest) {
 		return;
 	}
 
-	used_idx_pa = vq->vring.used_base_gpa + offsetof(struct vring_used, idx);
-	vm_guest_memory_read(vq->guest, used_idx_pa, &used_idx, sizeof(used_idx));
-
-	used_elem.id = head;
-	used_elem.len = len;
+	used_idx = vq->vring.used->idx;
+	used_elem = &vq->vring.used->ring[used_idx & (vq->vring.num - 1)];
+	used_elem->id = head;
+	used_elem->len = len;
 
-	used_idx = used_idx & (vq->vring.num - 1);
-	used_elem_pa = vq->vring.used_base_gpa + offsetof(struct vring_used, ring[used_idx]);
-	vm_guest_memory_write(vq->guest, used_elem_pa, (void *)&used_elem, sizeof(used_elem));
-
-	used_idx++;
-	vm_guest_memory_write(vq->guest, used_idx_pa, &used_idx, sizeof(used_idx));
+	/* The used element must be visible before the used idx. */
+	dmb();
+	*(volatile uint16_t *)&vq->vring.used->idx = used_idx + 1;
 }
 
 bool virtio_queue_setup_done(struct virtio_queue *vq)
@@ -201,6 +187,15 @@ bool virtio_queue_cleanup(struct virtio_queue *vq)
 		goto done;
 	}
 
+	if (vq->host_map_size) {
+		z_phys_unmap(vq->host_map_base, vq->host_map_size);
+	} else {
+		/* The vring was pinned in guest ram by the setup. */
+		vm_gpa_hva_put(vq->guest, vq->guest_addr);
+	}
+	vq->host_map_base = NULL;
+	vq->host_map_size = 0;
+
 	vq->last_avail_idx = 0;
 	vq->last_used_signalled = 0;
 
@@ -214,6 +209,7 @@ bool virtio_queue_cleanup(struct virtio_queue *vq)
 	vq->guest_addr = 0;
 	vq->host_addr = 0;
 	vq->total_size = 0;
+	memset(&vq->vring, 0, sizeof(vq->vring));
 
 done:
 	return true;
@@ -227,12 +223,8 @@ bool virtio_queue_setup(struct virtio_queue *vq,
 {
 	physical_addr_t gphys_addr, hphys_addr;
 	physical_size_t gphys_size, avail_size;
-	struct vm_mem_partition *vpart;
-
-    vpart = (struct vm_mem_partition *)k_malloc(sizeof(struct vm_mem_partition));
-    if (!vpart) {
-        return false;
-    }	
+	struct vm_mem_partition *vpart = NULL;
+	uint8_t *vring_base;
 
 	if(!virtio_queue_cleanup(vq)) {
 			return false;
@@ -240,16 +232,39 @@ bool virtio_queue_setup(struct virtio_queue *vq,
 
 	gphys_addr = guest_pfn * guest_page_size;
 	gphys_size = vring_size(desc_count, align);
-	hphys_addr = vm_gpa_to_hpa(guest, gphys_addr, vpart);
-	avail_size = vpart->part_hpa_size - (hphys_addr - vpart->part_hpa_base);
-
-	if(avail_size < gphys_size) {
-		printk("%s: available size less than required size\n",
-			   __func__);
+	hphys_addr = vm_gpa_to_hpa(guest, gphys_addr, &vpart);
+	if (!vpart) {
+		printk("%s: guest address 0x%llx is not mapped\n",
+			   __func__, gphys_addr);
 		return false;
-	}	
+	}
+
+	/**
+	 * Map the whole vring once, it is accessed directly until cleanup,
+	 * so the balloon can not take it.
+	 */
+	vring_base = vm_gpa_hva_get(guest, gphys_addr, gphys_size);
+	if (!vring_base) {
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+		/* The blocks of demand populated ram are not contiguous. */
+		if (vpart->blk_hva) {
+			printk("%s: vring crosses a guest ram block\n", __func__);
+			return false;
+		}
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+		avail_size = vpart->part_hpa_size - (hphys_addr - vpart->part_hpa_base);
+		if(avail_size < gphys_size) {
+			printk("%s: available size less than required size\n",
+				   __func__);
+			return false;
+		}
+		z_phys_map(&vring_base, hphys_addr, gphys_size,
+			   K_MEM_CACHE_WB | K_MEM_PERM_RW);
+		vq->host_map_base = vring_base;
+		vq->host_map_size = gphys_size;
+	}
 
-	vring_init(&vq->vring, desc_count, NULL, gphys_addr, align);
+	vring_init(&vq->vring, desc_count, vring_base, gphys_addr, align);
 
 	vq->guest = guest;
 	vq->desc_count = desc_count;
@@ -430,6 +445,114 @@ uint32_t virtio_buf_to_iovec_write(struct virtio_device *dev,
 	return pos;	
 }
 
+/**
+ * @brief Map the guest page holding @gpa to the hypervisor, the caller
+ * gives it back with virtio_guest_page_unmap().
+ */
+static uint8_t *virtio_guest_page_map(struct vm *vm, uint64_t gpa)
+{
+	uint8_t *hva;
+	uint64_t hpa;
+	struct vm_mem_partition *vpart = NULL;
+
+	hpa = vm_gpa_to_hpa(vm, gpa & ~(uint64_t)(CONFIG_MMU_PAGE_SIZE - 1), &vpart);
+	if (!vpart) {
+		return NULL;
+	}
+	z_phys_map(&hva, hpa, CONFIG_MMU_PAGE_SIZE, K_MEM_CACHE_WB | K_MEM_PERM_RW);
+
+	return hva + (gpa & (CONFIG_MMU_PAGE_SIZE - 1));
+}
+
+static void virtio_guest_page_unmap(uint8_t *hva)
+{
+	z_phys_unmap((uint8_t *)((uintptr_t)hva & ~(uintptr_t)(CONFIG_MMU_PAGE_SIZE - 1)),
+		     CONFIG_MMU_PAGE_SIZE);
+}
+
+uint32_t virtio_iovec_to_iovec_copy(struct virtio_device *dst_dev,
+				   struct virtio_iovec *dst_iov,
+				   uint32_t dst_cnt, uint32_t dst_off,
+				   struct virtio_device *src_dev,
+				   struct virtio_iovec *src_iov,
+				   uint32_t src_cnt, uint32_t src_off,
+				   uint32_t len)
+{
+	uint32_t i = 0, j = 0, pos = 0, chunk;
+	uint64_t src_gpa, dst_gpa;
+	uint8_t *src, *dst, *src_map, *dst_map;
+
+	while (i < src_cnt && src_off >= src_iov[i].len) {
+		src_off -= src_iov[i++].len;
+	}
+	while (j < dst_cnt && dst_off >= dst_iov[j].len) {
+		dst_off -= dst_iov[j++].len;
+	}
+
+	while (pos < len && i < src_cnt && j < dst_cnt) {
+		chunk = MIN(len - pos, MIN(src_iov[i].len - src_off,
+					   dst_iov[j].len - dst_off));
+
+		src_gpa = src_iov[i].addr + src_off;
+		dst_gpa = dst_iov[j].addr + dst_off;
+
+		/* Straight from one guest to the other when both are mapped. */
+		src = vm_gpa_hva_get(src_dev->guest, src_gpa, chunk);
+		dst = vm_gpa_hva_get(dst_dev->guest, dst_gpa, chunk);
+		src_map = NULL;
+		dst_map = NULL;
+		if (!src || !dst) {
+			/* Translate and map each unmapped page once for the chunk. */
+			chunk = MIN(chunk, CONFIG_MMU_PAGE_SIZE -
+					(src_gpa & (CONFIG_MMU_PAGE_SIZE - 1)));
+			chunk = MIN(chunk, CONFIG_MMU_PAGE_SIZE -
+					(dst_gpa & (CONFIG_MMU_PAGE_SIZE - 1)));
+			if (!src) {
+				src_map = virtio_guest_page_map(src_dev->guest, src_gpa);
+			}
+			if (!dst) {
+				dst_map = virtio_guest_page_map(dst_dev->guest, dst_gpa);
+			}
+		}
+		if ((src || src_map) && (dst || dst_map)) {
+			memcpy(dst ? dst : dst_map, src ? src : src_map, chunk);
+		} else {
+			printk("%s: gpa to hpa failed!\n", __func__);
+			chunk = 0;
+		}
+
+		if (src) {
+			vm_gpa_hva_put(src_dev->guest, src_gpa);
+		}
+		if (dst) {
+			vm_gpa_hva_put(dst_dev->guest, dst_gpa);
+		}
+		if (src_map) {
+			virtio_guest_page_unmap(src_map);
+		}
+		if (dst_map) {
+			virtio_guest_page_unmap(dst_map);
+		}
+		if (!chunk) {
+			break;
+		}
+
+		pos += chunk;
+		src_off += chunk;
+		dst_off += chunk;
+		if (src_off == src_iov[i].len) {
+			src_off = 0;
+			i++;
+		}
+		if (dst_off == dst_iov[j].len) {
+			dst_off = 0;
+			j++;
+		}
+	}
+
+	return pos;
+}
+
 void virtio_iovec_fill_zeros(struct virtio_device *dev,
 				 struct virtio_iovec *iov,
 				 uint32_t iov_cnt)
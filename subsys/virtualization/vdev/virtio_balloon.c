@@ -0,0 +1,444 @@
+/**
+ * @file virtio_balloon.c
+ * @brief VirtIO based memory balloon device Emulator.
+ *
+ * The host sets the balloon target of a vm, and the guest gives pages to
+ * the balloon until it is reached. The guest ram is populated by blocks,
+ * so a block goes back to the host pool once all its pages are in the
+ * balloon. Deflated pages are populated again when the guest touches them.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <zephyr.h>
+#include <spinlock.h>
+#include <sys/atomic.h>
+#include <sys/dlist.h>
+
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/vm_mm.h>
+#include <virtualization/vdev/virtio/virtio.h>
+#include <virtualization/vdev/virtio/virtio_balloon.h>
+
+#define VIRTIO_BALLOON_QUEUE_SIZE		64
+#define VIRTIO_BALLOON_INFLATE_QUEUE	0
+#define VIRTIO_BALLOON_DEFLATE_QUEUE	1
+#define VIRTIO_BALLOON_STATS_QUEUE		2
+#define VIRTIO_BALLOON_NUM_QUEUES		3
+/* PFNs read from the guest at a time */
+#define VIRTIO_BALLOON_PFN_BATCH		64
+
+struct virtio_balloon_dev {
+	struct virtio_device	*vdev;
+
+	/* Protects the queues, iov and stats. */
+	struct k_spinlock		lock;
+	struct virtio_queue		vqs[VIRTIO_BALLOON_NUM_QUEUES];
+	struct virtio_iovec		iov[VIRTIO_BALLOON_QUEUE_SIZE];
+	uint64_t				features;
+
+	/* Serializes the pfn processing, which runs without the lock. */
+	struct k_mutex			pfn_mutex;
+	struct virtio_iovec		pfn_iov[VIRTIO_BALLOON_QUEUE_SIZE];
+	/* pages the guest gave while a vdev buffer was in their block */
+	atomic_t				busy_pages;
+
+	struct virtio_balloon_config	config;
+
+	/* The stats buffer is kept until the host wants new stats. */
+	bool					stats_pending;
+	uint16_t				stats_head;
+	bool					stats_valid;
+	uint64_t				stats[VIRTIO_BALLOON_S_NR];
+
+	sys_dnode_t				node;
+};
+
+static sys_dlist_t virtio_balloon_devs = SYS_DLIST_STATIC_INIT(&virtio_balloon_devs);
+static struct k_spinlock virtio_balloon_devs_lock;
+
+/**
+ * @brief Inflate or deflate the pages listed in the buffers of @vq. The
+ * device lock is only held to pop and complete a buffer, not for the pfns.
+ * @return bool : whether the guest should be signaled.
+ */
+static bool virtio_balloon_do_pfns(struct virtio_balloon_dev *vbdev,
+				struct virtio_queue *vq, bool inflate)
+{
+	bool got, signal = false;
+	uint16_t head;
+	uint32_t i, j, n, iov_cnt, len;
+	uint64_t addr, remain;
+	uint32_t pfns[VIRTIO_BALLOON_PFN_BATCH];
+	k_spinlock_key_t key;
+	struct vm *guest = vbdev->vdev->guest;
+
+	k_mutex_lock(&vbdev->pfn_mutex, K_FOREVER);
+	while (1) {
+		key = k_spin_lock(&vbdev->lock);
+		if (!virtio_queue_available(vq)) {
+			k_spin_unlock(&vbdev->lock, key);
+			break;
+		}
+		head = virtio_queue_pop(vq);
+		got = virtio_queue_get_head_iovec(vq, head, vbdev->pfn_iov,
+					&iov_cnt, &len, &head);
+		k_spin_unlock(&vbdev->lock, key);
+		if (!got) {
+			printk("%s: failed to get iovec\n", __func__);
+			break;
+		}
+
+		for (i = 0; i < iov_cnt; i++) {
+			addr = vbdev->pfn_iov[i].addr;
+			remain = vbdev->pfn_iov[i].len / sizeof(uint32_t);
+			while (remain) {
+				n = MIN(remain, VIRTIO_BALLOON_PFN_BATCH);
+				vm_guest_memory_read(guest, addr, pfns, n * sizeof(uint32_t));
+				for (j = 0; j < n; j++) {
+					if (vm_mem_page_balloon(guest, (uint64_t)pfns[j]
+							<< VIRTIO_BALLOON_PFN_SHIFT, inflate) == -EBUSY) {
+						atomic_inc(&vbdev->busy_pages);
+					}
+				}
+				addr += n * sizeof(uint32_t);
+				remain -= n;
+			}
+		}
+
+		key = k_spin_lock(&vbdev->lock);
+		virtio_queue_set_used_elem(vq, head, 0);
+		signal = signal || virtio_queue_should_signal(vq);
+		k_spin_unlock(&vbdev->lock, key);
+	}
+	k_mutex_unlock(&vbdev->pfn_mutex);
+
+	return signal;
+}
+
+/**
+ * @brief Save the stats in the buffer of the guest, and keep the buffer
+ * until the host asks for new stats.
+ */
+static void virtio_balloon_do_stats(struct virtio_balloon_dev *vbdev)
+{
+	uint16_t head;
+	uint32_t i, n, iov_cnt, len;
+	struct virtio_balloon_stat stats[VIRTIO_BALLOON_S_NR];
+	struct virtio_queue *vq = &vbdev->vqs[VIRTIO_BALLOON_STATS_QUEUE];
+
+	while (virtio_queue_available(vq)) {
+		/* The guest has one stats buffer, an old one is given back. */
+		if (vbdev->stats_pending) {
+			virtio_queue_set_used_elem(vq, vbdev->stats_head, 0);
+			vbdev->stats_pending = false;
+		}
+
+		head = virtio_queue_pop(vq);
+		if (!virtio_queue_get_head_iovec(vq, head, vbdev->iov, &iov_cnt, &len, &head)) {
+			printk("%s: failed to get iovec\n", __func__);
+			return;
+		}
+
+		len = virtio_iovec_to_buf_read(vbdev->vdev, vbdev->iov, iov_cnt,
+					stats, sizeof(stats));
+		n = len / sizeof(struct virtio_balloon_stat);
+		for (i = 0; i < n; i++) {
+			if (stats[i].tag < VIRTIO_BALLOON_S_NR) {
+				vbdev->stats[stats[i].tag] = stats[i].val;
+			}
+		}
+		vbdev->stats_valid = vbdev->stats_valid || n;
+		vbdev->stats_head = head;
+		vbdev->stats_pending = true;
+	}
+}
+
+static struct virtio_balloon_dev *virtio_balloon_find(struct vm *vm)
+{
+	sys_dnode_t *d_node;
+	struct virtio_balloon_dev *vbdev;
+
+	SYS_DLIST_FOR_EACH_NODE(&virtio_balloon_devs, d_node) {
+		vbdev = CONTAINER_OF(d_node, struct virtio_balloon_dev, node);
+		if (vbdev->vdev->guest == vm) {
+			return vbdev;
+		}
+	}
+
+	return NULL;
+}
+
+int virtio_balloon_set_target(struct vm *vm, uint32_t pages)
+{
+	k_spinlock_key_t key;
+	struct virtio_device *dev;
+	struct virtio_balloon_dev *vbdev;
+
+	key = k_spin_lock(&virtio_balloon_devs_lock);
+	vbdev = virtio_balloon_find(vm);
+	if (!vbdev) {
+		k_spin_unlock(&virtio_balloon_devs_lock, key);
+		return -ENODEV;
+	}
+	dev = vbdev->vdev;
+	vbdev->config.num_pages = pages;
+	k_spin_unlock(&virtio_balloon_devs_lock, key);
+
+	if (dev->tra->config_notify) {
+		return dev->tra->config_notify(dev);
+	}
+
+	return 0;
+}
+
+int virtio_balloon_get_info(struct vm *vm, struct virtio_balloon_info *info)
+{
+	bool signal = false;
+	k_spinlock_key_t key, dev_key;
+	struct virtio_device *dev;
+	struct virtio_balloon_dev *vbdev;
+
+	key = k_spin_lock(&virtio_balloon_devs_lock);
+	vbdev = virtio_balloon_find(vm);
+	if (!vbdev) {
+		k_spin_unlock(&virtio_balloon_devs_lock, key);
+		return -ENODEV;
+	}
+	dev = vbdev->vdev;
+
+	dev_key = k_spin_lock(&vbdev->lock);
+	info->target_pages = vbdev->config.num_pages;
+	info->actual_pages = vbdev->config.actual;
+	info->busy_pages = atomic_get(&vbdev->busy_pages);
+	info->stats_valid = vbdev->stats_valid;
+	memcpy(info->stats, vbdev->stats, sizeof(info->stats));
+
+	/* Returning the stats buffer asks the guest for new stats. */
+	if (vbdev->stats_pending) {
+		virtio_queue_set_used_elem(&vbdev->vqs[VIRTIO_BALLOON_STATS_QUEUE],
+					vbdev->stats_head, 0);
+		vbdev->stats_pending = false;
+		signal = true;
+	}
+	k_spin_unlock(&vbdev->lock, dev_key);
+	k_spin_unlock(&virtio_balloon_devs_lock, key);
+
+	if (signal) {
+		dev->tra->notify(dev, VIRTIO_BALLOON_STATS_QUEUE);
+	}
+
+	return 0;
+}
+
+static uint64_t virtio_balloon_get_host_features(struct virtio_device *dev)
+{
+	return	1UL << VIRTIO_BALLOON_F_STATS_VQ
+		| 1UL << VIRTIO_BALLOON_F_DEFLATE_ON_OOM;
+}
+
+static void virtio_balloon_set_guest_features(struct virtio_device *dev,
+					  uint32_t select, uint32_t features)
+{
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+
+	if (1 < select)
+		return;
+
+	vbdev->features &= ~((uint64_t)UINT_MAX << (select * 32));
+	vbdev->features |= ((uint64_t)features << (select * 32));
+}
+
+static int virtio_balloon_init_vq(struct virtio_device *dev,
+			      uint32_t vq, uint32_t page_size, uint32_t align,
+			      uint32_t pfn)
+{
+	int rc;
+	k_spinlock_key_t key;
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+
+	if (vq >= VIRTIO_BALLOON_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&vbdev->lock);
+	rc = virtio_queue_setup(&vbdev->vqs[vq], dev->guest,
+			pfn, page_size, VIRTIO_BALLOON_QUEUE_SIZE, align);
+	k_spin_unlock(&vbdev->lock, key);
+
+	return rc;
+}
+
+static int virtio_balloon_get_pfn_vq(struct virtio_device *dev, uint32_t vq)
+{
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+
+	if (vq >= VIRTIO_BALLOON_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	return virtio_queue_guest_pfn(&vbdev->vqs[vq]);
+}
+
+static int virtio_balloon_get_size_vq(struct virtio_device *dev, uint32_t vq)
+{
+	return (vq < VIRTIO_BALLOON_NUM_QUEUES) ? VIRTIO_BALLOON_QUEUE_SIZE : 0;
+}
+
+static int virtio_balloon_set_size_vq(struct virtio_device *dev,
+				  uint32_t vq, int size)
+{
+	/* FIXME: dynamic */
+	return size;
+}
+
+static int virtio_balloon_notify_vq(struct virtio_device *dev, uint32_t vq)
+{
+	bool signal = false;
+	k_spinlock_key_t key;
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+
+	if (vq >= VIRTIO_BALLOON_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	switch (vq) {
+	case VIRTIO_BALLOON_INFLATE_QUEUE:
+	case VIRTIO_BALLOON_DEFLATE_QUEUE:
+		signal = virtio_balloon_do_pfns(vbdev, &vbdev->vqs[vq],
+				vq == VIRTIO_BALLOON_INFLATE_QUEUE);
+		break;
+	case VIRTIO_BALLOON_STATS_QUEUE:
+		key = k_spin_lock(&vbdev->lock);
+		virtio_balloon_do_stats(vbdev);
+		k_spin_unlock(&vbdev->lock, key);
+		break;
+	}
+
+	if (signal) {
+		dev->tra->notify(dev, vq);
+	}
+
+	return 0;
+}
+
+static void virtio_balloon_status_changed(struct virtio_device *dev,
+				      uint32_t new_status)
+{
+	/* Nothing to do here. */
+}
+
+static int virtio_balloon_read_config(struct virtio_device *dev,
+				  uint32_t offset, void *dst, uint32_t dst_len)
+{
+	uint32_t i;
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+	uint8_t *src = (uint8_t *)&vbdev->config;
+
+	for (i=0; (i<dst_len) && ((offset+i) < sizeof(vbdev->config)); i++) {
+		((uint8_t *)dst)[i] = src[offset + i];
+	}
+
+	return 0;
+}
+
+static int virtio_balloon_write_config(struct virtio_device *dev,
+				   uint32_t offset, void *src, uint32_t src_len)
+{
+	uint32_t i;
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+	uint8_t *dst = (uint8_t *)&vbdev->config;
+
+	/* The guest only reports the pages in its balloon. */
+	for (i = 0; i < src_len; i++) {
+		if (offset + i >= offsetof(struct virtio_balloon_config, actual) &&
+		    offset + i < sizeof(vbdev->config)) {
+			dst[offset + i] = ((uint8_t *)src)[i];
+		}
+	}
+
+	return 0;
+}
+
+static int virtio_balloon_reset(struct virtio_device *dev)
+{
+	uint32_t i;
+	k_spinlock_key_t key;
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+
+	key = k_spin_lock(&vbdev->lock);
+	for (i = 0; i < VIRTIO_BALLOON_NUM_QUEUES; i++) {
+		virtio_queue_cleanup(&vbdev->vqs[i]);
+	}
+	vbdev->stats_pending = false;
+	vbdev->stats_valid = false;
+	vbdev->config.actual = 0;
+	k_spin_unlock(&vbdev->lock, key);
+
+	return 0;
+}
+
+static int virtio_balloon_connect(struct virtio_device *dev,
+			      struct virtio_emulator *emu)
+{
+	k_spinlock_key_t key;
+	struct virtio_balloon_dev *vbdev;
+
+	vbdev = k_malloc(sizeof(struct virtio_balloon_dev));
+	if (!vbdev) {
+		printk("Failed to allocate virtio balloon device....\n");
+		return -ENOMEM;
+	}
+	memset(vbdev, 0, sizeof(struct virtio_balloon_dev));
+	vbdev->vdev = dev;
+	k_mutex_init(&vbdev->pfn_mutex);
+
+	dev->emu_data = vbdev;
+
+	key = k_spin_lock(&virtio_balloon_devs_lock);
+	sys_dnode_init(&vbdev->node);
+	sys_dlist_append(&virtio_balloon_devs, &vbdev->node);
+	k_spin_unlock(&virtio_balloon_devs_lock, key);
+
+	return 0;
+}
+
+static void virtio_balloon_disconnect(struct virtio_device *dev)
+{
+	k_spinlock_key_t key;
+	struct virtio_balloon_dev *vbdev = dev->emu_data;
+
+	key = k_spin_lock(&virtio_balloon_devs_lock);
+	sys_dlist_remove(&vbdev->node);
+	k_spin_unlock(&virtio_balloon_devs_lock, key);
+
+	k_free(vbdev);
+}
+
+struct virtio_device_id virtio_balloon_emu_id[] = {
+	{ .type = VIRTIO_ID_BALLOON },
+	{ },
+};
+
+struct virtio_emulator virtio_balloon = {
+	.name = "virtio_balloon",
+	.id_table = virtio_balloon_emu_id,
+
+	/* VirtIO operations */
+	.get_host_features      = virtio_balloon_get_host_features,
+	.set_guest_features     = virtio_balloon_set_guest_features,
+	.init_vq                = virtio_balloon_init_vq,
+	.get_pfn_vq             = virtio_balloon_get_pfn_vq,
+	.get_size_vq            = virtio_balloon_get_size_vq,
+	.set_size_vq            = virtio_balloon_set_size_vq,
+	.notify_vq              = virtio_balloon_notify_vq,
+	.status_changed         = virtio_balloon_status_changed,
+
+	/* Emulator operations */
+	.read_config = virtio_balloon_read_config,
+	.write_config = virtio_balloon_write_config,
+	.reset = virtio_balloon_reset,
+	.connect = virtio_balloon_connect,
+	.disconnect = virtio_balloon_disconnect,
+};
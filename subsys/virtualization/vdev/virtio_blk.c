@@ -25,7 +25,16 @@
 #define VIRTIO_BLK_IO_QUEUE		0
 #define VIRTIO_BLK_NUM_QUEUES		1
 #define VIRTIO_BLK_SECTOR_SIZE		512
-#define VIRTIO_BLK_DISK_SEG_MAX		(VIRTIO_BLK_QUEUE_SIZE - 2)
+#define VIRTIO_BLK_DISK_SEG_MAX		CONFIG_VIRTIO_BLK_SEG_MAX
+#define VIRTIO_BLK_REQ_NUM		CONFIG_VIRTIO_BLK_REQ_NUM
+#define VIRTIO_BLK_REQ_BLOCK_SIZE	\
+	ROUND_UP(sizeof(struct virtio_blk_dev_req), sizeof(void *))
+
+#ifdef CONFIG_VIRTIO_BLK_DEBUG
+#define VIRTIO_BLK_DBG(...)		printk(__VA_ARGS__)
+#else
+#define VIRTIO_BLK_DBG(...)
+#endif
 
 enum request_type {
 	REQUEST_UNKNOWN=0,
@@ -37,26 +46,58 @@ enum request_type {
 struct virtio_blk_dev_req {
 	struct virtio_queue		*vq;
 	uint16_t				head;
-	struct virtio_iovec		*read_iov;
-	uint32_t				read_iov_cnt;
+	struct virtio_iovec		data_iov[VIRTIO_BLK_DISK_SEG_MAX];
+	/* segments pinned in guest ram until the request is done */
+	bool					data_pinned[VIRTIO_BLK_DISK_SEG_MAX];
+	uint32_t				data_iov_cnt;
 	uint32_t				len;
+	uint64_t				sector;
 	struct virtio_iovec		status_iov;		
-	void				*data;
+	uint32_t				cmd;
+	uint8_t					status;
 	enum request_type type;
 };
 
+/* A run of sectors which is contiguous both on disk and in host memory. */
+struct virtio_blk_io_run {
+	enum request_type type;
+	uint8_t			*hva;
+	uint64_t		sector;
+	uint32_t		num_sectors;
+	/* requests [first, last] of the batch own this run */
+	uint16_t		first;
+	uint16_t		last;
+};
+
 struct virtio_blk_dev {
 	struct virtio_device 	*vdev;
 
 	struct virtio_queue 	vqs[VIRTIO_BLK_NUM_QUEUES];
 	struct virtio_iovec		iov[VIRTIO_BLK_QUEUE_SIZE];
-	struct virtio_blk_dev_req	reqs[VIRTIO_BLK_QUEUE_SIZE];
 	uint64_t 				features;
 
+	/* Request structures are allocated from this slab. */
+	struct k_mem_slab		req_slab;
+	char __aligned(sizeof(void *))
+		req_slab_buf[VIRTIO_BLK_REQ_NUM * VIRTIO_BLK_REQ_BLOCK_SIZE];
+	/* Bounce sectors for the segment out of the guest ram mapping. */
+	uint8_t __aligned(sizeof(void *))
+		bounce[CONFIG_VIRTIO_BLK_BOUNCE_SECTORS * SECTOR_SIZE];
+
+	/* Backend worker which drains the avail ring. */
+	struct k_work_q			io_wq;
+	struct k_work			io_work;
+	struct virtio_blk_dev_req	*batch[VIRTIO_BLK_REQ_NUM];
+	K_KERNEL_STACK_MEMBER(io_wq_stack, CONFIG_VIRTIO_BLK_WQ_STACK_SIZE);
+
 	struct virtio_blk_config 	config;
 	char *disk_pdrv;
 };
 
+static const struct k_work_queue_config virtio_blk_wq_cfg = {
+	.name = "virtio_blk",
+};
+
 static uint64_t virtio_blk_get_host_features(struct virtio_device *dev)
 {
 	return	1UL << VIRTIO_BLK_F_SEG_MAX
@@ -138,180 +179,306 @@ static int virtio_blk_set_size_vq(struct virtio_device *dev,
 }
  
 static void virtio_blk_req_done(struct virtio_blk_dev *vbdev,
-				struct virtio_blk_dev_req *req, uint8_t status)
+				struct virtio_blk_dev_req *req)
 {
+	uint32_t i;
 	struct virtio_device *dev = vbdev->vdev;
-	int queueid = req->vq - vbdev->vqs;
-
-	if (req->read_iov && req->len && req->data &&
-	    (status == VIRTIO_BLK_S_OK) &&
-	    (req->type == REQUEST_READ)) {
-		virtio_buf_to_iovec_write(dev,
-					  req->read_iov,
-					  req->read_iov_cnt,
-					  req->data,
-					  req->len);
-	}
 
-	if (req->read_iov) {
-		k_free(req->read_iov);
-		req->read_iov = NULL;
-		req->read_iov_cnt = 0;
+	for (i = 0; i < req->data_iov_cnt; i++) {
+		if (req->data_pinned[i]) {
+			vm_gpa_hva_put(dev->guest, req->data_iov[i].addr);
+			req->data_pinned[i] = false;
+		}
 	}
-
 	req->type = REQUEST_UNKNOWN;
-	if (req->data) {
-		k_free(req->data);
-		req->data = NULL;
-	}
 
-	virtio_buf_to_iovec_write(dev, &req->status_iov, 1, &status, 1);
+	virtio_buf_to_iovec_write(dev, &req->status_iov, 1, &req->status, 1);
 
 	virtio_queue_set_used_elem(req->vq, req->head, req->len);
 
-	if (virtio_queue_should_signal(req->vq)) {
-		dev->tra->notify(dev, queueid);
-	}
+	k_mem_slab_free(&vbdev->req_slab, (void **)&req);
 }
 
-static void virtio_blk_do_io(struct virtio_device *dev,
-			     struct virtio_blk_dev *vbdev)
+/**
+ * @brief Issue the pending run to disk, all the requests owning the
+ * run fail if the disk access fails.
+ */
+static void virtio_blk_run_flush(struct virtio_blk_dev *vbdev,
+				struct virtio_blk_io_run *run)
 {
 	int rc;
-	uint16_t head, thead;
-	uint32_t i, iov_cnt, len, num_sectors, cmd_buf;
-	struct virtio_blk_dev_req *req;
-	struct virtio_queue *vq = &vbdev->vqs[VIRTIO_BLK_IO_QUEUE];
-	struct virtio_blk_outhdr hdr;
+	uint16_t i;
 
-	while (virtio_queue_available(vq)) {
-		thead = virtio_queue_pop(vq);
-		req = &vbdev->reqs[thead];
-		rc = virtio_queue_get_head_iovec(vq, thead, vbdev->iov,
-						     &iov_cnt, &len, &head);
-		if (!rc) {
-			printk("%s: failed to get iovec (error %d)\n",
-				   __func__, rc);
-			continue;
+	if (!run->num_sectors) {
+		return;
+	}
+
+	if (run->type == REQUEST_READ) {
+		rc = disk_access_read(vbdev->disk_pdrv, run->hva,
+				run->sector, run->num_sectors);
+	} else {
+		rc = disk_access_write(vbdev->disk_pdrv, run->hva,
+				run->sector, run->num_sectors);
+	}
+
+	VIRTIO_BLK_DBG("virtio_blk %s: start_sector = %lld, num = %d\n",
+		(run->type == REQUEST_READ) ? "read" : "write",
+		run->sector, run->num_sectors);
+
+	if (rc) {
+		for (i = run->first; i <= run->last; i++) {
+			vbdev->batch[i]->status = VIRTIO_BLK_S_IOERR;
 		}
+	}
+	run->num_sectors = 0;
+}
+
+/**
+ * @brief Add a segment to the pending run. Adjacent sectors from the
+ * same or following requests are merged into one disk access.
+ */
+static void virtio_blk_run_add(struct virtio_blk_dev *vbdev,
+				struct virtio_blk_io_run *run, uint16_t idx,
+				enum request_type type, uint8_t *hva,
+				uint64_t sector, uint32_t num_sectors)
+{
+	if (run->num_sectors && run->type == type &&
+	    run->sector + run->num_sectors == sector &&
+	    run->hva + run->num_sectors * SECTOR_SIZE == hva) {
+		run->num_sectors += num_sectors;
+		run->last = idx;
+		return;
+	}
+
+	virtio_blk_run_flush(vbdev, run);
+	run->type = type;
+	run->hva = hva;
+	run->sector = sector;
+	run->num_sectors = num_sectors;
+	run->first = idx;
+	run->last = idx;
+}
 
-		req->vq = vq;
-		req->head = head;
-		req->read_iov = NULL;
-		req->read_iov_cnt = 0;
-		req->len = 0;
-		for (i = 1; i < (iov_cnt - 1); i++) {
-			req->len += vbdev->iov[i].len;
+/**
+ * @brief Queue the data segments of a read/write request. A segment
+ * that is contiguous in host memory goes to the pending run, other
+ * segments are transferred through the bounce buffer, one disk access
+ * for each chunk of it.
+ */
+static int virtio_blk_do_rw(struct virtio_blk_dev *vbdev,
+				struct virtio_blk_dev_req *req,
+				struct virtio_blk_io_run *run, uint16_t idx)
+{
+	int rc;
+	uint32_t i, off, num_sectors, chunk;
+	uint64_t sector = req->sector;
+	uint8_t *hva;
+	struct vm *guest = vbdev->vdev->guest;
+	struct virtio_iovec *iov;
+
+	for (i = 0; i < req->data_iov_cnt; i++) {
+		iov = &req->data_iov[i];
+		if (iov->len % SECTOR_SIZE) {
+			return -EINVAL;
 		}
-		req->status_iov.addr = vbdev->iov[iov_cnt - 1].addr;
-		req->status_iov.len = vbdev->iov[iov_cnt - 1].len;
-		req->type = REQUEST_UNKNOWN;
-
-		len = virtio_iovec_to_buf_read(dev, &vbdev->iov[0], 1,
-						   &hdr, sizeof(hdr));
-		if (len < sizeof(hdr)) {
-			virtio_queue_set_used_elem(req->vq, req->head, 0);
+		num_sectors = iov->len / SECTOR_SIZE;
+
+		/* The run is issued later, keep the segment until the request is done. */
+		hva = vm_gpa_hva_get(guest, iov->addr, iov->len);
+		if (hva) {
+			req->data_pinned[i] = true;
+			virtio_blk_run_add(vbdev, run, idx, req->type, hva,
+					sector, num_sectors);
+			sector += num_sectors;
 			continue;
 		}
 
-		switch (hdr.type) {
-		case VIRTIO_BLK_T_IN:
-			req->type = REQUEST_READ;
-			req->data = k_malloc(req->len);
-			if (!req->data) {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
-				continue;
-			}
-			len = sizeof(struct virtio_iovec) * (iov_cnt - 2);
-			req->read_iov = k_malloc(len);
-			if (!req->read_iov) {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
-				continue;
-			}
-			req->read_iov_cnt = iov_cnt - 2;
-			for (i = 0; i < req->read_iov_cnt; i++) {
-				req->read_iov[i].addr = vbdev->iov[i + 1].addr;
-				req->read_iov[i].len = vbdev->iov[i + 1].len;
-			}
-			num_sectors = (req->len + SECTOR_SIZE - 1) / SECTOR_SIZE;
-			if(disk_access_read(vbdev->disk_pdrv, req->data, hdr.sector, num_sectors)){
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
+		/* Keep the order with the sectors queued before. */
+		virtio_blk_run_flush(vbdev, run);
+		for (off = 0; off < iov->len; off += chunk * SECTOR_SIZE, sector += chunk) {
+			chunk = MIN((iov->len - off) / SECTOR_SIZE,
+					CONFIG_VIRTIO_BLK_BOUNCE_SECTORS);
+			if (req->type == REQUEST_READ) {
+				rc = disk_access_read(vbdev->disk_pdrv, vbdev->bounce,
+						sector, chunk);
+				if (rc) {
+					return rc;
+				}
+				vm_guest_memory_write(guest, iov->addr + off,
+						vbdev->bounce, chunk * SECTOR_SIZE);
 			} else {
-				printk("virtio_blk read: start_sector = %lld, num = %d\n", hdr.sector, num_sectors);
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_OK);
+				vm_guest_memory_read(guest, iov->addr + off,
+						vbdev->bounce, chunk * SECTOR_SIZE);
+				rc = disk_access_write(vbdev->disk_pdrv, vbdev->bounce,
+						sector, chunk);
+				if (rc) {
+					return rc;
+				}
 			}
-			break;
-		case VIRTIO_BLK_T_OUT:
-			req->type = REQUEST_WRITE;
-			req->data = k_malloc(req->len);
-			if (!req->data) {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
-				continue;
-			} else {
-				virtio_iovec_to_buf_read(dev,
-							 &vbdev->iov[1],
-							 iov_cnt - 2,
-							 req->data,
-							 req->len);
-			}
-			num_sectors = (req->len + SECTOR_SIZE - 1) / SECTOR_SIZE;
-			if(disk_access_write(vbdev->disk_pdrv, req->data, hdr.sector, num_sectors)){
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
-			} else {
-				printk("virtio_blk write: start_sector = %lld, num = %d\n", hdr.sector, num_sectors);
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_OK);
-			}
-			break;
-		case VIRTIO_BLK_T_FLUSH:
-			req->type = REQUEST_WRITE;
-			if (disk_access_ioctl(vbdev->disk_pdrv, DISK_IOCTL_CTRL_SYNC, &cmd_buf)) {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
-			} else {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_OK);
-			}
-			break;
-		case VIRTIO_BLK_T_GET_ID:
-			req->type = REQUEST_READ;
-			req->len = VIRTIO_BLK_ID_BYTES;
-			req->data = k_malloc(req->len);
-			if (!req->data) {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
-				continue; 
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Pop one request from the avail ring and parse it to @req,
+ * return error if the descriptor chain has been returned to guest.
+ */
+static int virtio_blk_get_req(struct virtio_device *dev,
+				struct virtio_blk_dev *vbdev, struct virtio_queue *vq,
+				struct virtio_blk_dev_req *req)
+{
+	int rc;
+	uint16_t head, thead;
+	uint32_t i, iov_cnt, len;
+	struct virtio_blk_outhdr hdr;
+
+	thead = virtio_queue_pop(vq);
+	rc = virtio_queue_get_head_iovec(vq, thead, vbdev->iov,
+					     &iov_cnt, &len, &head);
+	if (!rc) {
+		printk("%s: failed to get iovec (error %d)\n",
+			   __func__, rc);
+		return -EINVAL;
+	}
+
+	req->vq = vq;
+	req->head = head;
+	req->len = 0;
+	req->type = REQUEST_UNKNOWN;
+	req->status = VIRTIO_BLK_S_OK;
+
+	if (iov_cnt < 2) {
+		virtio_queue_set_used_elem(vq, head, 0);
+		return -EINVAL;
+	}
+	req->status_iov.addr = vbdev->iov[iov_cnt - 1].addr;
+	req->status_iov.len = vbdev->iov[iov_cnt - 1].len;
+
+	req->data_iov_cnt = iov_cnt - 2;
+	if (req->data_iov_cnt > VIRTIO_BLK_DISK_SEG_MAX) {
+		req->data_iov_cnt = 0;
+		req->status = VIRTIO_BLK_S_IOERR;
+		return 0;
+	}
+	for (i = 0; i < req->data_iov_cnt; i++) {
+		req->data_iov[i] = vbdev->iov[i + 1];
+		req->data_pinned[i] = false;
+		req->len += vbdev->iov[i + 1].len;
+	}
+
+	len = virtio_iovec_to_buf_read(dev, &vbdev->iov[0], 1,
+					   &hdr, sizeof(hdr));
+	if (len < sizeof(hdr)) {
+		virtio_queue_set_used_elem(vq, head, 0);
+		return -EINVAL;
+	}
+	req->sector = hdr.sector;
+
+	req->cmd = hdr.type;
+	switch (hdr.type) {
+	case VIRTIO_BLK_T_IN:
+		req->type = REQUEST_READ;
+		break;
+	case VIRTIO_BLK_T_OUT:
+		req->type = REQUEST_WRITE;
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void virtio_blk_handle_req(struct virtio_blk_dev *vbdev,
+				struct virtio_blk_dev_req *req,
+				struct virtio_blk_io_run *run, uint16_t idx)
+{
+	uint32_t cmd_buf;
+	char id[VIRTIO_BLK_ID_BYTES];
+
+	if (req->status != VIRTIO_BLK_S_OK) {
+		return;
+	}
+
+	switch (req->cmd) {
+	case VIRTIO_BLK_T_IN:
+	case VIRTIO_BLK_T_OUT:
+		if (virtio_blk_do_rw(vbdev, req, run, idx)) {
+			req->status = VIRTIO_BLK_S_IOERR;
+		}
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		/* The writes queued before must reach the disk first. */
+		virtio_blk_run_flush(vbdev, run);
+		if (disk_access_ioctl(vbdev->disk_pdrv, DISK_IOCTL_CTRL_SYNC, &cmd_buf)) {
+			req->status = VIRTIO_BLK_S_IOERR;
+		}
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		req->len = VIRTIO_BLK_ID_BYTES;
+		if (!vbdev->disk_pdrv || !req->data_iov_cnt) {
+			req->status = VIRTIO_BLK_S_IOERR;
+		} else {
+			strncpy(id, vbdev->disk_pdrv, VIRTIO_BLK_ID_BYTES);
+			virtio_buf_to_iovec_write(vbdev->vdev, &req->data_iov[0], 1,
+						  id, VIRTIO_BLK_ID_BYTES);
+		}
+		break;
+	default:
+		printk("%s: unhandled hdr.type=%d\n",
+			   __func__, req->cmd);
+		req->status = VIRTIO_BLK_S_UNSUPP;
+		break;
+	}
+}
+
+static void virtio_blk_do_io(struct virtio_device *dev,
+			     struct virtio_blk_dev *vbdev)
+{
+	uint16_t i, batch_cnt;
+	struct virtio_blk_dev_req *req;
+	struct virtio_blk_io_run run;
+	struct virtio_queue *vq = &vbdev->vqs[VIRTIO_BLK_IO_QUEUE];
+
+	while (virtio_queue_available(vq)) {
+		run.num_sectors = 0;
+		batch_cnt = 0;
+
+		/* Fetch a batch of requests, adjacent sectors are merged. */
+		while (batch_cnt < VIRTIO_BLK_REQ_NUM && virtio_queue_available(vq)) {
+			if (k_mem_slab_alloc(&vbdev->req_slab, (void **)&req, K_NO_WAIT)) {
+				break;
 			}
-			req->read_iov = k_malloc(sizeof(struct virtio_iovec));
-			if (!req->read_iov) {
-				virtio_blk_req_done(vbdev, req,
-						    VIRTIO_BLK_S_IOERR);
+			if (virtio_blk_get_req(dev, vbdev, vq, req)) {
+				k_mem_slab_free(&vbdev->req_slab, (void **)&req);
 				continue;
 			}
-			req->read_iov_cnt = 1;
-			req->read_iov[0].addr = vbdev->iov[1].addr;
-			req->read_iov[0].len = vbdev->iov[1].len;
-			if (!vbdev->disk_pdrv) {
-				virtio_blk_req_done(vbdev, req, VIRTIO_BLK_S_IOERR);
-			} else {
-				strncpy(req->data, vbdev->disk_pdrv, req->len);
-				virtio_blk_req_done(vbdev, req, VIRTIO_BLK_S_OK);
-			}
-			break;
-		default:
-			printk("%s: unhandled hdr.type=%d\n",
-				   __func__, hdr.type);
-			break;
-		};
+			vbdev->batch[batch_cnt] = req;
+			virtio_blk_handle_req(vbdev, req, &run, batch_cnt);
+			batch_cnt++;
+		}
+		virtio_blk_run_flush(vbdev, &run);
+
+		/* Complete the whole batch, and signal the guest once. */
+		for (i = 0; i < batch_cnt; i++) {
+			virtio_blk_req_done(vbdev, vbdev->batch[i]);
+		}
+		if (virtio_queue_should_signal(vq)) {
+			dev->tra->notify(dev, VIRTIO_BLK_IO_QUEUE);
+		}
 	}
 }
 
+static void virtio_blk_io_work(struct k_work *work)
+{
+	struct virtio_blk_dev *vbdev =
+		CONTAINER_OF(work, struct virtio_blk_dev, io_work);
+
+	virtio_blk_do_io(vbdev->vdev, vbdev);
+}
+
 static int virtio_blk_notify_vq(struct virtio_device *dev, uint32_t vq)
 {
 	int rc = 0;
@@ -319,7 +486,8 @@ static int virtio_blk_notify_vq(struct virtio_device *dev, uint32_t vq)
 
 	switch (vq) {
 	case VIRTIO_BLK_IO_QUEUE:
-		virtio_blk_do_io(dev, vbdev);
+		/* The backend worker drains the ring, vcpu returns at once. */
+		k_work_submit_to_queue(&vbdev->io_wq, &vbdev->io_work);
 		break;
 	default:
 		rc = -EINVAL;
@@ -365,15 +533,12 @@ static int virtio_blk_write_config(struct virtio_device *dev,
 
 static int virtio_blk_reset(struct virtio_device *dev)
 {
-	int i, rc;
-	struct virtio_blk_dev_req *req;
+	int rc;
+	struct k_work_sync sync;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
-		req = &vbdev->reqs[i];
-		memset(req, 0, sizeof(*req));
-		req->type = REQUEST_UNKNOWN;
-	}
+	/* Stop the backend before the queue is gone. */
+	k_work_cancel_sync(&vbdev->io_work, &sync);
 
 	rc = virtio_queue_cleanup(&vbdev->vqs[VIRTIO_BLK_IO_QUEUE]);
 	if (!rc) {
@@ -390,17 +555,27 @@ static int virtio_blk_connect(struct virtio_device *dev,
 	uint32_t cmd_buf;
 	struct virtio_blk_dev *vbdev;
 
-	vbdev = k_malloc(sizeof(struct virtio_blk_dev));
+	/* io_wq_stack must be aligned, So we allocate memory with aligned block */
+	vbdev = k_aligned_alloc(0x10, sizeof(struct virtio_blk_dev));
 	if (!vbdev) {
 		printk("Failed to allocate virtio block device....\n");
 		return -ENOMEM;
 	}
+	memset(vbdev, 0, sizeof(struct virtio_blk_dev));
 	vbdev->vdev = dev;
 
 	vbdev->config.capacity = 1024;
 	vbdev->config.seg_max = VIRTIO_BLK_DISK_SEG_MAX,
 	vbdev->config.blk_size = VIRTIO_BLK_SECTOR_SIZE;
 
+	rc = k_mem_slab_init(&vbdev->req_slab, vbdev->req_slab_buf,
+			VIRTIO_BLK_REQ_BLOCK_SIZE, VIRTIO_BLK_REQ_NUM);
+	if (rc) {
+		k_free(vbdev);
+		printk("Failed to init virtio block request slab....\n");
+		return rc;
+	}
+
 	vbdev->disk_pdrv = DISK_NAME;
 
 	if (!DISK_NAME) {
@@ -439,6 +614,11 @@ static int virtio_blk_connect(struct virtio_device *dev,
 	}
 	printk("Disk reports sector size %u\n", cmd_buf);
 
+	k_work_init(&vbdev->io_work, virtio_blk_io_work);
+	k_work_queue_start(&vbdev->io_wq, vbdev->io_wq_stack,
+			K_KERNEL_STACK_SIZEOF(vbdev->io_wq_stack),
+			CONFIG_VIRTIO_BLK_WQ_PRIORITY, &virtio_blk_wq_cfg);
+
 	dev->emu_data = vbdev;
 
 	return 0;
@@ -447,6 +627,9 @@ static int virtio_blk_connect(struct virtio_device *dev,
 static void virtio_blk_disconnect(struct virtio_device *dev)
 {
 	struct virtio_blk_dev *vbdev = dev->emu_data;
+
+	k_work_queue_drain(&vbdev->io_wq, true);
+	k_thread_abort(&vbdev->io_wq.thread);
 	vbdev->disk_pdrv = NULL;
 	k_free(vbdev);
 }
@@ -0,0 +1,671 @@
+/**
+ * @file virtio_console.c
+ * @brief VirtIO based console device Emulator.
+ *
+ * The output of a guest port is copied to a host ring buffer when the
+ * guest kicks the tx queue, so a whole buffer costs one exit instead of
+ * one exit per character of an emulated uart. The shell attaches to one
+ * port at a time, the other ports keep their latest output in the ring.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <zephyr.h>
+#include <spinlock.h>
+#include <sys/dlist.h>
+#include <sys/ring_buffer.h>
+#include <shell/shell.h>
+
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/vdev/virtio/virtio.h>
+#include <virtualization/vdev/virtio/virtio_console.h>
+
+#define VIRTIO_CONSOLE_QUEUE_SIZE		64
+#define VIRTIO_CONSOLE_MAX_PORTS		CONFIG_VIRTIO_CONSOLE_PORTS
+#define VIRTIO_CONSOLE_CTRL_RX_QUEUE	2
+#define VIRTIO_CONSOLE_CTRL_TX_QUEUE	3
+#define VIRTIO_CONSOLE_NUM_QUEUES		(VIRTIO_CONSOLE_MAX_PORTS * 2 + 2)
+#define VIRTIO_CONSOLE_RX_QUEUE(port)	((port) ? (port) * 2 + 2 : 0)
+#define VIRTIO_CONSOLE_TX_QUEUE(port)	((port) ? (port) * 2 + 3 : 1)
+#define VIRTIO_CONSOLE_NAME_LEN			16
+/* Ctrl-] detaches the shell from the port */
+#define VIRTIO_CONSOLE_DETACH_CHAR		0x1d
+
+struct virtio_console_dev;
+
+struct virtio_console_port {
+	struct virtio_console_dev	*vcdev;
+	uint32_t					id;
+	/* The guest driver is ready for the port. */
+	bool						ready;
+	/* Protects the output ring. */
+	struct k_spinlock			lock;
+	struct ring_buf				out;
+	uint8_t						out_buf[CONFIG_VIRTIO_CONSOLE_BUF_SIZE];
+	/* Serializes the tx of the port, guest buffers are copied under it. */
+	struct k_mutex				tx_mutex;
+	struct virtio_iovec			tx_iov[VIRTIO_CONSOLE_QUEUE_SIZE];
+};
+
+struct virtio_console_dev {
+	struct virtio_device	*vdev;
+
+	/* Protects the queues and iov. */
+	struct k_spinlock		lock;
+	struct virtio_queue		vqs[VIRTIO_CONSOLE_NUM_QUEUES];
+	struct virtio_iovec		iov[VIRTIO_CONSOLE_QUEUE_SIZE];
+	uint64_t				features;
+
+	struct virtio_console_config	config;
+	struct virtio_console_port	ports[VIRTIO_CONSOLE_MAX_PORTS];
+
+	sys_dnode_t				node;
+};
+
+static sys_dlist_t virtio_console_devs = SYS_DLIST_STATIC_INIT(&virtio_console_devs);
+static struct k_spinlock virtio_console_devs_lock;
+
+/* The shell and the port attached to it, protected by virtio_console_devs_lock */
+static const struct shell *virtio_console_shell;
+static struct virtio_console_port *virtio_console_attached;
+
+static void virtio_console_out_work_fn(struct k_work *work);
+static K_WORK_DEFINE(virtio_console_out_work, virtio_console_out_work_fn);
+
+/**
+ * @brief Port of a data queue, or -1 for the control queues.
+ */
+static int virtio_console_vq_port(uint32_t vq)
+{
+	if (vq < VIRTIO_CONSOLE_CTRL_RX_QUEUE) {
+		return 0;
+	}
+	if (vq <= VIRTIO_CONSOLE_CTRL_TX_QUEUE) {
+		return -1;
+	}
+
+	return (vq - 2) / 2;
+}
+
+/**
+ * @brief Append @len bytes at @gpa to the port output, the oldest
+ * output is dropped when the ring is full. The guest memory is read
+ * into a small buffer without any spinlock held.
+ */
+static void virtio_console_port_output(struct virtio_console_port *port,
+				struct vm *guest, uint64_t gpa, uint32_t len)
+{
+	uint8_t buf[64];
+	uint32_t size, space;
+	k_spinlock_key_t key;
+
+	/* Only the tail of a buffer larger than the ring would be kept. */
+	if (len > sizeof(port->out_buf)) {
+		gpa += len - sizeof(port->out_buf);
+		len = sizeof(port->out_buf);
+	}
+
+	while (len) {
+		size = MIN(len, sizeof(buf));
+		vm_guest_memory_read(guest, gpa, buf, size);
+
+		key = k_spin_lock(&port->lock);
+		space = ring_buf_space_get(&port->out);
+		if (space < size) {
+			ring_buf_get(&port->out, NULL, size - space);
+		}
+		ring_buf_put(&port->out, buf, size);
+		k_spin_unlock(&port->lock, key);
+
+		gpa += size;
+		len -= size;
+	}
+}
+
+static void virtio_console_out_work_fn(struct k_work *work)
+{
+	uint8_t buf[64];
+	uint32_t len;
+	k_spinlock_key_t key;
+	struct virtio_console_port *port;
+	const struct shell *shell;
+
+	ARG_UNUSED(work);
+
+	while (1) {
+		key = k_spin_lock(&virtio_console_devs_lock);
+		port = virtio_console_attached;
+		shell = virtio_console_shell;
+		k_spin_unlock(&virtio_console_devs_lock, key);
+		if (!port || !shell) {
+			return;
+		}
+
+		key = k_spin_lock(&port->lock);
+		len = ring_buf_get(&port->out, buf, sizeof(buf));
+		k_spin_unlock(&port->lock, key);
+		if (!len) {
+			return;
+		}
+		shell_fprintf(shell, SHELL_NORMAL, "%.*s", len, buf);
+	}
+}
+
+/**
+ * @brief Send a control message to the guest, the caller holds the
+ * device lock.
+ */
+static void virtio_console_ctrl_send(struct virtio_console_dev *vcdev,
+				uint32_t id, uint16_t event, uint16_t value, const char *name)
+{
+	uint16_t head;
+	uint32_t iov_cnt, len;
+	uint8_t buf[sizeof(struct virtio_console_control) + VIRTIO_CONSOLE_NAME_LEN];
+	struct virtio_console_control *ctrl = (struct virtio_console_control *)buf;
+	struct virtio_queue *vq = &vcdev->vqs[VIRTIO_CONSOLE_CTRL_RX_QUEUE];
+
+	if (!virtio_queue_available(vq)) {
+		printk("%s: no buffer for control event %d\n", __func__, event);
+		return;
+	}
+
+	head = virtio_queue_pop(vq);
+	if (!virtio_queue_get_head_iovec(vq, head, vcdev->iov, &iov_cnt, &len, &head)) {
+		return;
+	}
+
+	ctrl->id = id;
+	ctrl->event = event;
+	ctrl->value = value;
+	len = sizeof(*ctrl);
+	if (name) {
+		len += snprintk(&buf[len], VIRTIO_CONSOLE_NAME_LEN, "%s", name) + 1;
+		len = MIN(len, sizeof(buf));
+	}
+
+	len = virtio_buf_to_iovec_write(vcdev->vdev, vcdev->iov, iov_cnt, buf, len);
+	virtio_queue_set_used_elem(vq, head, len);
+}
+
+static void virtio_console_ctrl_handle(struct virtio_console_dev *vcdev,
+				struct virtio_console_control *ctrl)
+{
+	uint32_t i;
+	char name[VIRTIO_CONSOLE_NAME_LEN];
+
+	switch (ctrl->event) {
+	case VIRTIO_CONSOLE_DEVICE_READY:
+		if (!ctrl->value) {
+			break;
+		}
+		for (i = 0; i < VIRTIO_CONSOLE_MAX_PORTS; i++) {
+			virtio_console_ctrl_send(vcdev, i, VIRTIO_CONSOLE_PORT_ADD, 1, NULL);
+		}
+		break;
+	case VIRTIO_CONSOLE_PORT_READY:
+		if (ctrl->id >= VIRTIO_CONSOLE_MAX_PORTS) {
+			break;
+		}
+		vcdev->ports[ctrl->id].ready = ctrl->value;
+		if (!ctrl->value) {
+			break;
+		}
+		/* Port 0 is the guest console, the others get a name. */
+		if (ctrl->id == 0) {
+			virtio_console_ctrl_send(vcdev, 0, VIRTIO_CONSOLE_CONSOLE_PORT, 1, NULL);
+		} else {
+			snprintk(name, sizeof(name), "zvm.port%u", ctrl->id);
+			virtio_console_ctrl_send(vcdev, ctrl->id, VIRTIO_CONSOLE_PORT_NAME, 1, name);
+		}
+		virtio_console_ctrl_send(vcdev, ctrl->id, VIRTIO_CONSOLE_PORT_OPEN, 1, NULL);
+		break;
+	case VIRTIO_CONSOLE_PORT_OPEN:
+		/* The host side is always open, output is buffered. */
+		break;
+	default:
+		break;
+	}
+}
+
+static void virtio_console_do_ctrl(struct virtio_console_dev *vcdev)
+{
+	uint16_t head;
+	uint32_t iov_cnt, len;
+	struct virtio_console_control ctrl;
+	struct virtio_queue *vq = &vcdev->vqs[VIRTIO_CONSOLE_CTRL_TX_QUEUE];
+
+	while (virtio_queue_available(vq)) {
+		head = virtio_queue_pop(vq);
+		if (!virtio_queue_get_head_iovec(vq, head, vcdev->iov, &iov_cnt, &len, &head)) {
+			printk("%s: failed to get iovec\n", __func__);
+			return;
+		}
+
+		len = virtio_iovec_to_buf_read(vcdev->vdev, vcdev->iov, iov_cnt,
+					&ctrl, sizeof(ctrl));
+		virtio_queue_set_used_elem(vq, head, 0);
+		if (len == sizeof(ctrl)) {
+			virtio_console_ctrl_handle(vcdev, &ctrl);
+		}
+	}
+}
+
+/**
+ * @brief Move all the tx buffers of @port to its output ring. The device
+ * lock is only held to pop and complete a buffer, not for the copy.
+ */
+static void virtio_console_do_tx(struct virtio_console_dev *vcdev,
+				struct virtio_console_port *port)
+{
+	bool got;
+	uint16_t head;
+	uint32_t i, iov_cnt, len;
+	k_spinlock_key_t key;
+	struct vm *guest = vcdev->vdev->guest;
+	struct virtio_queue *vq = &vcdev->vqs[VIRTIO_CONSOLE_TX_QUEUE(port->id)];
+
+	k_mutex_lock(&port->tx_mutex, K_FOREVER);
+	while (1) {
+		key = k_spin_lock(&vcdev->lock);
+		if (!virtio_queue_available(vq)) {
+			k_spin_unlock(&vcdev->lock, key);
+			break;
+		}
+		head = virtio_queue_pop(vq);
+		got = virtio_queue_get_head_iovec(vq, head, port->tx_iov,
+					&iov_cnt, &len, &head);
+		k_spin_unlock(&vcdev->lock, key);
+		if (!got) {
+			printk("%s: failed to get iovec\n", __func__);
+			break;
+		}
+
+		for (i = 0; i < iov_cnt; i++) {
+			virtio_console_port_output(port, guest, port->tx_iov[i].addr,
+						port->tx_iov[i].len);
+		}
+
+		key = k_spin_lock(&vcdev->lock);
+		virtio_queue_set_used_elem(vq, head, 0);
+		k_spin_unlock(&vcdev->lock, key);
+	}
+	k_mutex_unlock(&port->tx_mutex);
+}
+
+/**
+ * @brief Copy input of the shell to the rx buffers of @port, the input
+ * is dropped if the guest has no rx buffer.
+ */
+static void virtio_console_port_input(struct virtio_console_port *port,
+				uint8_t *data, size_t size)
+{
+	bool signal = false;
+	uint16_t head;
+	uint32_t iov_cnt, len;
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev = port->vcdev;
+	struct virtio_device *dev = vcdev->vdev;
+	uint32_t rxq = VIRTIO_CONSOLE_RX_QUEUE(port->id);
+	struct virtio_queue *vq = &vcdev->vqs[rxq];
+
+	key = k_spin_lock(&vcdev->lock);
+	while (size && virtio_queue_available(vq)) {
+		head = virtio_queue_pop(vq);
+		if (!virtio_queue_get_head_iovec(vq, head, vcdev->iov, &iov_cnt, &len, &head)) {
+			break;
+		}
+		len = virtio_buf_to_iovec_write(dev, vcdev->iov, iov_cnt, data, size);
+		virtio_queue_set_used_elem(vq, head, len);
+		data += len;
+		size -= len;
+	}
+	signal = virtio_queue_should_signal(vq);
+	k_spin_unlock(&vcdev->lock, key);
+
+	if (signal) {
+		dev->tra->notify(dev, rxq);
+	}
+}
+
+/**
+ * @brief Detach the shell from its port, the caller holds
+ * virtio_console_devs_lock.
+ */
+static void virtio_console_detach(void)
+{
+	if (virtio_console_shell) {
+		shell_set_bypass(virtio_console_shell, NULL);
+	}
+	virtio_console_attached = NULL;
+	virtio_console_shell = NULL;
+}
+
+static void virtio_console_bypass(const struct shell *shell, uint8_t *data, size_t len)
+{
+	size_t i;
+	k_spinlock_key_t key;
+	struct virtio_console_port *port;
+
+	/* The port can not be freed while the lock is held. */
+	key = k_spin_lock(&virtio_console_devs_lock);
+	port = virtio_console_attached;
+	if (!port) {
+		shell_set_bypass(shell, NULL);
+		k_spin_unlock(&virtio_console_devs_lock, key);
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (data[i] == VIRTIO_CONSOLE_DETACH_CHAR) {
+			break;
+		}
+	}
+	if (i) {
+		virtio_console_port_input(port, data, i);
+	}
+	if (i < len) {
+		virtio_console_detach();
+	}
+	k_spin_unlock(&virtio_console_devs_lock, key);
+
+	if (i < len) {
+		shell_fprintf(shell, SHELL_NORMAL, "\nDetached from vm console.\n");
+	}
+}
+
+int virtio_console_attach(const struct shell *shell, struct vm *vm, uint32_t port)
+{
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev, *found = NULL;
+	sys_dnode_t *d_node;
+
+	if (port >= VIRTIO_CONSOLE_MAX_PORTS) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&virtio_console_devs_lock);
+	SYS_DLIST_FOR_EACH_NODE(&virtio_console_devs, d_node) {
+		vcdev = CONTAINER_OF(d_node, struct virtio_console_dev, node);
+		if (vcdev->vdev->guest == vm) {
+			found = vcdev;
+			break;
+		}
+	}
+	if (!found) {
+		k_spin_unlock(&virtio_console_devs_lock, key);
+		return -ENODEV;
+	}
+	virtio_console_shell = shell;
+	virtio_console_attached = &found->ports[port];
+	shell_set_bypass(shell, virtio_console_bypass);
+	k_spin_unlock(&virtio_console_devs_lock, key);
+
+	shell_fprintf(shell, SHELL_NORMAL,
+		"Attached to port %u of %s, press Ctrl-] to detach.\n", port, vm->vm_name);
+
+	/* Print the buffered output. */
+	k_work_submit(&virtio_console_out_work);
+
+	return 0;
+}
+
+static uint64_t virtio_console_get_host_features(struct virtio_device *dev)
+{
+	return	1UL << VIRTIO_CONSOLE_F_MULTIPORT
+		| 1UL << VIRTIO_CONSOLE_F_EMERG_WRITE
+		| 1UL << VIRTIO_RING_F_EVENT_IDX;
+}
+
+static void virtio_console_set_guest_features(struct virtio_device *dev,
+					  uint32_t select, uint32_t features)
+{
+	struct virtio_console_dev *vcdev = dev->emu_data;
+
+	if (1 < select)
+		return;
+
+	vcdev->features &= ~((uint64_t)UINT_MAX << (select * 32));
+	vcdev->features |= ((uint64_t)features << (select * 32));
+}
+
+static int virtio_console_init_vq(struct virtio_device *dev,
+			      uint32_t vq, uint32_t page_size, uint32_t align,
+			      uint32_t pfn)
+{
+	int rc;
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev = dev->emu_data;
+
+	if (vq >= VIRTIO_CONSOLE_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&vcdev->lock);
+	rc = virtio_queue_setup(&vcdev->vqs[vq], dev->guest,
+			pfn, page_size, VIRTIO_CONSOLE_QUEUE_SIZE, align);
+	k_spin_unlock(&vcdev->lock, key);
+
+	return rc;
+}
+
+static int virtio_console_get_pfn_vq(struct virtio_device *dev, uint32_t vq)
+{
+	struct virtio_console_dev *vcdev = dev->emu_data;
+
+	if (vq >= VIRTIO_CONSOLE_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	return virtio_queue_guest_pfn(&vcdev->vqs[vq]);
+}
+
+static int virtio_console_get_size_vq(struct virtio_device *dev, uint32_t vq)
+{
+	return (vq < VIRTIO_CONSOLE_NUM_QUEUES) ? VIRTIO_CONSOLE_QUEUE_SIZE : 0;
+}
+
+static int virtio_console_set_size_vq(struct virtio_device *dev,
+				  uint32_t vq, int size)
+{
+	/* FIXME: dynamic */
+	return size;
+}
+
+static int virtio_console_notify_vq(struct virtio_device *dev, uint32_t vq)
+{
+	int id;
+	bool output = false;
+	bool tx_signal = false, ctrl_signal = false;
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev = dev->emu_data;
+
+	if (vq >= VIRTIO_CONSOLE_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	id = virtio_console_vq_port(vq);
+	/* Nothing to do for new rx buffers. */
+	if (id >= 0 && !(vq & 0x1)) {
+		return 0;
+	}
+	if (vq == VIRTIO_CONSOLE_CTRL_RX_QUEUE) {
+		return 0;
+	}
+
+	if (id < 0) {
+		key = k_spin_lock(&vcdev->lock);
+		virtio_console_do_ctrl(vcdev);
+		k_spin_unlock(&vcdev->lock, key);
+	} else {
+		virtio_console_do_tx(vcdev, &vcdev->ports[id]);
+		output = (virtio_console_attached == &vcdev->ports[id]);
+	}
+
+	key = k_spin_lock(&vcdev->lock);
+	tx_signal = virtio_queue_should_signal(&vcdev->vqs[vq]);
+	ctrl_signal = virtio_queue_should_signal(
+			&vcdev->vqs[VIRTIO_CONSOLE_CTRL_RX_QUEUE]);
+	k_spin_unlock(&vcdev->lock, key);
+
+	if (tx_signal) {
+		dev->tra->notify(dev, vq);
+	}
+	if (ctrl_signal) {
+		dev->tra->notify(dev, VIRTIO_CONSOLE_CTRL_RX_QUEUE);
+	}
+	/* The shell prints in the system work queue, vcpu returns at once. */
+	if (output) {
+		k_work_submit(&virtio_console_out_work);
+	}
+
+	return 0;
+}
+
+static void virtio_console_status_changed(struct virtio_device *dev,
+				      uint32_t new_status)
+{
+	/* Nothing to do here. */
+}
+
+static int virtio_console_read_config(struct virtio_device *dev,
+				  uint32_t offset, void *dst, uint32_t dst_len)
+{
+	uint32_t i;
+	struct virtio_console_dev *vcdev = dev->emu_data;
+	uint8_t *src = (uint8_t *)&vcdev->config;
+
+	for (i=0; (i<dst_len) && ((offset+i) < sizeof(vcdev->config)); i++) {
+		((uint8_t *)dst)[i] = src[offset + i];
+	}
+
+	return 0;
+}
+
+static int virtio_console_write_config(struct virtio_device *dev,
+				   uint32_t offset, void *src, uint32_t src_len)
+{
+	uint8_t c;
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev = dev->emu_data;
+	struct virtio_console_port *port = &vcdev->ports[0];
+
+	/* Emergency write, the guest puts one char before the queues work. */
+	if (offset != offsetof(struct virtio_console_config, emerg_wr) || !src_len) {
+		return 0;
+	}
+	c = *(uint8_t *)src;
+
+	key = k_spin_lock(&port->lock);
+	if (!ring_buf_put(&port->out, &c, 1)) {
+		ring_buf_get(&port->out, NULL, 1);
+		ring_buf_put(&port->out, &c, 1);
+	}
+	k_spin_unlock(&port->lock, key);
+
+	if (virtio_console_attached == port) {
+		k_work_submit(&virtio_console_out_work);
+	}
+
+	return 0;
+}
+
+static int virtio_console_reset(struct virtio_device *dev)
+{
+	uint32_t i;
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev = dev->emu_data;
+
+	key = k_spin_lock(&vcdev->lock);
+	for (i = 0; i < VIRTIO_CONSOLE_NUM_QUEUES; i++) {
+		virtio_queue_cleanup(&vcdev->vqs[i]);
+	}
+	for (i = 0; i < VIRTIO_CONSOLE_MAX_PORTS; i++) {
+		vcdev->ports[i].ready = false;
+	}
+	k_spin_unlock(&vcdev->lock, key);
+
+	return 0;
+}
+
+static int virtio_console_connect(struct virtio_device *dev,
+			      struct virtio_emulator *emu)
+{
+	uint32_t i;
+	k_spinlock_key_t key;
+	struct virtio_console_dev *vcdev;
+
+	vcdev = k_malloc(sizeof(struct virtio_console_dev));
+	if (!vcdev) {
+		printk("Failed to allocate virtio console device....\n");
+		return -ENOMEM;
+	}
+	memset(vcdev, 0, sizeof(struct virtio_console_dev));
+	vcdev->vdev = dev;
+
+	vcdev->config.cols = 80;
+	vcdev->config.rows = 25;
+	vcdev->config.max_nr_ports = VIRTIO_CONSOLE_MAX_PORTS;
+
+	for (i = 0; i < VIRTIO_CONSOLE_MAX_PORTS; i++) {
+		vcdev->ports[i].vcdev = vcdev;
+		vcdev->ports[i].id = i;
+		ring_buf_init(&vcdev->ports[i].out, sizeof(vcdev->ports[i].out_buf),
+				vcdev->ports[i].out_buf);
+		k_mutex_init(&vcdev->ports[i].tx_mutex);
+	}
+
+	dev->emu_data = vcdev;
+
+	key = k_spin_lock(&virtio_console_devs_lock);
+	sys_dnode_init(&vcdev->node);
+	sys_dlist_append(&virtio_console_devs, &vcdev->node);
+	k_spin_unlock(&virtio_console_devs_lock, key);
+
+	return 0;
+}
+
+static void virtio_console_disconnect(struct virtio_device *dev)
+{
+	k_spinlock_key_t key;
+	struct k_work_sync sync;
+	struct virtio_console_dev *vcdev = dev->emu_data;
+
+	key = k_spin_lock(&virtio_console_devs_lock);
+	sys_dlist_remove(&vcdev->node);
+	if (virtio_console_attached && virtio_console_attached->vcdev == vcdev) {
+		virtio_console_detach();
+	}
+	k_spin_unlock(&virtio_console_devs_lock, key);
+
+	/* The output work may still be printing a port of this device. */
+	k_work_cancel_sync(&virtio_console_out_work, &sync);
+	k_free(vcdev);
+}
+
+struct virtio_device_id virtio_console_emu_id[] = {
+	{ .type = VIRTIO_ID_CONSOLE },
+	{ },
+};
+
+struct virtio_emulator virtio_console = {
+	.name = "virtio_console",
+	.id_table = virtio_console_emu_id,
+
+	/* VirtIO operations */
+	.get_host_features      = virtio_console_get_host_features,
+	.set_guest_features     = virtio_console_set_guest_features,
+	.init_vq                = virtio_console_init_vq,
+	.get_pfn_vq             = virtio_console_get_pfn_vq,
+	.get_size_vq            = virtio_console_get_size_vq,
+	.set_size_vq            = virtio_console_set_size_vq,
+	.notify_vq              = virtio_console_notify_vq,
+	.status_changed         = virtio_console_status_changed,
+
+	/* Emulator operations */
+	.read_config = virtio_console_read_config,
+	.write_config = virtio_console_write_config,
+	.reset = virtio_console_reset,
+	.connect = virtio_console_connect,
+	.disconnect = virtio_console_disconnect,
+};
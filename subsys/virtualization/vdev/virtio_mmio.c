@@ -17,6 +17,9 @@
 #include <virtualization/vdev/virtio/virtio.h>
 #include <virtualization/vdev/virtio/virtio_mmio.h>
 #include <virtualization/vdev/virtio/virtio_blk.h>
+#include <virtualization/vdev/virtio/virtio_net.h>
+#include <virtualization/vdev/virtio/virtio_console.h>
+#include <virtualization/vdev/virtio/virtio_balloon.h>
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
@@ -228,9 +231,26 @@ static int virtio_mmio_notify(struct virtio_device *dev, uint32_t vq)
 	return 0; 
 }
 
+static int virtio_mmio_config_notify(struct virtio_device *dev)
+{
+	int err = 0;
+	struct virtio_mmio_dev *m = dev->tra_data;
+
+	m->config.interrupt_status |= VIRTIO_MMIO_INT_CONFIG;
+
+	err = set_virq_to_vm(dev->guest, m->irq);
+	if(err < 0){
+		printk("Send virq to vm error!\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static struct virtio_transport mmio_tra = {
 	.name = "virtio_mmio",
 	.notify = virtio_mmio_notify,
+	.config_notify = virtio_mmio_config_notify,
 };
 
 int virtio_mmio_probe(struct vm *guest, struct virt_dev *edev) {
@@ -329,6 +349,15 @@ static void zvm_virtio_emu_register(void)
 #ifdef CONFIG_VM_VIRTIO_BLOCK
     virtio_register_emulator(&virtio_blk);
 #endif
+#ifdef CONFIG_VM_VIRTIO_NET
+    virtio_register_emulator(&virtio_net);
+#endif
+#ifdef CONFIG_VM_VIRTIO_CONSOLE
+    virtio_register_emulator(&virtio_console);
+#endif
+#ifdef CONFIG_VM_VIRTIO_BALLOON
+    virtio_register_emulator(&virtio_balloon);
+#endif
 }
 
 /**
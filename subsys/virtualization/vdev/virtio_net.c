@@ -0,0 +1,446 @@
+/**
+ * @file virtio_net.c
+ * @brief VirtIO based network device Emulator.
+ *
+ * Each device is a port of the vnet switch. Frames are never queued in
+ * zvm, the switch thread copies a frame from the tx buffers of the
+ * sender to the rx buffers of the receiver, or drops it if the receiver
+ * has no rx buffer.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <zephyr.h>
+#include <device.h>
+#include <sys/atomic.h>
+
+#include <virtualization/zvm.h>
+#include <virtualization/vdev/virtio/virtio.h>
+#include <virtualization/vdev/virtio/virtio_net.h>
+#include <virtualization/vdev/virtio/vnet_switch.h>
+
+#define VIRTIO_NET_QUEUE_SIZE		256
+#define VIRTIO_NET_MAX_PAIRS		CONFIG_VIRTIO_NET_QUEUE_PAIRS
+#define VIRTIO_NET_RX_QUEUE(pair)	((pair) * 2)
+#define VIRTIO_NET_TX_QUEUE(pair)	((pair) * 2 + 1)
+#define VIRTIO_NET_CTRL_QUEUE		(VIRTIO_NET_MAX_PAIRS * 2)
+#define VIRTIO_NET_NUM_QUEUES		(VIRTIO_NET_MAX_PAIRS * 2 + 1)
+#define VIRTIO_NET_HDR_LEN		sizeof(struct virtio_net_hdr)
+#define VIRTIO_NET_MTU			1500
+
+BUILD_ASSERT(VIRTIO_NET_MAX_PAIRS <= 32, "rx_pending is a 32-bit mask");
+
+struct virtio_net_dev {
+	struct virtio_device	*vdev;
+	struct vnet_port		port;
+	bool					attached;
+
+	struct virtio_queue		vqs[VIRTIO_NET_NUM_QUEUES];
+	uint64_t				features;
+	/* Queue pairs in use, the driver sets it by the control queue. */
+	uint16_t				curr_pairs;
+	/* Rx queues that got frames since the last flush. */
+	uint32_t				rx_pending;
+
+	struct virtio_net_config	config;
+};
+
+struct virtio_net_ctrl_cmd {
+	struct virtio_net_ctrl_hdr	hdr;
+	uint16_t					pairs;
+} __attribute__((packed));
+
+/* Only the switch thread uses them, a chain can not be longer than a queue. */
+static struct virtio_iovec virtio_net_tx_iov[VIRTIO_NET_QUEUE_SIZE];
+static struct virtio_iovec virtio_net_rx_iov[VIRTIO_NET_QUEUE_SIZE];
+
+static atomic_t virtio_net_mac_idx;
+
+static uint64_t virtio_net_get_host_features(struct virtio_device *dev)
+{
+	uint64_t features = 1UL << VIRTIO_NET_F_MAC
+		| 1UL << VIRTIO_NET_F_MTU
+		| 1UL << VIRTIO_NET_F_STATUS
+		| 1UL << VIRTIO_NET_F_CTRL_VQ
+		| 1UL << VIRTIO_RING_F_EVENT_IDX;
+
+	if (VIRTIO_NET_MAX_PAIRS > 1) {
+		features |= 1UL << VIRTIO_NET_F_MQ;
+	}
+
+	return features;
+}
+
+static void virtio_net_set_guest_features(struct virtio_device *dev,
+					  uint32_t select, uint32_t features)
+{
+	struct virtio_net_dev *vndev = dev->emu_data;
+
+	if (1 < select)
+		return;
+
+	vndev->features &= ~((uint64_t)UINT_MAX << (select * 32));
+	vndev->features |= ((uint64_t)features << (select * 32));
+}
+
+static int virtio_net_init_vq(struct virtio_device *dev,
+			      uint32_t vq, uint32_t page_size, uint32_t align,
+			      uint32_t pfn)
+{
+	int rc;
+	struct virtio_net_dev *vndev = dev->emu_data;
+
+	if (vq >= VIRTIO_NET_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	/* Join the switch when the driver comes up. */
+	if (!vndev->attached) {
+		rc = vnet_switch_port_add(&vndev->port);
+		if (rc) {
+			return rc;
+		}
+		vndev->attached = true;
+	}
+
+	vnet_switch_lock();
+	rc = virtio_queue_setup(&vndev->vqs[vq], dev->guest,
+			pfn, page_size, VIRTIO_NET_QUEUE_SIZE, align);
+	vnet_switch_unlock();
+
+	return rc;
+}
+
+static int virtio_net_get_pfn_vq(struct virtio_device *dev, uint32_t vq)
+{
+	struct virtio_net_dev *vndev = dev->emu_data;
+
+	if (vq >= VIRTIO_NET_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	return virtio_queue_guest_pfn(&vndev->vqs[vq]);
+}
+
+static int virtio_net_get_size_vq(struct virtio_device *dev, uint32_t vq)
+{
+	return (vq < VIRTIO_NET_NUM_QUEUES) ? VIRTIO_NET_QUEUE_SIZE : 0;
+}
+
+static int virtio_net_set_size_vq(struct virtio_device *dev,
+				  uint32_t vq, int size)
+{
+	/* FIXME: dynamic */
+	return size;
+}
+
+/**
+ * @brief Handle the commands on the control queue. Rx mode and mac
+ * filter commands are accepted as is, the switch learns the macs.
+ */
+static void virtio_net_do_ctrl(struct virtio_net_dev *vndev)
+{
+	uint8_t status;
+	uint16_t head;
+	uint32_t iov_cnt, len;
+	struct virtio_net_ctrl_cmd cmd;
+	struct virtio_device *dev = vndev->vdev;
+	struct virtio_queue *vq = &vndev->vqs[VIRTIO_NET_CTRL_QUEUE];
+	struct virtio_iovec *iov = virtio_net_tx_iov;
+
+	while (virtio_queue_available(vq)) {
+		head = virtio_queue_pop(vq);
+		if (!virtio_queue_get_head_iovec(vq, head, iov, &iov_cnt, &len, &head)) {
+			printk("%s: failed to get iovec\n", __func__);
+			return;
+		}
+		if (iov_cnt < 2) {
+			virtio_queue_set_used_elem(vq, head, 0);
+			continue;
+		}
+
+		memset(&cmd, 0, sizeof(cmd));
+		len = virtio_iovec_to_buf_read(dev, iov, iov_cnt - 1, &cmd, sizeof(cmd));
+
+		status = VIRTIO_NET_ERR;
+		switch (cmd.hdr.class) {
+		case VIRTIO_NET_CTRL_RX:
+		case VIRTIO_NET_CTRL_MAC:
+			status = VIRTIO_NET_OK;
+			break;
+		case VIRTIO_NET_CTRL_MQ:
+			if (cmd.hdr.cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET &&
+			    len == sizeof(cmd) &&
+			    cmd.pairs >= VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN &&
+			    cmd.pairs <= VIRTIO_NET_MAX_PAIRS) {
+				vndev->curr_pairs = cmd.pairs;
+				status = VIRTIO_NET_OK;
+			}
+			break;
+		default:
+			break;
+		}
+
+		virtio_buf_to_iovec_write(dev, &iov[iov_cnt - 1], 1, &status, 1);
+		virtio_queue_set_used_elem(vq, head, 1);
+	}
+
+	if (virtio_queue_should_signal(vq)) {
+		dev->tra->notify(dev, VIRTIO_NET_CTRL_QUEUE);
+	}
+}
+
+/**
+ * @brief Forward the frames of a tx queue in batches, the sender and
+ * each receiver get one virq for a batch.
+ */
+static void virtio_net_do_tx(struct virtio_net_dev *vndev, uint16_t pair)
+{
+	uint16_t head;
+	uint32_t cnt, iov_cnt, len;
+	uint8_t buf[VIRTIO_NET_HDR_LEN + VNET_ETH_HLEN];
+	struct vnet_frame frame;
+	struct virtio_device *dev = vndev->vdev;
+	struct virtio_queue *vq = &vndev->vqs[VIRTIO_NET_TX_QUEUE(pair)];
+
+	frame.dev = dev;
+	frame.iov = virtio_net_tx_iov;
+	frame.offset = VIRTIO_NET_HDR_LEN;
+	frame.queue = pair;
+
+	while (virtio_queue_available(vq)) {
+		for (cnt = 0; cnt < CONFIG_VNET_SWITCH_BATCH &&
+		     virtio_queue_available(vq); cnt++) {
+			head = virtio_queue_pop(vq);
+			if (!virtio_queue_get_head_iovec(vq, head, frame.iov,
+						&iov_cnt, &len, &head)) {
+				printk("%s: failed to get iovec\n", __func__);
+				return;
+			}
+
+			if (len >= sizeof(buf) &&
+			    virtio_iovec_to_buf_read(dev, frame.iov, iov_cnt,
+						buf, sizeof(buf)) == sizeof(buf)) {
+				memcpy(frame.eth_hdr, &buf[VIRTIO_NET_HDR_LEN], VNET_ETH_HLEN);
+				frame.iov_cnt = iov_cnt;
+				frame.len = len - VIRTIO_NET_HDR_LEN;
+				vnet_switch_forward(&vndev->port, &frame);
+			}
+
+			/* The frame has been copied, the buffer goes back at once. */
+			virtio_queue_set_used_elem(vq, head, 0);
+		}
+
+		vnet_switch_flush();
+		if (virtio_queue_should_signal(vq)) {
+			dev->tra->notify(dev, VIRTIO_NET_TX_QUEUE(pair));
+		}
+	}
+}
+
+static void virtio_net_port_transmit(struct vnet_port *port)
+{
+	uint16_t pair;
+	struct virtio_net_dev *vndev = port->priv;
+
+	virtio_net_do_ctrl(vndev);
+
+	for (pair = 0; pair < VIRTIO_NET_MAX_PAIRS; pair++) {
+		virtio_net_do_tx(vndev, pair);
+	}
+}
+
+static int virtio_net_port_receive(struct vnet_port *port,
+				struct vnet_frame *frame)
+{
+	uint16_t pair, head;
+	uint32_t iov_cnt, len, copied;
+	struct virtio_net_hdr hdr;
+	struct virtio_net_dev *vndev = port->priv;
+	struct virtio_device *dev = vndev->vdev;
+	struct virtio_queue *vq;
+
+	pair = frame->queue % vndev->curr_pairs;
+	vq = &vndev->vqs[VIRTIO_NET_RX_QUEUE(pair)];
+	if (!virtio_queue_available(vq)) {
+		return -ENOBUFS;
+	}
+
+	head = virtio_queue_pop(vq);
+	if (!virtio_queue_get_head_iovec(vq, head, virtio_net_rx_iov,
+				&iov_cnt, &len, &head)) {
+		return -EINVAL;
+	}
+	vndev->rx_pending |= BIT(pair);
+
+	if (len < VIRTIO_NET_HDR_LEN) {
+		virtio_queue_set_used_elem(vq, head, 0);
+		return -EINVAL;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+	virtio_buf_to_iovec_write(dev, virtio_net_rx_iov, iov_cnt,
+				&hdr, VIRTIO_NET_HDR_LEN);
+	copied = virtio_iovec_to_iovec_copy(dev, virtio_net_rx_iov, iov_cnt,
+				VIRTIO_NET_HDR_LEN, frame->dev, frame->iov,
+				frame->iov_cnt, frame->offset, frame->len);
+
+	virtio_queue_set_used_elem(vq, head, VIRTIO_NET_HDR_LEN + copied);
+
+	return 0;
+}
+
+static void virtio_net_port_flush(struct vnet_port *port)
+{
+	uint16_t pair;
+	struct virtio_net_dev *vndev = port->priv;
+	struct virtio_device *dev = vndev->vdev;
+
+	for (pair = 0; pair < VIRTIO_NET_MAX_PAIRS; pair++) {
+		if (!(vndev->rx_pending & BIT(pair))) {
+			continue;
+		}
+		if (virtio_queue_should_signal(&vndev->vqs[VIRTIO_NET_RX_QUEUE(pair)])) {
+			dev->tra->notify(dev, VIRTIO_NET_RX_QUEUE(pair));
+		}
+	}
+	vndev->rx_pending = 0;
+}
+
+static int virtio_net_notify_vq(struct virtio_device *dev, uint32_t vq)
+{
+	struct virtio_net_dev *vndev = dev->emu_data;
+
+	if (vq >= VIRTIO_NET_NUM_QUEUES) {
+		return -EINVAL;
+	}
+
+	/**
+	 * New rx buffers need nothing, the frames without a buffer have
+	 * been dropped. The switch thread drains tx and control queues,
+	 * vcpu returns at once.
+	 */
+	if (vq == VIRTIO_NET_CTRL_QUEUE || (vq & 0x1)) {
+		if (vndev->attached) {
+			vnet_switch_kick(&vndev->port);
+		}
+	}
+
+	return 0;
+}
+
+static void virtio_net_status_changed(struct virtio_device *dev,
+				      uint32_t new_status)
+{
+	/* Nothing to do here. */
+}
+
+static int virtio_net_read_config(struct virtio_device *dev,
+				  uint32_t offset, void *dst, uint32_t dst_len)
+{
+	uint32_t i;
+	struct virtio_net_dev *vndev = dev->emu_data;
+	uint8_t *src = (uint8_t *)&vndev->config;
+
+	for (i=0; (i<dst_len) && ((offset+i) < sizeof(vndev->config)); i++) {
+		((uint8_t *)dst)[i] = src[offset + i];
+	}
+
+	return 0;
+}
+
+static int virtio_net_write_config(struct virtio_device *dev,
+				   uint32_t offset, void *src, uint32_t src_len)
+{
+	/* The mac is given by the device, nothing is writable. */
+	return 0;
+}
+
+static int virtio_net_reset(struct virtio_device *dev)
+{
+	uint32_t i;
+	struct virtio_net_dev *vndev = dev->emu_data;
+
+	/* The switch thread must not touch the queues being cleaned. */
+	vnet_switch_lock();
+	for (i = 0; i < VIRTIO_NET_NUM_QUEUES; i++) {
+		virtio_queue_cleanup(&vndev->vqs[i]);
+	}
+	vndev->curr_pairs = 1;
+	vndev->rx_pending = 0;
+	vnet_switch_unlock();
+
+	return 0;
+}
+
+static int virtio_net_connect(struct virtio_device *dev,
+			      struct virtio_emulator *emu)
+{
+	struct virtio_net_dev *vndev;
+	uint8_t mac[VIRTIO_NET_MAC_LEN] = {
+		0x52, 0x54, 0x00, 0x5a, (uint8_t)dev->guest->vmid,
+		(uint8_t)atomic_inc(&virtio_net_mac_idx),
+	};
+
+	vndev = k_malloc(sizeof(struct virtio_net_dev));
+	if (!vndev) {
+		printk("Failed to allocate virtio net device....\n");
+		return -ENOMEM;
+	}
+	memset(vndev, 0, sizeof(struct virtio_net_dev));
+	vndev->vdev = dev;
+	vndev->curr_pairs = 1;
+
+	memcpy(vndev->config.mac, mac, VIRTIO_NET_MAC_LEN);
+	vndev->config.status = VIRTIO_NET_S_LINK_UP;
+	vndev->config.max_virtqueue_pairs = VIRTIO_NET_MAX_PAIRS;
+	vndev->config.mtu = VIRTIO_NET_MTU;
+
+	memcpy(vndev->port.mac, mac, VNET_ETH_ALEN);
+	vndev->port.transmit = virtio_net_port_transmit;
+	vndev->port.receive = virtio_net_port_receive;
+	vndev->port.flush = virtio_net_port_flush;
+	vndev->port.priv = vndev;
+
+	dev->emu_data = vndev;
+
+	return 0;
+}
+
+static void virtio_net_disconnect(struct virtio_device *dev)
+{
+	struct virtio_net_dev *vndev = dev->emu_data;
+
+	if (vndev->attached) {
+		vnet_switch_port_remove(&vndev->port);
+	}
+	k_free(vndev);
+}
+
+struct virtio_device_id virtio_net_emu_id[] = {
+	{ .type = VIRTIO_ID_NET },
+	{ },
+};
+
+struct virtio_emulator virtio_net = {
+	.name = "virtio_net",
+	.id_table = virtio_net_emu_id,
+
+	/* VirtIO operations */
+	.get_host_features      = virtio_net_get_host_features,
+	.set_guest_features     = virtio_net_set_guest_features,
+	.init_vq                = virtio_net_init_vq,
+	.get_pfn_vq             = virtio_net_get_pfn_vq,
+	.get_size_vq            = virtio_net_get_size_vq,
+	.set_size_vq            = virtio_net_set_size_vq,
+	.notify_vq              = virtio_net_notify_vq,
+	.status_changed         = virtio_net_status_changed,
+
+	/* Emulator operations */
+	.read_config = virtio_net_read_config,
+	.write_config = virtio_net_write_config,
+	.reset = virtio_net_reset,
+	.connect = virtio_net_connect,
+	.disconnect = virtio_net_disconnect,
+};
@@ -0,0 +1,214 @@
+/**
+ * @file vnet_switch.c
+ * @brief Software L2 switch between the virtual network ports of vms.
+ *
+ * All the forwarding runs in one work queue thread, which owns the rx
+ * queues of every port, so frames go from the tx buffers of a guest to
+ * the rx buffers of another one with a single copy and no extra lock.
+ */
+
+#include <string.h>
+#include <zephyr.h>
+#include <kernel.h>
+#include <sys/dlist.h>
+
+#include <virtualization/zvm.h>
+#include <virtualization/vdev/virtio/vnet_switch.h>
+
+LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
+
+struct vnet_fdb_entry {
+	uint8_t mac[VNET_ETH_ALEN];
+	struct vnet_port *port;
+	/* last time the mac is seen, the oldest entry is replaced */
+	uint32_t stamp;
+};
+
+static K_MUTEX_DEFINE(vnet_switch_mutex);
+static sys_dlist_t vnet_ports = SYS_DLIST_STATIC_INIT(&vnet_ports);
+static struct vnet_fdb_entry vnet_fdb[CONFIG_VNET_SWITCH_FDB_SIZE];
+static uint32_t vnet_fdb_stamp;
+
+static bool vnet_switch_started;
+static struct k_work_q vnet_switch_wq;
+static K_KERNEL_STACK_DEFINE(vnet_switch_stack, CONFIG_VNET_SWITCH_WQ_STACK_SIZE);
+
+static const struct k_work_queue_config vnet_switch_wq_cfg = {
+	.name = "vnet_switch",
+};
+
+static inline bool vnet_mac_is_multicast(const uint8_t *mac)
+{
+	return mac[0] & 0x01;
+}
+
+static void vnet_fdb_learn(struct vnet_port *port, const uint8_t *mac)
+{
+	uint32_t i;
+	struct vnet_fdb_entry *entry, *victim = &vnet_fdb[0];
+
+	if (vnet_mac_is_multicast(mac)) {
+		return;
+	}
+
+	vnet_fdb_stamp++;
+	for (i = 0; i < CONFIG_VNET_SWITCH_FDB_SIZE; i++) {
+		entry = &vnet_fdb[i];
+		if (entry->port && !memcmp(entry->mac, mac, VNET_ETH_ALEN)) {
+			entry->port = port;
+			entry->stamp = vnet_fdb_stamp;
+			return;
+		}
+		if (!entry->port) {
+			victim = entry;
+		} else if (victim->port &&
+			   (int32_t)(entry->stamp - victim->stamp) < 0) {
+			victim = entry;
+		}
+	}
+
+	memcpy(victim->mac, mac, VNET_ETH_ALEN);
+	victim->port = port;
+	victim->stamp = vnet_fdb_stamp;
+}
+
+static struct vnet_port *vnet_fdb_lookup(const uint8_t *mac)
+{
+	uint32_t i;
+
+	for (i = 0; i < CONFIG_VNET_SWITCH_FDB_SIZE; i++) {
+		if (vnet_fdb[i].port && !memcmp(vnet_fdb[i].mac, mac, VNET_ETH_ALEN)) {
+			return vnet_fdb[i].port;
+		}
+	}
+
+	return NULL;
+}
+
+static void vnet_fdb_purge(struct vnet_port *port)
+{
+	uint32_t i;
+
+	for (i = 0; i < CONFIG_VNET_SWITCH_FDB_SIZE; i++) {
+		if (vnet_fdb[i].port == port) {
+			vnet_fdb[i].port = NULL;
+		}
+	}
+}
+
+static void vnet_switch_deliver(struct vnet_port *dst, struct vnet_frame *frame)
+{
+	if (!dst->receive(dst, frame)) {
+		dst->dirty = true;
+	}
+	/* A receiver without rx buffer drops the frame, as a real switch. */
+}
+
+void vnet_switch_forward(struct vnet_port *src, struct vnet_frame *frame)
+{
+	const uint8_t *dst_mac = &frame->eth_hdr[0];
+	const uint8_t *src_mac = &frame->eth_hdr[VNET_ETH_ALEN];
+	struct vnet_port *dst;
+	sys_dnode_t *d_node;
+
+	vnet_fdb_learn(src, src_mac);
+
+	if (!vnet_mac_is_multicast(dst_mac)) {
+		dst = vnet_fdb_lookup(dst_mac);
+		if (dst) {
+			if (dst != src) {
+				vnet_switch_deliver(dst, frame);
+			}
+			return;
+		}
+	}
+
+	SYS_DLIST_FOR_EACH_NODE(&vnet_ports, d_node) {
+		dst = CONTAINER_OF(d_node, struct vnet_port, node);
+		if (dst != src) {
+			vnet_switch_deliver(dst, frame);
+		}
+	}
+}
+
+void vnet_switch_flush(void)
+{
+	struct vnet_port *port;
+	sys_dnode_t *d_node;
+
+	SYS_DLIST_FOR_EACH_NODE(&vnet_ports, d_node) {
+		port = CONTAINER_OF(d_node, struct vnet_port, node);
+		if (port->dirty) {
+			port->dirty = false;
+			port->flush(port);
+		}
+	}
+}
+
+static void vnet_switch_work(struct k_work *work)
+{
+	struct vnet_port *port = CONTAINER_OF(work, struct vnet_port, work);
+
+	k_mutex_lock(&vnet_switch_mutex, K_FOREVER);
+	if (sys_dnode_is_linked(&port->node)) {
+		port->transmit(port);
+		vnet_switch_flush();
+	}
+	k_mutex_unlock(&vnet_switch_mutex);
+}
+
+void vnet_switch_kick(struct vnet_port *port)
+{
+	k_work_submit_to_queue(&vnet_switch_wq, &port->work);
+}
+
+int vnet_switch_port_add(struct vnet_port *port)
+{
+	if (!port->transmit || !port->receive || !port->flush) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&vnet_switch_mutex, K_FOREVER);
+
+	if (!vnet_switch_started) {
+		k_work_queue_start(&vnet_switch_wq, vnet_switch_stack,
+				K_KERNEL_STACK_SIZEOF(vnet_switch_stack),
+				CONFIG_VNET_SWITCH_WQ_PRIORITY, &vnet_switch_wq_cfg);
+		vnet_switch_started = true;
+	}
+
+	port->dirty = false;
+	k_work_init(&port->work, vnet_switch_work);
+	sys_dnode_init(&port->node);
+	sys_dlist_append(&vnet_ports, &port->node);
+	/* Known before the first frame, no flooding to reach it. */
+	vnet_fdb_learn(port, port->mac);
+
+	k_mutex_unlock(&vnet_switch_mutex);
+
+	return 0;
+}
+
+void vnet_switch_port_remove(struct vnet_port *port)
+{
+	struct k_work_sync sync;
+
+	k_work_cancel_sync(&port->work, &sync);
+
+	k_mutex_lock(&vnet_switch_mutex, K_FOREVER);
+	if (sys_dnode_is_linked(&port->node)) {
+		sys_dlist_remove(&port->node);
+	}
+	vnet_fdb_purge(port);
+	k_mutex_unlock(&vnet_switch_mutex);
+}
+
+void vnet_switch_lock(void)
+{
+	k_mutex_lock(&vnet_switch_mutex, K_FOREVER);
+}
+
+void vnet_switch_unlock(void)
+{
+	k_mutex_unlock(&vnet_switch_mutex);
+}
@@ -24,6 +24,7 @@
 #include <virtualization/arm/mm.h>
 #include <virtualization/arm/cpu.h>
 #include <virtualization/vdev/vgic_v3.h>
+#include <virtualization/vdev/shmem.h>
 #include <virtualization/vm_mm.h>
 #include <virtualization/zvm.h>
 
@@ -48,6 +49,31 @@ static int stop_vm_handler(struct vm *vm)
     return 0;
 }
 
+/**
+ * @brief Print vcpus' halt-poll window and statistics of the vm.
+ */
+static void z_list_vcpu_halt_poll_info(struct vm *vm)
+{
+    uint32_t i;
+    struct vcpu *vcpu;
+    struct vcpu_halt_poll *hp;
+
+    if (!vm->vcpus) {
+        return;
+    }
+
+    for (i = 0; i < vm->vcpu_num; i++) {
+        vcpu = vm->vcpus[i];
+        if (!vcpu) {
+            continue;
+        }
+        hp = &vcpu->halt_poll;
+        printk("|   vcpu%d halt-poll: window %dns(max %dns) success %d fail %d poll %lldus \n",
+                vcpu->vcpu_id, hp->poll_ns, hp->max_ns, hp->success, hp->fail,
+                hp->total_ns / 1000);
+    }
+}
+
 static void z_list_vm_info(uint16_t vmid)
 {
     char *vm_ss;
@@ -81,6 +107,7 @@ static void z_list_vm_info(uint16_t vmid)
     mem_size = vm->os->os_mem_size / (1024*1024);
     printk("|***%d  %s\t%d\t%d \t%s ***| \n", vm->vmid,
             vm->vm_name, vm->vcpu_num, mem_size, vm_ss);
+    z_list_vcpu_halt_poll_info(vm);
 
 }
 
@@ -329,6 +356,10 @@ int vm_vcpus_run(struct vm *vm)
             k_spin_unlock(&vm->spinlock, key);
             return -ENODEV;
         }
+        /* Secondary vcpus start when the guest turns them on by psci. */
+        if (vcpu->vcpu_id && vcpu->vcpu_state == _VCPU_STATE_UNKNOWN) {
+            continue;
+        }
         vm_vcpu_run(vcpu);
     }
     vm->vm_status = VM_STATE_RUNNING;
@@ -354,6 +385,9 @@ int vm_vcpus_pause(struct vm *vm)
             k_spin_unlock(&vm->spinlock, key);
             return -ENODEV;
         }
+        if (vcpu->vcpu_state == _VCPU_STATE_UNKNOWN) {
+            continue;
+        }
         vm_vcpu_pause(vcpu);
     }
 
@@ -379,6 +413,10 @@ int vm_vcpus_halt(struct vm *vm)
             k_spin_unlock(&vm->spinlock, key);
             return -ENODEV;
         }
+        /* A vcpu never turned on has no thread to stop. */
+        if (vcpu->vcpu_state == _VCPU_STATE_UNKNOWN) {
+            continue;
+        }
         vm_vcpu_halt(vcpu);
     }
     vm->vm_status = VM_STATE_HALT;
@@ -412,6 +450,8 @@ int vm_delete(struct vm *vm)
         }
     }
 
+    vm_shmem_remove(vm);
+
     /* remove all the partition in the vmem_domain */
     ret = vm_mem_apart_remove(vmem_dm);
 
@@ -424,6 +464,8 @@ int vm_delete(struct vm *vm)
             k_free(vwork->vcpu_thread);
         }
 
+        vcpu_sched_remove(vcpu);
+        arch_vcpu_deinit(vcpu);
         k_free(vcpu->arch);
         k_free(vcpu->work);
         k_free(vcpu);
@@ -501,6 +543,109 @@ int z_parse_info_vm_args(size_t argc, char **argv, struct getopt_state *state)
     return get_vmid_by_id(argc, argv, state);
 }
 
+typedef int (*vm_opt_handler_t)(int opt, const char *optarg, void *arg);
+
+/**
+ * @brief Parse "-n <vmid>" plus the command specific options in optstring.
+ * Options other than 'n' are passed to handler, a non-zero return of it
+ * fails the parse with usage printed.
+ * @return int : vmid, CONFIG_MAX_VM_NUM if "-n" is absent, or error code.
+ */
+static int z_parse_vm_opt_args(size_t argc, char **argv, struct getopt_state *state,
+                const char *optstring, vm_opt_handler_t handler, void *arg,
+                const char *usage)
+{
+    int opt, ret = CONFIG_MAX_VM_NUM;
+    char *end;
+    unsigned long vm_id;
+    struct getopt_state *alloc_state = NULL;
+
+    if (state == NULL) {
+        alloc_state = (struct getopt_state*)k_malloc(sizeof(struct getopt_state));
+        if (!alloc_state) {
+            ZVM_LOG_WARN("Allocation memory for getopt_state Error! \n");
+            return -ENOMEM;
+        }
+        state = alloc_state;
+    }
+    getopt_init(state);
+
+    while ((opt = getopt(state, argc, argv, optstring)) != -1) {
+        if (opt == 'n') {
+            vm_id = strtoul(state->optarg, &end, 10);
+            if (end == state->optarg || *end != '\0' || vm_id >= CONFIG_MAX_VM_NUM) {
+                ZVM_LOG_WARN("Input number invalid, Please input a valid vmid after \"-n\" command! \n");
+                ret = -EINVAL;
+                break;
+            }
+            ret = (int)vm_id;
+        } else if (handler(opt, state->optarg, arg)) {
+            ZVM_LOG_WARN("Input invalid, Please input \"%s\"! \n", usage);
+            ret = -EINVAL;
+            break;
+        }
+    }
+
+    if (alloc_state) {
+        k_free(alloc_state);
+    }
+    return ret;
+}
+
+static int stat_opt_handler(int opt, const char *optarg, void *arg)
+{
+    ARG_UNUSED(optarg);
+
+    if (opt != 'c') {
+        return -EINVAL;
+    }
+    *(bool *)arg = true;
+    return 0;
+}
+
+int z_parse_stat_vm_args(size_t argc, char **argv, struct getopt_state *state,
+                bool *clear)
+{
+    return z_parse_vm_opt_args(argc, argv, state, "n:c", stat_opt_handler,
+                clear, "zvm stat -n <vmid> [-c]");
+}
+
+static int console_opt_handler(int opt, const char *optarg, void *arg)
+{
+    char *end;
+
+    if (opt != 'p') {
+        return -EINVAL;
+    }
+    *(uint32_t *)arg = (uint32_t)strtoul(optarg, &end, 10);
+    return (end == optarg || *end != '\0') ? -EINVAL : 0;
+}
+
+int z_parse_console_vm_args(size_t argc, char **argv, struct getopt_state *state,
+                uint32_t *port)
+{
+    return z_parse_vm_opt_args(argc, argv, state, "n:p:", console_opt_handler,
+                port, "zvm console -n <vmid> [-p <port>]");
+}
+
+static int balloon_opt_handler(int opt, const char *optarg, void *arg)
+{
+    char *end;
+
+    if (opt != 'm') {
+        return -EINVAL;
+    }
+    *(int64_t *)arg = (int64_t)strtoul(optarg, &end, 10);
+    return (end == optarg || *end != '\0') ? -EINVAL : 0;
+}
+
+int z_parse_balloon_vm_args(size_t argc, char **argv, struct getopt_state *state,
+                int64_t *target_mb)
+{
+    return z_parse_vm_opt_args(argc, argv, state, "n:m:", balloon_opt_handler,
+                target_mb, "zvm balloon -n <vmid> [-m <MB>]");
+}
+
 int z_list_vms_info(uint16_t vmid)
 {
     /* if vmid equal to CONFIG_MAX_VM_NUM, list all vm */
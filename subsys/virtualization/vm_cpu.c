@@ -36,8 +36,6 @@ static void init_vcpu_virt_irq_desc(struct vcpu_virt_irq_block *virq_block)
         desc->virq_flags = VIRQ_NOUSED_FLAG;
         desc->virq_states = 0;
         desc->vm_id = DEFAULT_VM;
-
-        sys_dnode_init(&(desc->desc_node));
     }
 }
 
@@ -98,6 +96,7 @@ static void vcpu_context_switch(struct k_thread *new_thread,
         default:
             break;
         }
+        vcpu_sched_handoff(old_vcpu);
     }
     ZVM_LOG_INFO("** load_vcpu_context, thread: %p, new vcpu thread? : %d \n ", new_thread, VCPU_THREAD(new_thread));
     if (VCPU_THREAD(new_thread)) {
@@ -258,6 +257,16 @@ int vcpu_state_switch(struct k_thread *thread, uint16_t new_state)
     }
     vcpu->vcpu_state = new_state;
 
+    /**
+     * vcpu sleeping in wfi must leave the wait to see its new state. The
+     * state is published before the waiting flag is read, pairs with the
+     * barrier in vcpu_wait_for_irq().
+     */
+    if (new_state == _VCPU_STATE_PAUSED || new_state == _VCPU_STATE_HALTED) {
+        dmb();
+        vcpu_wfi_kick(vcpu);
+    }
+
     return ret;
 
 }
@@ -275,7 +284,7 @@ void do_vcpu_swap(struct k_thread *new_thread, struct k_thread *old_thread)
     if (old_thread && VCPU_THREAD(old_thread)) {
         save_vcpu_context(old_thread);
     }
-    else if (new_thread && VCPU_THREAD(new_thread)) {
+    if (new_thread && VCPU_THREAD(new_thread)) {
         load_vcpu_context(new_thread);
     }
 #endif /* CONFIG_SMP */
@@ -318,6 +327,7 @@ int z_vcpu_run(struct vcpu *vcpu)
     ZVM_LOG_INFO("\n** Start running vcpu: %s-%d. \n", vcpu->vm->vm_name, vcpu->vcpu_id);
     do{
         ret = arch_vcpu_run(vcpu);
+        vcpu_sched_migrate_point(vcpu);
     }while(ret >= 0);
     ZVM_LOG_INFO("** Stop running vcpu: %s-%d. \n", vcpu->vm->vm_name, vcpu->vcpu_id);
     vm_delete(vcpu->vm);
@@ -330,16 +340,146 @@ int z_vcpu_run(struct vcpu *vcpu)
  */
 int vcpu_irq_exit(struct vcpu *vcpu)
 {
-    bool pend, active;
 	struct vcpu_virt_irq_block *vb = &vcpu->virq_block;
 
-	pend = sys_dlist_is_empty(&vb->pending_irqs);
-	active = sys_dlist_is_empty(&vb->active_irqs);
+	return vb->virq_pending_counts || vcpu->arch->list_regs_map ||
+			atomic_get(&vb->sgi_posted);
+}
+
+/**
+ * @brief Init vcpu's halt-poll policy: rtos vm polls from the start and
+ * keeps a minimal window for low wakeup latency, other vms start without
+ * polling so that an idle guest does not waste pcpu.
+ */
+static void vcpu_halt_poll_init(struct vcpu *vcpu)
+{
+    struct vcpu_halt_poll *hp = &vcpu->halt_poll;
+
+    memset(hp, 0, sizeof(struct vcpu_halt_poll));
+    if (vcpu->vm->is_rtos) {
+        hp->max_ns = CONFIG_VM_VCPU_HALT_POLL_RT_MAX_NS;
+        hp->min_ns = MIN(CONFIG_VM_VCPU_HALT_POLL_GROW_START_NS, hp->max_ns);
+        hp->poll_ns = hp->max_ns;
+    } else {
+        hp->max_ns = CONFIG_VM_VCPU_HALT_POLL_NORT_MAX_NS;
+        hp->min_ns = 0;
+        hp->poll_ns = 0;
+    }
+}
+
+/**
+ * @brief Adjust the window by the whole idle time: wakeup came soon after
+ * the window, a longer one would catch it; vcpu slept longer than max,
+ * polling only wastes pcpu.
+ */
+static void vcpu_halt_poll_update(struct vcpu_halt_poll *hp, uint64_t idle_ns)
+{
+    uint32_t poll_ns = hp->poll_ns;
+
+    if (idle_ns <= poll_ns) {
+        return;
+    }
+
+    if (idle_ns > hp->max_ns) {
+        poll_ns /= 2;
+        if (poll_ns < CONFIG_VM_VCPU_HALT_POLL_GROW_START_NS) {
+            poll_ns = 0;
+        }
+    } else {
+        poll_ns = poll_ns ? poll_ns * 2 : CONFIG_VM_VCPU_HALT_POLL_GROW_START_NS;
+    }
+    hp->poll_ns = CLAMP(poll_ns, hp->min_ns, hp->max_ns);
+}
+
+/**
+ * @brief Guest is idle in wfi: poll for vcpu's halt-poll window, then
+ * sleep until set_virq_to_vcpu() kicks this vcpu. Vtimer expiry and sgi
+ * both come through that path.
+ */
+int vcpu_wait_for_irq(struct vcpu *vcpu)
+{
+    uint64_t start, idle, poll_cycles;
+    struct vcpu_halt_poll *hp = &vcpu->halt_poll;
+
+    /* 64-bit cycles, a long sleep wraps the 32-bit counter in seconds. */
+    start = k_cycle_get_64();
+    if (hp->poll_ns) {
+        poll_cycles = k_ns_to_cyc_ceil64(hp->poll_ns);
+        do {
+            if (vcpu_irq_exit(vcpu)) {
+                idle = k_cycle_get_64() - start;
+                hp->success++;
+                hp->total_ns += k_cyc_to_ns_floor64(idle);
+                vm_exit_stat_idle(vcpu, (uint32_t)MIN(idle, UINT32_MAX));
+                return 0;
+            }
+        } while (k_cycle_get_64() - start < poll_cycles);
+        hp->fail++;
+        hp->total_ns += k_cyc_to_ns_floor64(k_cycle_get_64() - start);
+    }
+
+    /**
+     * Drop the wakeups left by earlier kicks, and publish the waiting
+     * flag before the last check, so a virq set after it always gives
+     * the sem.
+     */
+    k_sem_reset(&vcpu->wfi_sem);
+    atomic_set(&vcpu->wfi_waiting, 1);
+    dmb();
+    /**
+     * Test the vcpu's own state, it is switched before the kick, while
+     * vm_status is only set after all the vcpus are paused or halted.
+     */
+    if (!vcpu_irq_exit(vcpu) &&
+        !(vcpu->vcpu_state & (_VCPU_STATE_HALTED | _VCPU_STATE_PAUSED))) {
+#ifdef CONFIG_ZVM_STEAL_TIME
+        uint64_t wait_start = k_cycle_get_64();
+
+        k_sem_take(&vcpu->wfi_sem, K_FOREVER);
+        vcpu->wait_cycles += k_cycle_get_64() - wait_start;
+#else
+        k_sem_take(&vcpu->wfi_sem, K_FOREVER);
+#endif
+    }
+    atomic_set(&vcpu->wfi_waiting, 0);
+
+    idle = k_cycle_get_64() - start;
+    vcpu_halt_poll_update(hp, k_cyc_to_ns_floor64(idle));
+    vm_exit_stat_idle(vcpu, (uint32_t)MIN(idle, UINT32_MAX));
+
+    return 0;
+}
+
+bool vcpu_wfi_kick(struct vcpu *vcpu)
+{
+    if (!atomic_get(&vcpu->wfi_waiting)) {
+        return false;
+    }
+    k_sem_give(&vcpu->wfi_sem);
 
-	return !(pend && active);
+    return true;
 }
 
-static int created_vm_num = 0;
+uint64_t vcpu_steal_time_ns(struct vcpu *vcpu)
+{
+#ifdef CONFIG_ZVM_STEAL_TIME
+    uint64_t life, used;
+    k_thread_runtime_stats_t rt_stats;
+
+    if (!vcpu->steal_start ||
+        k_thread_runtime_stats_get(vcpu->work->vcpu_thread, &rt_stats)) {
+        return 0;
+    }
+
+    life = k_cycle_get_64() - vcpu->steal_start;
+    used = rt_stats.execution_cycles + vcpu->wait_cycles;
+
+    return life > used ? k_cyc_to_ns_floor64(life - used) : 0;
+#else
+    ARG_UNUSED(vcpu);
+    return 0;
+#endif
+}
 
 struct vcpu *vm_vcpu_init(struct vm *vm, uint16_t vcpu_id, char *vcpu_name)
 {
@@ -354,7 +494,8 @@ struct vcpu *vm_vcpu_init(struct vm *vm, uint16_t vcpu_id, char *vcpu_name)
         return NULL;
     }
 
-    vcpu->arch = (struct vcpu_arch *)k_malloc(sizeof(struct vcpu_arch));
+    /* fp/simd context is stored with q register alignment */
+    vcpu->arch = (struct vcpu_arch *)k_aligned_alloc(0x10, sizeof(struct vcpu_arch));
     if (!vcpu->arch) {
         ZVM_LOG_ERR("Init vcpu->arch failed");
         k_free(vcpu);
@@ -362,9 +503,7 @@ struct vcpu *vm_vcpu_init(struct vm *vm, uint16_t vcpu_id, char *vcpu_name)
     }
 
     /* init vcpu virt irq block. */
-    vcpu->virq_block.virq_pending_counts = 0;
-    sys_dlist_init(&vcpu->virq_block.pending_irqs);
-    sys_dlist_init(&vcpu->virq_block.active_irqs);
+    memset(&vcpu->virq_block, 0, sizeof(struct vcpu_virt_irq_block));
     ZVM_SPINLOCK_INIT(&vcpu->virq_block.spinlock);
     init_vcpu_virt_irq_desc(&vcpu->virq_block);
 
@@ -395,27 +534,6 @@ struct vcpu *vm_vcpu_init(struct vm *vm, uint16_t vcpu_id, char *vcpu_name)
 			vm_prio, 0, K_FOREVER);
     strcpy(tid->name, vcpu_name);
 
-    /* SMP support*/
-#ifdef CONFIG_SCHED_CPU_MASK
-    k_thread_cpu_mask_disable(tid, 0);
-
-    if (vm->is_rtos) {
-        pcpu_num = rt_get_idle_cpu();
-    }else{
-        pcpu_num = nrt_get_idle_cpu();
-    }
-    if (pcpu_num < 0 || pcpu_num >= CONFIG_MP_NUM_CPUS) {
-        ZVM_LOG_WARN("No suitable idle cpu for VM! \n");
-        return NULL;
-    }
-    /* Just work on 4 cores system */
-    if(++created_vm_num == CONFIG_MP_NUM_CPUS-1){
-        pcpu_num = CONFIG_MP_NUM_CPUS-1;
-    }
-    k_thread_cpu_mask_enable(tid, pcpu_num);
-    vcpu->cpu = pcpu_num;
-#endif /* CONFIG_SCHED_CPU_MASK */
-
     /* create a new thread and store it in work struct */
     vwork->v_date = vcpu;
     vwork->vcpu_thread->vcpu_struct = vcpu;
@@ -430,8 +548,30 @@ struct vcpu *vm_vcpu_init(struct vm *vm, uint16_t vcpu_id, char *vcpu_name)
     vcpu->exit_type = 0;
     vcpu->resume_signal = false;
     vcpu->waitq_flag = false;
+    k_sem_init(&vcpu->wfi_sem, 0, 1);
+    atomic_set(&vcpu->wfi_waiting, 0);
+    vcpu_halt_poll_init(vcpu);
+#ifdef CONFIG_ZVM_STEAL_TIME
+    vcpu->steal_start = 0;
+    vcpu->wait_cycles = 0;
+#endif
+
+    /* SMP support*/
+#ifdef CONFIG_ZVM_VCPU_SCHED
+    pcpu_num = vcpu_sched_place(vcpu);
+    if (pcpu_num < 0) {
+        ZVM_LOG_WARN("No suitable idle cpu for VM! \n");
+        return NULL;
+    }
+    k_thread_cpu_mask_clear(tid);
+    k_thread_cpu_mask_enable(tid, pcpu_num);
+    vcpu->cpu = pcpu_num;
+#else
+    ARG_UNUSED(pcpu_num);
+#endif /* CONFIG_ZVM_VCPU_SCHED */
 
     if (arch_vcpu_init(vcpu)) {
+        vcpu_sched_remove(vcpu);
         k_free(vcpu);
         return  NULL;
     }
@@ -451,6 +591,9 @@ int vm_vcpu_run(struct vcpu *vcpu)
     switch (cur_state) {
     case _VCPU_STATE_READY:
     case _VCPU_STATE_UNKNOWN:
+#ifdef CONFIG_ZVM_STEAL_TIME
+        vcpu->steal_start = k_cycle_get_64();
+#endif
         k_thread_start(thread);
         vcpu->vcpu_state = _VCPU_STATE_READY;
         break;
@@ -16,6 +16,7 @@
 #include <virtualization/vdev/vgic_v3.h>
 #include <virtualization/vm_console.h>
 #include <virtualization/vdev/fiq_debugger.h>
+#include <virtualization/vdev/shmem.h>
 #include <virtualization/vdev/virt_device.h>
 #include <virtualization/vdev/virtio/virtio_mmio.h>
 
@@ -38,7 +39,7 @@ static int vm_vdev_mem_add(struct vm *vm, struct virt_dev *vdev)
     }
 
     return vm_vdev_mem_create(vm->vmem_domain, vdev->vm_vdev_paddr,
-            vdev->vm_vdev_vaddr, vdev->vm_vdev_size, attrs);
+            vdev->vm_vdev_vaddr, vdev->vm_vdev_size, attrs, vdev);
 
 }
 
@@ -70,6 +71,7 @@ struct virt_dev *vm_virt_dev_add(struct vm *vm, const char *dev_name, bool pt_fl
     ret = vm_vdev_mem_add(vm, vm_dev);
     if(ret){
         ZVM_LOG_ERR("Map vm device memory error!\n");
+        k_free(vm_dev);
         return NULL;
     }
     vm_dev->virq = dev_virq;
@@ -86,40 +88,35 @@ int vdev_mmio_abort(arch_commom_regs_t *regs, int write, uint64_t addr,
     uint64_t *reg_value = value;
     struct vm *vm;
     struct virt_dev *vdev;
-    struct  _dnode *d_node, *ds_node;
+    struct vm_mem_region region;
     const struct device *dev;
 
     vm = get_current_vm();
 
-    SYS_DLIST_FOR_EACH_NODE_SAFE(&vm->vdev_list, d_node, ds_node){
-        vdev = CONTAINER_OF(d_node, struct virt_dev, vdev_node);
-
-        if (vdev->shareable) {
-			if ((addr >= vdev->vm_vdev_vaddr) && (addr < vdev->vm_vdev_vaddr + vdev->vm_vdev_size)) {
-                dev = (const struct device* const)vdev->priv_data;
-				if (write) {
-					return ((struct virtio_mmio_driver_api *)((struct virt_device_api *)dev->api)->device_driver_api)->write(vdev, addr - vdev->vm_vdev_vaddr, 0, (uint32_t)*reg_value, size);
-				} else {
-					return ((struct virtio_mmio_driver_api *)((struct virt_device_api *)dev->api)->device_driver_api)->read(vdev, addr - vdev->vm_vdev_vaddr, (uint32_t *)reg_value, size);
-				}
-			}
-		} else {
-            if ((addr >= vdev->vm_vdev_paddr) && (addr < vdev->vm_vdev_paddr + vdev->vm_vdev_size)) {
-                dev = (const struct device* const)vdev->priv_vdev;
-                if (write) {
-                    return ((const struct virt_device_api * \
-                        const)(dev->api))->virt_device_write(vdev, addr, reg_value);
-                }else{
-                    return ((const struct virt_device_api * \
-                        const)(dev->api))->virt_device_read(vdev, addr, reg_value);
-                }
-            }
+    if (vm_mem_region_lookup(vm->vmem_domain, addr, &region) || !region.vdev) {
+        /* Not found the vdev */
+        ZVM_LOG_WARN("There are no virtual dev for this addr, addr : 0x%llx \n", addr);
+        return -ENODEV;
+    }
+    vdev = region.vdev;
+
+    if (vdev->shareable) {
+        dev = (const struct device* const)vdev->priv_data;
+        if (write) {
+            return ((struct virtio_mmio_driver_api *)((struct virt_device_api *)dev->api)->device_driver_api)->write(vdev, addr - vdev->vm_vdev_vaddr, 0, (uint32_t)*reg_value, size);
+        } else {
+            return ((struct virtio_mmio_driver_api *)((struct virt_device_api *)dev->api)->device_driver_api)->read(vdev, addr - vdev->vm_vdev_vaddr, (uint32_t *)reg_value, size);
+        }
+    } else {
+        dev = (const struct device* const)vdev->priv_vdev;
+        if (write) {
+            return ((const struct virt_device_api * \
+                const)(dev->api))->virt_device_write(vdev, addr, reg_value);
+        }else{
+            return ((const struct virt_device_api * \
+                const)(dev->api))->virt_device_read(vdev, addr, reg_value);
         }
     }
-
-    /* Not found the vdev */
-    ZVM_LOG_WARN("There are no virtual dev for this addr, addr : 0x%llx \n", addr);
-    return -ENODEV;
 }
 
 int vm_unmap_ptdev(struct virt_dev *vdev, uint64_t vm_dev_base,
@@ -223,6 +220,12 @@ int vm_device_init(struct vm *vm)
         return -EMMAO;
     }
 
+    ret = vm_shmem_create(vm);
+    if (ret) {
+        ZVM_LOG_WARN("Init vm shared memory error! \n");
+        return ret;
+    }
+
     /* Board specific device init, for example fig debugger. */
     switch (vm->os->type){
     case OS_TYPE_LINUX:
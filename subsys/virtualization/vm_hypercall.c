@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <string.h>
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/vm_cpu.h>
+#include <virtualization/vm_mm.h>
+#include <virtualization/vm_hypercall.h>
+#include <virtualization/vdev/vgic_common.h>
+
+LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
+
+/* Bytes of console output printed at a time */
+#define VM_HC_CONSOLE_CHUNK     (64)
+
+/**
+ * @brief Hypercall handler, @regs holds x0-x3 of the guest. x0 is set
+ * from the return value, the handler puts its results in x1-x3.
+ */
+typedef int (*vm_hypercall_fn_t)(struct vcpu *vcpu, uint64_t *regs);
+
+static int vm_hc_version(struct vcpu *vcpu, uint64_t *regs)
+{
+    ARG_UNUSED(vcpu);
+
+    regs[1] = ZVM_HC_VERSION_VALUE;
+    regs[2] = ZVM_HC_FUNC_NUM;
+    regs[3] = 0;
+
+    return 0;
+}
+
+static int vm_hc_yield(struct vcpu *vcpu, uint64_t *regs)
+{
+    ARG_UNUSED(vcpu);
+    ARG_UNUSED(regs);
+
+    /**
+     * The target hint is not used yet, vcpus of a vm run at the same
+     * priority, so yielding lets the waited vcpu run if it shares the
+     * pcpu.
+     */
+    k_yield();
+
+    return 0;
+}
+
+static int vm_hc_send_ipi(struct vcpu *vcpu, uint64_t *regs)
+{
+    uint32_t i;
+    uint64_t sent = 0, mask = regs[1];
+    uint32_t sgi_id = (uint32_t)regs[2];
+    struct vm *vm = vcpu->vm;
+
+    if (sgi_id >= VM_SGI_VIRQ_NR) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < vm->vcpu_num && i < 64; i++) {
+        if (!(mask & BIT64(i)) || !vm->vcpus[i]) {
+            continue;
+        }
+        if (set_virq_to_vcpu(vm->vcpus[i], sgi_id) >= 0) {
+            sent |= BIT64(i);
+        }
+    }
+    regs[1] = sent;
+
+    return 0;
+}
+
+static int vm_hc_console_write(struct vcpu *vcpu, uint64_t *regs)
+{
+    char buf[VM_HC_CONSOLE_CHUNK + 1];
+    uint64_t gpa = regs[1];
+    size_t len = MIN(regs[2], ZVM_HC_CONSOLE_MAX);
+    size_t done = 0, chunk;
+    struct vm_mem_partition *vpart;
+
+    while (done < len) {
+        /* A chunk stays in one page, the page is guest ram or not. */
+        chunk = MIN(len - done, VM_HC_CONSOLE_CHUNK);
+        chunk = MIN(chunk, CONFIG_MMU_PAGE_SIZE -
+                ((gpa + done) & (CONFIG_MMU_PAGE_SIZE - 1)));
+        vpart = NULL;
+        vm_gpa_to_hpa(vcpu->vm, gpa + done, &vpart);
+        if (!vpart) {
+            break;
+        }
+        /* Works whether the guest ram has a host mapping or not. */
+        vm_guest_memory_read(vcpu->vm, gpa + done, buf, chunk);
+        buf[chunk] = '\0';
+        printk("%s", buf);
+        done += chunk;
+    }
+    regs[1] = done;
+
+    return (done || !len) ? 0 : -EFAULT;
+}
+
+static int vm_hc_steal_time(struct vcpu *vcpu, uint64_t *regs)
+{
+    if (!IS_ENABLED(CONFIG_ZVM_STEAL_TIME)) {
+        return -ENOTSUP;
+    }
+    regs[1] = vcpu_steal_time_ns(vcpu);
+
+    return 0;
+}
+
+static const vm_hypercall_fn_t vm_hypercall_table[ZVM_HC_FUNC_NUM] = {
+    [ZVM_HC_VERSION] = vm_hc_version,
+    [ZVM_HC_YIELD] = vm_hc_yield,
+    [ZVM_HC_SEND_IPI] = vm_hc_send_ipi,
+    [ZVM_HC_CONSOLE_WRITE] = vm_hc_console_write,
+    [ZVM_HC_STEAL_TIME] = vm_hc_steal_time,
+};
+
+void vm_hypercall_handle(struct vcpu *vcpu, uint64_t *regs)
+{
+    uint64_t func = regs[0];
+
+    if (!ZVM_HC_IS_ZVM(func) ||
+        (func & ZVM_HC_FUNC_MASK) >= ZVM_HC_FUNC_NUM) {
+        regs[0] = ZVM_HC_NOT_SUPPORTED;
+        return;
+    }
+
+    regs[0] = vm_hypercall_table[func & ZVM_HC_FUNC_MASK](vcpu, regs);
+}
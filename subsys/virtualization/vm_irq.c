@@ -53,18 +53,17 @@ static int vm_virq_desc_init(struct vm *vm)
     for (i = 0; i < VM_SPI_VIRQ_NR; i++) {
 		desc = &vm->vm_irq_block.vm_virt_irq_desc[i];
 
-        desc->virq_flags = VIRQ_NOUSED_FLAG | VIRQ_HW_FLAG;
+        /* The hw flag is set when a passthrough device takes the spi. */
+        desc->virq_flags = VIRQ_NOUSED_FLAG;
 		/* For shared irq, it shared with all cores */
         desc->vcpu_id =  DEFAULT_VCPU;
         desc->vm_id = vm->vmid;
         desc->vdev_trigger = 0;
-        desc->virq_num = i;
-        desc->pirq_num = i;
+        desc->virq_num = i + VM_LOCAL_VIRQ_NR;
+        desc->pirq_num = i + VM_LOCAL_VIRQ_NR;
         desc->id = VM_INVALID_DESC_ID;
         desc->virq_states = VIRQ_STATE_INVALID;
         desc->type = 0;
-
-        sys_dnode_init(&(desc->desc_node));
     }
 
     return 0;
@@ -79,9 +78,9 @@ void vm_device_irq_init(struct vm *vm, struct virt_dev *vm_dev)
     if(vm_dev->dev_pt_flag){
         desc->virq_flags = VIRQ_NOUSED_FLAG | VIRQ_HW_FLAG;
     }else{
-        ZVM_LOG_ERR("There is no supported virtual interrupt");
+        desc->virq_flags = VIRQ_NOUSED_FLAG;
     }
-    desc->id = desc->virq_num;
+    desc->id = VM_INVALID_DESC_ID;
     desc->pirq_num = vm_dev->hirq;
     desc->virq_num = vm_dev->virq;
 
@@ -14,6 +14,8 @@
 #include <virtualization/os/os_linux.h>
 #include <virtualization/zvm.h>
 #include <virtualization/vdev/vgic_v3.h>
+#include <virtualization/vdev/virtio/virtio_console.h>
+#include <virtualization/vdev/virtio/virtio_balloon.h>
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
@@ -228,3 +230,119 @@ int zvm_info_guest(size_t argc, char **argv)
 
 	return ret;
 }
+
+
+int zvm_stat_guest(size_t argc, char **argv)
+{
+	int vm_id;
+	bool clear = false;
+	int ret = 0;
+	struct vm *vm;
+
+	vm_id = z_parse_stat_vm_args(argc, argv, state, &clear);
+	if (vm_id < 0) {
+		return vm_id;
+	}
+	if (vm_id >= CONFIG_MAX_VM_NUM ||
+		!(BIT(vm_id) & zvm_overall_info->alloced_vmid)) {
+        ZVM_LOG_WARN("This vm is not exist!\n Please input zvm info to list vms! \n");
+		return -ENODEV;
+    }
+
+	vm = zvm_overall_info->vms[vm_id];
+	ret = vm_exit_stat_print(vm);
+	if (ret == -ENOTSUP) {
+		ZVM_LOG_WARN("Exit statistics is not enabled, please set CONFIG_ZVM_EXIT_STAT! \n");
+		return ret;
+	}
+	if (!ret && clear) {
+		ret = vm_exit_stat_reset(vm);
+	}
+
+	return ret;
+}
+
+
+int zvm_console_guest(const struct shell *shell, size_t argc, char **argv)
+{
+	int vm_id;
+	uint32_t port = 0;
+
+	if (!IS_ENABLED(CONFIG_VM_VIRTIO_CONSOLE)) {
+		ZVM_LOG_WARN("Virtio console is not enabled, please set CONFIG_VM_VIRTIO_CONSOLE! \n");
+		return -ENOTSUP;
+	}
+
+	vm_id = z_parse_console_vm_args(argc, argv, state, &port);
+	if (vm_id < 0 || vm_id >= CONFIG_MAX_VM_NUM ||
+		!(BIT(vm_id) & zvm_overall_info->alloced_vmid)) {
+        ZVM_LOG_WARN("This vm is not exist!\n Please input zvm info to list vms! \n");
+		return -ENODEV;
+    }
+
+#ifdef CONFIG_VM_VIRTIO_CONSOLE
+	if (virtio_console_attach(shell, zvm_overall_info->vms[vm_id], port)) {
+		ZVM_LOG_WARN("This vm has no virtio console port %u! \n", port);
+		return -ENODEV;
+	}
+#endif
+
+	return 0;
+}
+
+
+int zvm_balloon_guest(const struct shell *shell, size_t argc, char **argv)
+{
+	int vm_id;
+	int64_t target_mb = -1;
+
+	if (!IS_ENABLED(CONFIG_VM_VIRTIO_BALLOON)) {
+		ZVM_LOG_WARN("Virtio balloon is not enabled, please set CONFIG_VM_VIRTIO_BALLOON! \n");
+		return -ENOTSUP;
+	}
+
+	vm_id = z_parse_balloon_vm_args(argc, argv, state, &target_mb);
+	if (vm_id < 0 || vm_id >= CONFIG_MAX_VM_NUM ||
+		!(BIT(vm_id) & zvm_overall_info->alloced_vmid)) {
+        ZVM_LOG_WARN("This vm is not exist!\n Please input zvm info to list vms! \n");
+		return -ENODEV;
+    }
+
+#ifdef CONFIG_VM_VIRTIO_BALLOON
+	struct vm *vm = zvm_overall_info->vms[vm_id];
+	struct virtio_balloon_info info;
+
+	if (target_mb >= 0) {
+		if (virtio_balloon_set_target(vm,
+				(target_mb * 1024 * 1024) >> VIRTIO_BALLOON_PFN_SHIFT)) {
+			ZVM_LOG_WARN("This vm has no virtio balloon! \n");
+			return -ENODEV;
+		}
+	}
+
+	if (virtio_balloon_get_info(vm, &info)) {
+		ZVM_LOG_WARN("This vm has no virtio balloon! \n");
+		return -ENODEV;
+	}
+
+	shell_fprintf(shell, SHELL_NORMAL, "vm %d balloon: target %uM, actual %uM\n",
+		vm_id, info.target_pages >> (20 - VIRTIO_BALLOON_PFN_SHIFT),
+		info.actual_pages >> (20 - VIRTIO_BALLOON_PFN_SHIFT));
+	if (info.busy_pages) {
+		shell_fprintf(shell, SHELL_NORMAL,
+			"  %u pages kept mapped, vdev buffers were in their blocks\n",
+			info.busy_pages);
+	}
+	if (info.stats_valid) {
+		shell_fprintf(shell, SHELL_NORMAL,
+			"  free %lluM, avail %lluM, total %lluM, swap in/out %llu/%llu\n",
+			info.stats[VIRTIO_BALLOON_S_MEMFREE] >> 20,
+			info.stats[VIRTIO_BALLOON_S_AVAIL] >> 20,
+			info.stats[VIRTIO_BALLOON_S_MEMTOT] >> 20,
+			info.stats[VIRTIO_BALLOON_S_SWAP_IN],
+			info.stats[VIRTIO_BALLOON_S_SWAP_OUT]);
+	}
+#endif
+
+	return 0;
+}
@@ -7,6 +7,7 @@
 #include <sys/mem_manage.h>
 #include <sys/dlist.h>
 #include <sys/util.h>
+#include <cache.h>
 
 #include <virtualization/zvm.h>
 #include <virtualization/arm/mm.h>
@@ -24,6 +25,19 @@ struct k_spinlock vm_mem_domain_lock;
 static uint8_t vm_max_partitions = CONFIG_MAX_DOMAIN_PARTITIONS;
 static struct k_spinlock z_vm_domain_lock;
 
+#ifdef CONFIG_VM_GUEST_MEM_HOST_MAP
+BUILD_ASSERT(CONFIG_VM_GUEST_MEM_HOST_MAP_TOTAL_SIZE < CONFIG_KERNEL_VM_SIZE,
+            "guest ram host mappings must leave room in KERNEL_VM_SIZE");
+
+/* Host virtual address space taken by the guest ram mappings of all vms. */
+static struct k_spinlock vm_host_map_lock;
+static uint64_t vm_host_map_used;
+#endif /* CONFIG_VM_GUEST_MEM_HOST_MAP */
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+/* Backing memory of the guest ram blocks of all the vms. */
+K_HEAP_DEFINE(vm_mem_block_pool, CONFIG_VM_DYNAMIC_MEMORY_POOL_SIZE);
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
 
 /**
  * @brief add vpart_space to vm's unused list area.
@@ -77,6 +91,16 @@ static struct vm_mem_partition *alloc_vm_mem_partition(uint64_t hpbase,
 
     vpart->part_hpa_base = hpbase;
     vpart->part_hpa_size = size;
+    vpart->part_hva_base = 0;
+    vpart->part_hva_size = 0;
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    vpart->blk_hva = NULL;
+    vpart->blk_size = 0;
+    vpart->blk_num = 0;
+    vpart->blk_ballooned = NULL;
+    vpart->blk_balloon_map = NULL;
+    vpart->blk_pins = NULL;
+#endif
 
     sys_dnode_init(&vpart->vpart_node);
     sys_dlist_init(&vpart->blk_list);
@@ -84,11 +108,117 @@ static struct vm_mem_partition *alloc_vm_mem_partition(uint64_t hpbase,
     return vpart;
 }
 
+/**
+ * @brief Find the index of the last region whose base <= gpa,
+ * return -1 if there is no such region.
+ */
+static int vm_mem_region_search(struct vm_mem_domain *vmem_dm, uint64_t gpa)
+{
+    int low = 0, high = vmem_dm->region_num - 1, mid, found = -1;
+
+    while (low <= high) {
+        mid = low + (high - low) / 2;
+        if (vmem_dm->regions[mid].gpa_base <= gpa) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * @brief Insert a region to the gpa index, keep it sorted by gpa_base.
+ */
+static int vm_mem_region_add(struct vm_mem_domain *vmem_dm, uint64_t gpa_base,
+            uint64_t gpa_size, struct vm_mem_partition *vpart, struct virt_dev *vdev)
+{
+    int idx, ret = 0;
+    struct vm_mem_region *prev, *next;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&vmem_dm->region_lock);
+
+    if (vmem_dm->region_num >= CONFIG_VM_MEM_REGION_NUM) {
+        ZVM_LOG_WARN("Too many memory regions for vm, max: %d \n",
+                CONFIG_VM_MEM_REGION_NUM);
+        ret = -ENOSPC;
+        goto out;
+    }
+
+    /* the new region will be placed at idx */
+    idx = vm_mem_region_search(vmem_dm, gpa_base) + 1;
+
+    prev = (idx > 0) ? &vmem_dm->regions[idx - 1] : NULL;
+    next = (idx < vmem_dm->region_num) ? &vmem_dm->regions[idx] : NULL;
+    if ((prev && prev->gpa_base + prev->gpa_size > gpa_base) ||
+        (next && gpa_base + gpa_size > next->gpa_base)) {
+        ZVM_LOG_WARN("Memory region base 0x%llx (size 0x%llx) overlaps existing one! \n",
+                gpa_base, gpa_size);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    memmove(&vmem_dm->regions[idx + 1], &vmem_dm->regions[idx],
+            (vmem_dm->region_num - idx) * sizeof(struct vm_mem_region));
+    vmem_dm->regions[idx].gpa_base = gpa_base;
+    vmem_dm->regions[idx].gpa_size = gpa_size;
+    vmem_dm->regions[idx].vpart = vpart;
+    vmem_dm->regions[idx].vdev = vdev;
+    vmem_dm->region_num++;
+    vmem_dm->last_region = idx;
+
+out:
+    k_spin_unlock(&vmem_dm->region_lock, key);
+    return ret;
+}
+
+int vm_mem_region_lookup(struct vm_mem_domain *vmem_dm, uint64_t gpa,
+                    struct vm_mem_region *region)
+{
+    int idx;
+    struct vm_mem_region *reg;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&vmem_dm->region_lock);
+
+    /* Most of the lookups hit the same region as the last one. */
+    if (vmem_dm->last_region < vmem_dm->region_num) {
+        reg = &vmem_dm->regions[vmem_dm->last_region];
+        if (gpa >= reg->gpa_base && gpa - reg->gpa_base < reg->gpa_size) {
+            *region = *reg;
+            k_spin_unlock(&vmem_dm->region_lock, key);
+            return 0;
+        }
+    }
+
+    idx = vm_mem_region_search(vmem_dm, gpa);
+    if (idx < 0) {
+        k_spin_unlock(&vmem_dm->region_lock, key);
+        return -ESRCH;
+    }
+
+    reg = &vmem_dm->regions[idx];
+    if (gpa - reg->gpa_base >= reg->gpa_size) {
+        k_spin_unlock(&vmem_dm->region_lock, key);
+        return -ESRCH;
+    }
+
+    vmem_dm->last_region = idx;
+    *region = *reg;
+    k_spin_unlock(&vmem_dm->region_lock, key);
+
+    return 0;
+}
+
 /**
  * @brief init vpart from default device tree.
  */
 static int create_vm_mem_vpart(struct vm_mem_domain *vmem_domain, uint64_t hpbase,
-                    uint64_t ipbase, uint64_t size, uint32_t attrs)
+                    uint64_t ipbase, uint64_t size, uint32_t attrs,
+                    struct virt_dev *vdev)
 {
     int ret = 0;
     struct vm_mem_partition *vpart;
@@ -99,6 +229,13 @@ static int create_vm_mem_vpart(struct vm_mem_domain *vmem_domain, uint64_t hpbas
     }
     vpart->vmem_domain = vmem_domain;
 
+    ret = vm_mem_region_add(vmem_domain, ipbase, size, vpart, vdev);
+    if (ret) {
+        k_free(vpart->vm_mm_partition);
+        k_free(vpart);
+        return ret;
+    }
+
     ret = add_idle_vpart(vmem_domain, vpart);
 
     return ret;
@@ -108,7 +245,7 @@ static int vm_ram_mem_create(struct vm_mem_domain *vmem_domain)
 {
     int ret = 0;
     int type = OS_TYPE_MAX;
-    uint64_t va_base, pa_base, kpa_base, size;
+    uint64_t va_base, pa_base, size, blk_size;
     struct  _dnode *d_node, *ds_node;
     struct vm *vm = vmem_domain->vm;
     struct vm_mem_partition *vpart;
@@ -118,52 +255,65 @@ static int vm_ram_mem_create(struct vm_mem_domain *vmem_domain)
     case OS_TYPE_LINUX:
         va_base = LINUX_VMSYS_BASE;
         size = LINUX_VMSYS_SIZE;
-#ifdef CONFIG_VM_DYNAMIC_MEMORY
-        kpa_base = (uint64_t)k_malloc(size + CONFIG_MMU_PAGE_SIZE);
-        if(kpa_base == 0){
-            ZVM_LOG_ERR("The heap memory is not enough\n");
-            return -EMMAO;
-        }
-        pa_base = z_mem_phys_addr((void *)ROUND_UP(kpa_base, CONFIG_MMU_PAGE_SIZE));
-#else
-        ARG_UNUSED(vpart);
-        ARG_UNUSED(kpa_base);
         pa_base = LINUX_VM_IMAGE_BASE;
-#endif
+        blk_size = LINUX_VM_BLOCK_SIZE;
         break;
     case OS_TYPE_ZEPHYR:
         va_base = ZEPHYR_VMSYS_BASE;
         size = ZEPHYR_VMSYS_SIZE;
-#ifdef CONFIG_VM_DYNAMIC_MEMORY
-        kpa_base = (uint64_t)k_malloc(size + CONFIG_MMU_PAGE_SIZE);
-        if(kpa_base == 0){
-            ZVM_LOG_ERR("The heap memory is not enough\n");
-            return -EMMAO;
-        }
-        pa_base = z_mem_phys_addr((void *)ROUND_UP(kpa_base, CONFIG_MMU_PAGE_SIZE));
-#else
-        ARG_UNUSED(vpart);
-        ARG_UNUSED(kpa_base);
-        ARG_UNUSED(d_node);
-        ARG_UNUSED(ds_node);
         pa_base = ZEPHYR_VM_IMAGE_BASE;
-#endif
+        blk_size = ZEPHYR_VM_BLOCK_SIZE;
         break;
     default:
         return -EMMAO;
         break;
     }
 
-    ret =  create_vm_mem_vpart(vmem_domain, pa_base, va_base, size, MT_VM_NORMAL_MEM);
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    /* No memory behind the ram yet, blocks are allocated on first touch. */
+    pa_base = 0;
+#endif
+    ret =  create_vm_mem_vpart(vmem_domain, pa_base, va_base, size,
+                MT_VM_NORMAL_MEM, NULL);
+    if (ret) {
+        return ret;
+    }
 
 #ifdef CONFIG_VM_DYNAMIC_MEMORY
     SYS_DLIST_FOR_EACH_NODE_SAFE(&vmem_domain->idle_vpart_list,d_node,ds_node){
         vpart = CONTAINER_OF(d_node,struct vm_mem_partition,vpart_node);
-        if(vpart->part_hpa_base == pa_base){
-            vpart->part_kpa_base = kpa_base;
+        if(vpart->vm_mm_partition->start == va_base){
+            vpart->blk_num = size / blk_size;
+            vpart->blk_hva = (atomic_ptr_t *)k_calloc(vpart->blk_num,
+                        sizeof(atomic_ptr_t));
+            vpart->blk_ballooned = (uint16_t *)k_calloc(vpart->blk_num,
+                        sizeof(uint16_t));
+            vpart->blk_balloon_map = (uint32_t *)k_calloc(
+                        DIV_ROUND_UP(size / CONFIG_MMU_PAGE_SIZE, 32),
+                        sizeof(uint32_t));
+            vpart->blk_pins = (uint32_t *)k_calloc(vpart->blk_num,
+                        sizeof(uint32_t));
+            if (!vpart->blk_hva || !vpart->blk_ballooned ||
+                !vpart->blk_balloon_map || !vpart->blk_pins) {
+                k_free(vpart->blk_hva);
+                k_free(vpart->blk_ballooned);
+                k_free(vpart->blk_balloon_map);
+                k_free(vpart->blk_pins);
+                vpart->blk_hva = NULL;
+                vpart->blk_ballooned = NULL;
+                vpart->blk_balloon_map = NULL;
+                vpart->blk_pins = NULL;
+                return -EMMAO;
+            }
+            vpart->blk_size = blk_size;
             break;
         }
     }
+#else
+    ARG_UNUSED(blk_size);
+    ARG_UNUSED(d_node);
+    ARG_UNUSED(ds_node);
+    ARG_UNUSED(vpart);
 #endif
     return ret;
 }
@@ -180,7 +330,7 @@ static int vm_dtb_mem_create(struct vm_mem_domain *vmem_domain)
 
     /* Attribute 'MT_VM_DEVICE_MEM' was occer a address size trap, replace with normal memory */
     return create_vm_mem_vpart(vmem_domain, vm_dtb_base, vm_dtb_base,
-            vm_dtb_size, MT_VM_NORMAL_MEM);
+            vm_dtb_size, MT_VM_NORMAL_MEM, NULL);
 }
 
 static int vm_init_mem_create(struct vm_mem_domain *vmem_domain)
@@ -243,9 +393,10 @@ static int vm_init_mem_create(struct vm_mem_domain *vmem_domain)
 
 
 int vm_vdev_mem_create(struct vm_mem_domain *vmem_domain, uint64_t hpbase,
-                    uint64_t ipbase, uint64_t size, uint32_t attrs)
+                    uint64_t ipbase, uint64_t size, uint32_t attrs,
+                    struct virt_dev *vdev)
 {
-    return create_vm_mem_vpart(vmem_domain, hpbase, ipbase, size, attrs);
+    return create_vm_mem_vpart(vmem_domain, hpbase, ipbase, size, attrs, vdev);
 }
 
 // int map_vpart_to_block(struct vm_mem_domain *vmem_domain,
@@ -459,6 +610,13 @@ static int vm_mem_domain_partition_add(struct vm_mem_domain *vmem_dm,
 	domain->partitions[p_idx].attr = part->attr;
 	domain->num_partitions++;
 
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+	/* The blocks of guest ram are mapped when they are populated. */
+	if (vpart->blk_hva) {
+		goto unlock_out;
+	}
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
 #ifdef CONFIG_ARCH_MEM_DOMAIN_SYNCHRONOUS_API
 	ret = arch_vm_mem_domain_partition_add(domain, p_idx, phys_start, vm->vmid);
 #endif /* CONFIG_ARCH_MEM_DOMAIN_SYNCHRONOUS_API */
@@ -485,39 +643,341 @@ static int vm_mem_domain_partition_remove(struct vm_mem_domain *vmem_dm)
     key = k_spin_lock(&vm_mem_domain_lock);
 
 #ifdef CONFIG_ARCH_MEM_DOMAIN_SYNCHRONOUS_API
+    /* Invalidate the stage-2 tlb once for all the partitions. */
+    arch_vm_s2_tlb_batch_start(vm);
     for(p_idx = 0;p_idx < vm_max_partitions; p_idx++) {
         if(domain->partitions[p_idx].size != 0U){
             ret = arch_vm_mem_domain_partition_remove(domain,p_idx,vm->vmid);
         }
     }
+    arch_vm_s2_tlb_batch_end(vm);
 #endif
+    /* Return the stage-2 tables of this vm to the shared pool. */
+    arch_vm_mem_domain_deinit(domain, vm->vmid);
     k_free(domain);
     k_spin_unlock(&vm_mem_domain_lock,key);
 
     return ret;
 }
 
+/**
+ * @brief Map guest ram vpart to hypervisor once, then device models can
+ * access the guest memory by a cached host pointer. z_phys_map() takes
+ * z_mm_lock and edits the host page tables, so it is called without the
+ * spinlock of the memory domain to keep that irq-off section short.
+ * When the mappings of all the vms would pass
+ * CONFIG_VM_GUEST_MEM_HOST_MAP_TOTAL_SIZE, the vpart is left unmapped
+ * and reached by temporary mappings.
+ */
+static void vm_mem_vpart_hva_map(struct vm_mem_partition *vpart)
+{
+    uint8_t *hva;
+    uint64_t map_size;
+    k_spinlock_key_t key;
+    uint32_t attrs = vpart->vm_mm_partition->attr.attrs;
+
+    vpart->part_hva_base = 0;
+    vpart->part_hva_size = 0;
+
+    /* Only normal memory is guest ram, device region is not mapped. */
+    if ((attrs & MT_S2_TYPE_MASK) != MT_S2_NORMAL) {
+        return;
+    }
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    /* Each populated block is reached by its own hypervisor address. */
+    if (vpart->blk_hva) {
+        return;
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
+#ifdef CONFIG_VM_GUEST_MEM_HOST_MAP
+    map_size = MIN(vpart->part_hpa_size,
+                (uint64_t)CONFIG_VM_GUEST_MEM_HOST_MAP_MAX_SIZE);
+    if (!map_size) {
+        return;
+    }
+
+    /* z_phys_map() panics when the virtual address space runs out. */
+    key = k_spin_lock(&vm_host_map_lock);
+    if (vm_host_map_used + map_size > CONFIG_VM_GUEST_MEM_HOST_MAP_TOTAL_SIZE) {
+        k_spin_unlock(&vm_host_map_lock, key);
+        ZVM_LOG_WARN("Guest ram at 0x%lx is not mapped to host, budget is used up! \n",
+                vpart->vm_mm_partition->start);
+        return;
+    }
+    vm_host_map_used += map_size;
+    k_spin_unlock(&vm_host_map_lock, key);
+
+    z_phys_map(&hva, vpart->part_hpa_base, map_size,
+            K_MEM_CACHE_WB | K_MEM_PERM_RW);
+
+    vpart->part_hva_base = (uint64_t)hva;
+    vpart->part_hva_size = map_size;
+#else
+    ARG_UNUSED(hva);
+    ARG_UNUSED(map_size);
+    ARG_UNUSED(key);
+#endif /* CONFIG_VM_GUEST_MEM_HOST_MAP */
+}
+
+static void vm_mem_vpart_hva_unmap(struct vm_mem_partition *vpart)
+{
+#ifdef CONFIG_VM_GUEST_MEM_HOST_MAP
+    k_spinlock_key_t key;
+
+    if (!vpart->part_hva_size) {
+        return;
+    }
+
+    z_phys_unmap((uint8_t *)vpart->part_hva_base, vpart->part_hva_size);
+    key = k_spin_lock(&vm_host_map_lock);
+    vm_host_map_used -= vpart->part_hva_size;
+    k_spin_unlock(&vm_host_map_lock, key);
+    vpart->part_hva_base = 0;
+    vpart->part_hva_size = 0;
+#else
+    ARG_UNUSED(vpart);
+#endif /* CONFIG_VM_GUEST_MEM_HOST_MAP */
+}
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+BUILD_ASSERT(LINUX_VM_BLOCK_SIZE / CONFIG_MMU_PAGE_SIZE <= UINT16_MAX &&
+            ZEPHYR_VM_BLOCK_SIZE / CONFIG_MMU_PAGE_SIZE <= UINT16_MAX,
+            "blk_ballooned counts the pages of a block in 16 bits");
+
+/**
+ * @brief Get the block of @vpart which contains @gpa, it is allocated and
+ * zeroed and cleaned to memory on the first touch. When two vcpus race on the same block, the
+ * loser gives its copy back to the pool.
+ */
+static uint8_t *vm_mem_block_get(struct vm_mem_partition *vpart, uint64_t gpa)
+{
+    uint32_t idx;
+    uint8_t *blk;
+
+    idx = (gpa - vpart->vm_mm_partition->start) / vpart->blk_size;
+    blk = (uint8_t *)atomic_ptr_get(&vpart->blk_hva[idx]);
+    if (blk) {
+        return blk;
+    }
+
+    blk = (uint8_t *)k_heap_aligned_alloc(&vm_mem_block_pool, vpart->blk_size,
+                vpart->blk_size, K_NO_WAIT);
+    if (!blk) {
+        ZVM_LOG_WARN("No memory left for vm block at gpa 0x%llx! \n", gpa);
+        return NULL;
+    }
+    memset(blk, 0, vpart->blk_size);
+    /**
+     * The zeroes may still sit in the host cache, and a guest with its
+     * caches off would read the old heap content behind them.
+     */
+    sys_cache_data_range(blk, vpart->blk_size, K_CACHE_WB_INVD);
+
+    if (!atomic_ptr_cas(&vpart->blk_hva[idx], NULL, blk)) {
+        k_heap_free(&vm_mem_block_pool, blk);
+        blk = (uint8_t *)atomic_ptr_get(&vpart->blk_hva[idx]);
+    }
+
+    return blk;
+}
+
+static void vm_mem_blocks_free(struct vm_mem_partition *vpart)
+{
+    uint32_t i;
+    void *blk;
+
+    if (!vpart->blk_hva) {
+        return;
+    }
+
+    for (i = 0; i < vpart->blk_num; i++) {
+        blk = atomic_ptr_get(&vpart->blk_hva[i]);
+        if (blk) {
+            k_heap_free(&vm_mem_block_pool, blk);
+        }
+    }
+    k_free(vpart->blk_hva);
+    k_free(vpart->blk_ballooned);
+    k_free(vpart->blk_balloon_map);
+    k_free(vpart->blk_pins);
+    vpart->blk_hva = NULL;
+    vpart->blk_ballooned = NULL;
+    vpart->blk_balloon_map = NULL;
+    vpart->blk_pins = NULL;
+}
+
+/**
+ * @brief Copy between @buf and guest ram, the range may cross blocks.
+ */
+static int vm_mem_blocks_copy(struct vm *vm, uint64_t gpa, void *buf,
+                size_t len, bool write)
+{
+    uint64_t offset, chunk;
+    uint8_t *hva;
+    struct vm_mem_partition *vpart = NULL;
+
+    while (len) {
+        vm_gpa_to_hpa(vm, gpa, &vpart);
+        if (!vpart || !vpart->blk_hva) {
+            return -ESRCH;
+        }
+
+        offset = (gpa - vpart->vm_mm_partition->start) % vpart->blk_size;
+        chunk = MIN(len, vpart->blk_size - offset);
+        hva = vm_gpa_hva_get(vm, gpa, chunk);
+        if (!hva) {
+            return -ENOMEM;
+        }
+
+        if (write) {
+            memcpy(hva, buf, chunk);
+        } else {
+            memcpy(buf, hva, chunk);
+        }
+        vm_gpa_hva_put(vm, gpa);
+        gpa += chunk;
+        buf = (uint8_t *)buf + chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+int vm_mem_block_fault(struct vm *vm, uint64_t gpa)
+{
+    int ret = 0;
+    uint32_t idx;
+    uint64_t blk_gpa;
+    uint8_t *blk;
+    k_spinlock_key_t key;
+    struct vm_mem_region region;
+    struct vm_mem_partition *vpart;
+
+    if (vm_mem_region_lookup(vm->vmem_domain, gpa, &region) || region.vdev) {
+        return -ESRCH;
+    }
+
+    vpart = region.vpart;
+    if (!vpart->blk_hva) {
+        return -ESRCH;
+    }
+
+    blk = vm_mem_block_get(vpart, gpa);
+    if (!blk) {
+        return -ENOMEM;
+    }
+
+    idx = (gpa - vpart->vm_mm_partition->start) / vpart->blk_size;
+    blk_gpa = vpart->vm_mm_partition->start + idx * vpart->blk_size;
+
+    key = k_spin_lock(&vpart->blk_lock);
+    /**
+     * Another vcpu may have mapped it already, mapping it again is
+     * harmless. If the balloon took it meanwhile, the access faults again.
+    */
+    if (atomic_ptr_get(&vpart->blk_hva[idx]) == blk) {
+        ret = arch_vm_mem_block_map(vm, z_mem_phys_addr(blk), blk_gpa,
+                vpart->blk_size, vpart->vm_mm_partition->attr.attrs);
+    }
+    k_spin_unlock(&vpart->blk_lock, key);
+
+    return ret;
+}
+
+int vm_mem_page_balloon(struct vm *vm, uint64_t gpa, bool inflate)
+{
+    int ret = 0;
+    uint32_t idx, page, bit;
+    uint64_t blk_gpa;
+    void *blk = NULL;
+    k_spinlock_key_t key;
+    struct vm_mem_region region;
+    struct vm_mem_partition *vpart;
+
+    if (vm_mem_region_lookup(vm->vmem_domain, gpa, &region) || region.vdev) {
+        return -ESRCH;
+    }
+
+    vpart = region.vpart;
+    if (!vpart->blk_hva) {
+        return -ESRCH;
+    }
+
+    idx = (gpa - vpart->vm_mm_partition->start) / vpart->blk_size;
+    blk_gpa = vpart->vm_mm_partition->start + idx * vpart->blk_size;
+    page = (gpa - vpart->vm_mm_partition->start) / CONFIG_MMU_PAGE_SIZE;
+    bit = BIT(page % 32);
+
+    key = k_spin_lock(&vpart->blk_lock);
+    if (!inflate) {
+        /* The block comes back zeroed on the next touch if it was freed. */
+        if (vpart->blk_balloon_map[page / 32] & bit) {
+            vpart->blk_balloon_map[page / 32] &= ~bit;
+            vpart->blk_ballooned[idx]--;
+        }
+    } else if (vpart->blk_pins[idx]) {
+        /* A vring or an in-flight buffer of a vdev is in this block. */
+        ret = -EBUSY;
+    } else if (!(vpart->blk_balloon_map[page / 32] & bit)) {
+        /* A page given twice is counted once. */
+        vpart->blk_balloon_map[page / 32] |= bit;
+        if (++vpart->blk_ballooned[idx] == vpart->blk_size / CONFIG_MMU_PAGE_SIZE) {
+            blk = atomic_ptr_get(&vpart->blk_hva[idx]);
+            if (blk) {
+                atomic_ptr_clear(&vpart->blk_hva[idx]);
+                arch_vm_mem_block_unmap(vm, blk_gpa, vpart->blk_size);
+            }
+        }
+    }
+    k_spin_unlock(&vpart->blk_lock, key);
+
+    if (blk) {
+        k_heap_free(&vm_mem_block_pool, blk);
+    }
+
+    return ret;
+}
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
 int vm_mem_domain_partitions_add(struct vm_mem_domain *vmem_dm)
 {
     int ret = 0;
     k_spinlock_key_t key;
+    sys_dlist_t added;
     struct  _dnode *d_node, *ds_node;
     struct vm_mem_partition *vpart;
 
+    sys_dlist_init(&added);
     key = k_spin_lock(&vmem_dm->spin_mmlock);
+    arch_vm_s2_tlb_batch_start(vmem_dm->vm);
     SYS_DLIST_FOR_EACH_NODE_SAFE(&vmem_dm->idle_vpart_list, d_node, ds_node){
         vpart = CONTAINER_OF(d_node, struct vm_mem_partition, vpart_node);
         ret = vm_mem_domain_partition_add(vmem_dm, vpart);
         if (ret) {
-            k_spin_unlock(&vmem_dm->spin_mmlock, key);
-            return ret;
+            break;
         }
 
         sys_dlist_remove(&vpart->vpart_node);
-        sys_dlist_append(&vmem_dm->mapped_vpart_list, &vpart->vpart_node);
+        sys_dlist_append(&added, &vpart->vpart_node);
+    }
+    arch_vm_s2_tlb_batch_end(vmem_dm->vm);
+    k_spin_unlock(&vmem_dm->spin_mmlock, key);
+
+    /* The host mappings take z_mm_lock, they are made out of the spinlock. */
+    SYS_DLIST_FOR_EACH_NODE(&added, d_node) {
+        vpart = CONTAINER_OF(d_node, struct vm_mem_partition, vpart_node);
+        vm_mem_vpart_hva_map(vpart);
     }
 
+    key = k_spin_lock(&vmem_dm->spin_mmlock);
+    SYS_DLIST_FOR_EACH_NODE_SAFE(&added, d_node, ds_node) {
+        sys_dlist_remove(d_node);
+        sys_dlist_append(&vmem_dm->mapped_vpart_list, d_node);
+    }
     k_spin_unlock(&vmem_dm->spin_mmlock, key);
+
     return ret;
 }
 
@@ -529,9 +989,13 @@ int vm_mem_apart_remove(struct vm_mem_domain *vmem_dm)
     struct vm_mem_partition *vpart;
     struct k_mem_partition  *vmpart;
     struct k_mem_domain  *vm_mem_dm;
-    struct vm *vm;
 
-    vm = vmem_dm->vm;
+    /* The vm is dying, no one adds vparts now. Unmap out of the spinlock. */
+    SYS_DLIST_FOR_EACH_NODE(&vmem_dm->mapped_vpart_list, d_node) {
+        vpart = CONTAINER_OF(d_node, struct vm_mem_partition, vpart_node);
+        vm_mem_vpart_hva_unmap(vpart);
+    }
+
     key = k_spin_lock(&vmem_dm->spin_mmlock);
 
     vm_mem_dm = vmem_dm->vm_mm_domain;
@@ -540,15 +1004,14 @@ int vm_mem_apart_remove(struct vm_mem_domain *vmem_dm)
         vpart = CONTAINER_OF(d_node, struct vm_mem_partition, vpart_node);
         vmpart = vpart->vm_mm_partition;
     #ifdef CONFIG_VM_DYNAMIC_MEMORY
-        if( (vm->vmid < ZVM_ZEPHYR_VM_NUM && vpart->part_hpa_size == ZEPHYR_VMSYS_SIZE) ||
-           (vm->vmid >= ZVM_ZEPHYR_VM_NUM && vpart->part_hpa_size == LINUX_VMSYS_SIZE) ){
-                k_free((void *)vpart->part_kpa_base);
-           }
+        vm_mem_blocks_free(vpart);
     #endif
         sys_dlist_remove(&vpart->vpart_node);
         k_free(vmpart);
         k_free(vpart);
     }
+    vmem_dm->region_num = 0;
+    vmem_dm->last_region = 0;
 
     k_spin_unlock(&vmem_dm->spin_mmlock,key);
     return ret;
@@ -625,6 +1088,9 @@ int vm_mem_domain_create(struct vm *vm)
     /* init the list of used and unused vpart */
     sys_dlist_init(&vmem_dm->idle_vpart_list);
     sys_dlist_init(&vmem_dm->mapped_vpart_list);
+    vmem_dm->region_num = 0;
+    vmem_dm->last_region = 0;
+    ZVM_SPINLOCK_INIT(&vmem_dm->region_lock);
     ret = vm_domain_init(vmem_dm->vm_mm_domain, 0, NULL, vm);
     if (ret) {
         ZVM_LOG_WARN("Init vm domain failed! \n");
@@ -647,24 +1113,122 @@ int vm_mem_domain_create(struct vm *vm)
 }
 
 
-uint64_t vm_gpa_to_hpa(struct vm *vm, uint64_t gpa, struct vm_mem_partition *vpart)
+uint64_t vm_gpa_to_hpa(struct vm *vm, uint64_t gpa, struct vm_mem_partition **vpart)
 {
-    struct vm_mem_domain *vmem_domain = vm->vmem_domain;
-    sys_dnode_t *d_node, *ds_node;
-    uint64_t vpart_gpa_start, vpart_gpa_end, vpart_hpa_start;
+    struct vm_mem_region region;
 
-    SYS_DLIST_FOR_EACH_NODE_SAFE(&vmem_domain->mapped_vpart_list, d_node, ds_node) {
-        vpart = CONTAINER_OF(d_node, struct vm_mem_partition, vpart_node);
+    if (vm_mem_region_lookup(vm->vmem_domain, gpa, &region)) {
+        return -ESRCH;
+    }
+
+    if (vpart) {
+        *vpart = region.vpart;
+    }
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    if (region.vpart->blk_hva) {
+        uint8_t *blk = vm_mem_block_get(region.vpart, gpa);
+
+        if (!blk) {
+            if (vpart) {
+                *vpart = NULL;
+            }
+            return -ENOMEM;
+        }
+        return z_mem_phys_addr(blk) + (gpa - region.gpa_base) % region.vpart->blk_size;
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
+    return (gpa - region.gpa_base + region.vpart->part_hpa_base);
+}
 
-        vpart_gpa_start = (uint64_t)(vpart->vm_mm_partition->start);
-        vpart_gpa_end = vpart_gpa_start + ((uint64_t)vpart->vm_mm_partition->size);
+void *vm_gpa_to_hva(struct vm *vm, uint64_t gpa, size_t len)
+{
+    uint64_t hpa, offset;
+    struct vm_mem_partition *vpart = NULL;
+
+    hpa = vm_gpa_to_hpa(vm, gpa, &vpart);
+    if (!vpart) {
+        return NULL;
+    }
 
-        if(vpart_gpa_start <= gpa && gpa <= vpart_gpa_end) {
-            vpart_hpa_start = vpart->part_hpa_base;
-            return (gpa - vpart_gpa_start + vpart_hpa_start);
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    /* The block is populated by the translation above. */
+    if (vpart->blk_hva) {
+        offset = (gpa - vpart->vm_mm_partition->start) % vpart->blk_size;
+        if (offset + len > vpart->blk_size) {
+            return NULL;
         }
+        return (uint8_t *)atomic_ptr_get(&vpart->blk_hva[
+                (gpa - vpart->vm_mm_partition->start) / vpart->blk_size]) + offset;
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
+    if (!vpart->part_hva_size) {
+        return NULL;
     }
-    return -ESRCH;
+
+    offset = hpa - vpart->part_hpa_base;
+    if (offset + len > vpart->part_hva_size) {
+        return NULL;
+    }
+
+    return (void *)(vpart->part_hva_base + offset);
+}
+
+void *vm_gpa_hva_get(struct vm *vm, uint64_t gpa, size_t len)
+{
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    uint32_t idx;
+    void *hva;
+    k_spinlock_key_t key;
+    struct vm_mem_region region;
+    struct vm_mem_partition *vpart;
+
+    if (!vm_mem_region_lookup(vm->vmem_domain, gpa, &region) && !region.vdev &&
+        region.vpart->blk_hva) {
+        vpart = region.vpart;
+        idx = (gpa - vpart->vm_mm_partition->start) / vpart->blk_size;
+
+        /* Pin the block first, the balloon does not free a pinned block. */
+        key = k_spin_lock(&vpart->blk_lock);
+        vpart->blk_pins[idx]++;
+        k_spin_unlock(&vpart->blk_lock, key);
+
+        hva = vm_gpa_to_hva(vm, gpa, len);
+        if (!hva) {
+            vm_gpa_hva_put(vm, gpa);
+        }
+        return hva;
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
+    return vm_gpa_to_hva(vm, gpa, len);
+}
+
+void vm_gpa_hva_put(struct vm *vm, uint64_t gpa)
+{
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    uint32_t idx;
+    k_spinlock_key_t key;
+    struct vm_mem_region region;
+    struct vm_mem_partition *vpart;
+
+    if (vm_mem_region_lookup(vm->vmem_domain, gpa, &region) || region.vdev ||
+        !region.vpart->blk_hva) {
+        return;
+    }
+
+    vpart = region.vpart;
+    idx = (gpa - vpart->vm_mm_partition->start) / vpart->blk_size;
+    key = k_spin_lock(&vpart->blk_lock);
+    __ASSERT_NO_MSG(vpart->blk_pins[idx]);
+    vpart->blk_pins[idx]--;
+    k_spin_unlock(&vpart->blk_lock, key);
+#else
+    ARG_UNUSED(vm);
+    ARG_UNUSED(gpa);
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
 }
 
 void vm_host_memory_read(uint64_t hpa, void *dst, size_t len)
@@ -680,7 +1244,7 @@ void vm_host_memory_read(uint64_t hpa, void *dst, size_t len)
 }
 
 void vm_host_memory_write(uint64_t hpa, void *src, size_t len)
-{   
+{
     size_t len_actual = len;
     uint64_t *hva;
     if (len == 1) {
@@ -692,17 +1256,29 @@ void vm_host_memory_write(uint64_t hpa, void *src, size_t len)
 }
 
 void vm_guest_memory_read(struct vm *vm, uint64_t gpa, void *dst, size_t len)
-{   
+{
     uint64_t hpa;
-    struct vm_mem_partition *vpart;
-    vpart = (struct vm_mem_partition *)k_malloc(sizeof(struct vm_mem_partition));
-    if (!vpart) {
+    void *hva;
+    struct vm_mem_partition *vpart = NULL;
+
+    /* Fast path, guest ram is mapped to hypervisor already. */
+    hva = vm_gpa_hva_get(vm, gpa, len);
+    if (hva) {
+        memcpy(dst, hva, len);
+        vm_gpa_hva_put(vm, gpa);
         return;
-    }	
-    hpa = vm_gpa_to_hpa(vm, gpa, vpart);
-    if(hpa < 0){
+    }
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    if (!vm_mem_blocks_copy(vm, gpa, dst, len, false)) {
+        return;
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
+    hpa = vm_gpa_to_hpa(vm, gpa, &vpart);
+    if (!vpart) {
         printk("vm_guest_memory_read: gpa to hpa failed!\n");
-        return ;
+        return;
     }
     vm_host_memory_read(hpa, dst, len);
 }
@@ -710,15 +1286,51 @@ void vm_guest_memory_read(struct vm *vm, uint64_t gpa, void *dst, size_t len)
 void vm_guest_memory_write(struct vm *vm, uint64_t gpa, void *src, size_t len)
 {
     uint64_t hpa;
-    struct vm_mem_partition *vpart;
-    vpart = (struct vm_mem_partition *)k_malloc(sizeof(struct vm_mem_partition));
-    if (!vpart) {
+    void *hva;
+    struct vm_mem_partition *vpart = NULL;
+
+    /* Fast path, guest ram is mapped to hypervisor already. */
+    hva = vm_gpa_hva_get(vm, gpa, len);
+    if (hva) {
+        memcpy(hva, src, len);
+        vm_gpa_hva_put(vm, gpa);
+        return;
+    }
+
+#ifdef CONFIG_VM_DYNAMIC_MEMORY
+    if (!vm_mem_blocks_copy(vm, gpa, src, len, true)) {
         return;
-    }	
-    hpa = vm_gpa_to_hpa(vm, gpa, vpart);
-    if(hpa < 0){
+    }
+#endif /* CONFIG_VM_DYNAMIC_MEMORY */
+
+    hpa = vm_gpa_to_hpa(vm, gpa, &vpart);
+    if (!vpart) {
         printk("vm_guest_memory_write: gpa to hpa failed!\n");
-        return ;
+        return;
     }
     vm_host_memory_write(hpa, src, len);
 }
+
+void vm_guest_memory_load(struct vm *vm, uint64_t gpa, void *src, size_t len)
+{
+    void *hva;
+    size_t chunk;
+
+    vm_guest_memory_write(vm, gpa, src, len);
+
+    /**
+     * The copy went through cacheable host aliases, while the guest
+     * boots with its mmu and caches off. Clean it to the point of
+     * coherency so the guest reads the image, not stale memory.
+     */
+    while (len) {
+        chunk = MIN(len, CONFIG_MMU_PAGE_SIZE - (gpa & (CONFIG_MMU_PAGE_SIZE - 1)));
+        hva = vm_gpa_hva_get(vm, gpa, chunk);
+        if (hva) {
+            sys_cache_data_range(hva, chunk, K_CACHE_WB_INVD);
+            vm_gpa_hva_put(vm, gpa);
+        }
+        gpa += chunk;
+        len -= chunk;
+    }
+}
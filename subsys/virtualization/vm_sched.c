@@ -0,0 +1,406 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <kernel.h>
+#include <ksched.h>
+#include <spinlock.h>
+#include <sys/dlist.h>
+#include <arch/arm64/lib_helpers.h>
+#include <virtualization/zvm.h>
+#include <virtualization/vm_cpu.h>
+#include <virtualization/arm/sysreg.h>
+#include <virtualization/vdev/vgic_common.h>
+
+LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
+
+/* pcpu 0 is left to the host threads. */
+#define VCPU_SCHED_FIRST_CPU    (CONFIG_MP_NUM_CPUS > 1 ? 1 : 0)
+
+/**
+ * @brief Vcpus pinned to a pcpu, and the run and steal time of its
+ * non-rt vcpus in the last balance period, in permille of the pcpu.
+ */
+struct vcpu_sched_pcpu {
+    uint16_t rt_vcpus;
+    uint16_t nrt_vcpus;
+    uint32_t load;
+};
+
+static struct vcpu_sched_pcpu vcpu_sched_pcpus[CONFIG_MP_NUM_CPUS];
+static sys_dlist_t vcpu_sched_list = SYS_DLIST_STATIC_INIT(&vcpu_sched_list);
+static struct k_spinlock vcpu_sched_lock;
+
+#ifdef CONFIG_ZVM_VCPU_BALANCE
+/* Polls of a migration before it is given up. */
+#define VCPU_SCHED_MIGRATE_TRIES    100
+
+static struct k_work_q vcpu_sched_wq;
+static K_KERNEL_STACK_DEFINE(vcpu_sched_stack, CONFIG_ZVM_VCPU_BALANCE_WQ_STACK_SIZE);
+static struct k_work_delayable vcpu_sched_work;
+static atomic_t vcpu_sched_started;
+
+static const struct k_work_queue_config vcpu_sched_wq_cfg = {
+    .name = "vcpu_balance",
+};
+
+/* Only one migration is in flight, it is finished by the next work. */
+static struct vcpu *vcpu_sched_migrating;
+static uint16_t vcpu_sched_migrate_from;
+static uint32_t vcpu_sched_migrate_tries;
+static int64_t vcpu_sched_last_ticks;
+
+static void vcpu_sched_balance_start(void);
+#endif /* CONFIG_ZVM_VCPU_BALANCE */
+
+/**
+ * @brief Whether pcpu @a suits a new vcpu better than @b. Non-rt vcpus
+ * go to the least loaded pcpu, a rt vcpu prefers the pcpu with the
+ * fewest non-rt vcpus to move away.
+ */
+static bool vcpu_sched_pcpu_better(struct vcpu_sched_pcpu *a,
+                struct vcpu_sched_pcpu *b, bool rt)
+{
+    if (rt && a->nrt_vcpus != b->nrt_vcpus) {
+        return a->nrt_vcpus < b->nrt_vcpus;
+    }
+    if (a->load != b->load) {
+        return a->load < b->load;
+    }
+    return a->nrt_vcpus < b->nrt_vcpus;
+}
+
+int vcpu_sched_place(struct vcpu *vcpu)
+{
+    int cpu, best = -ESRCH;
+    bool rt = vcpu->vm->is_rtos;
+    k_spinlock_key_t key;
+    struct vcpu_sched_pcpu *pcpu, *best_pcpu = NULL;
+
+    key = k_spin_lock(&vcpu_sched_lock);
+    for (cpu = VCPU_SCHED_FIRST_CPU; cpu < CONFIG_MP_NUM_CPUS; cpu++) {
+        pcpu = &vcpu_sched_pcpus[cpu];
+        /* A rt vcpu has its pcpu for itself. */
+        if (pcpu->rt_vcpus) {
+            continue;
+        }
+        if (!best_pcpu || vcpu_sched_pcpu_better(pcpu, best_pcpu, rt)) {
+            best = cpu;
+            best_pcpu = pcpu;
+        }
+    }
+
+    if (best_pcpu) {
+        if (rt) {
+            best_pcpu->rt_vcpus++;
+        } else {
+            best_pcpu->nrt_vcpus++;
+        }
+        vcpu->sched.pcpu = best;
+        vcpu->sched.rt = rt;
+        vcpu->sched.load = 0;
+        vcpu->sched.steal = 0;
+        vcpu->sched.last_run_cycles = 0;
+        vcpu->sched.last_steal_ns = 0;
+        atomic_clear(&vcpu->sched.migrate);
+        sys_dnode_init(&vcpu->sched.node);
+        sys_dlist_append(&vcpu_sched_list, &vcpu->sched.node);
+    }
+    k_spin_unlock(&vcpu_sched_lock, key);
+
+#ifdef CONFIG_ZVM_VCPU_BALANCE
+    if (best_pcpu) {
+        vcpu_sched_balance_start();
+    }
+#endif
+
+    return best;
+}
+
+void vcpu_sched_remove(struct vcpu *vcpu)
+{
+    k_spinlock_key_t key;
+    struct vcpu_sched_pcpu *pcpu;
+
+    key = k_spin_lock(&vcpu_sched_lock);
+    if (!sys_dnode_is_linked(&vcpu->sched.node)) {
+        k_spin_unlock(&vcpu_sched_lock, key);
+        return;
+    }
+
+    pcpu = &vcpu_sched_pcpus[vcpu->sched.pcpu];
+    if (vcpu->sched.rt) {
+        pcpu->rt_vcpus--;
+    } else {
+        pcpu->nrt_vcpus--;
+        pcpu->load -= MIN(pcpu->load, vcpu->sched.load + vcpu->sched.steal);
+    }
+    sys_dlist_remove(&vcpu->sched.node);
+
+#ifdef CONFIG_ZVM_VCPU_BALANCE
+    if (vcpu_sched_migrating == vcpu) {
+        vcpu_sched_migrating = NULL;
+    }
+#endif
+    k_spin_unlock(&vcpu_sched_lock, key);
+}
+
+#ifdef CONFIG_ZVM_VCPU_BALANCE
+
+void vcpu_sched_migrate_point(struct vcpu *vcpu)
+{
+    atomic_val_t migrate = atomic_get(&vcpu->sched.migrate);
+
+    if (!migrate || (migrate & VCPU_MIGRATE_CLAIMED)) {
+        return;
+    }
+    /* The balancer may give up the migration at the same time. */
+    if (!atomic_cas(&vcpu->sched.migrate, migrate, migrate | VCPU_MIGRATE_CLAIMED)) {
+        return;
+    }
+
+    /**
+     * Leave the pcpu with host irqs unmasked, so that the switch is
+     * not delayed. The balancer resumes the thread on its target pcpu
+     * after vcpu_sched_handoff() sees the context saved.
+     */
+    enable_irq();
+    isb();
+    k_thread_suspend(k_current_get());
+    disable_irq();
+    isb();
+}
+
+void vcpu_sched_handoff(struct vcpu *vcpu)
+{
+    struct k_thread *thread = vcpu->work->vcpu_thread;
+
+    if ((atomic_get(&vcpu->sched.migrate) & VCPU_MIGRATE_CLAIMED) &&
+        (thread->base.thread_state & _THREAD_SUSPENDED) &&
+        vcpu->vcpu_state == _VCPU_STATE_READY) {
+        /* Lazy el1 registers are still on this pcpu, take them along. */
+        vcpu_sysreg_flush(vcpu);
+        atomic_or(&vcpu->sched.migrate, VCPU_MIGRATE_PARKED);
+    }
+}
+
+static void vcpu_sched_move(struct vcpu *vcpu, uint16_t from, uint16_t to)
+{
+    uint32_t load = vcpu->sched.load + vcpu->sched.steal;
+
+    vcpu_sched_pcpus[from].nrt_vcpus--;
+    vcpu_sched_pcpus[from].load -= MIN(vcpu_sched_pcpus[from].load, load);
+    vcpu_sched_pcpus[to].nrt_vcpus++;
+    vcpu_sched_pcpus[to].load += load;
+    vcpu->sched.pcpu = to;
+}
+
+/**
+ * @brief Finish or give up the migration in flight.
+ * @return false if the vcpu has not left its pcpu yet.
+ */
+static bool vcpu_sched_migrate_finish(struct vcpu *vcpu)
+{
+    struct k_thread *thread = vcpu->work->vcpu_thread;
+    atomic_val_t migrate = atomic_get(&vcpu->sched.migrate);
+    int cpu = (migrate & VCPU_MIGRATE_CPU_MASK) - 1;
+
+    if (!(migrate & VCPU_MIGRATE_PARKED)) {
+        if (++vcpu_sched_migrate_tries < VCPU_SCHED_MIGRATE_TRIES) {
+            return false;
+        }
+        /* Never reached its migrate point, paused or halted. */
+        if (atomic_cas(&vcpu->sched.migrate, migrate, 0)) {
+            vcpu_sched_move(vcpu, cpu, vcpu_sched_migrate_from);
+            return true;
+        }
+        /* Claimed meanwhile, it is leaving the pcpu. */
+        return false;
+    }
+
+    k_thread_cpu_mask_clear(thread);
+    k_thread_cpu_mask_enable(thread, cpu);
+    atomic_clear(&vcpu->sched.migrate);
+    k_thread_resume(thread);
+
+    return true;
+}
+
+/**
+ * @brief Account the run and steal time of each vcpu since the last
+ * period to its pcpu.
+ */
+static void vcpu_sched_sample(void)
+{
+    int cpu;
+    uint64_t period_ns, run_ns, steal_ns;
+    int64_t now = k_uptime_ticks();
+    sys_dnode_t *d_node;
+    struct vcpu *vcpu;
+    k_thread_runtime_stats_t rt_stats;
+
+    period_ns = k_ticks_to_ns_floor64(now - vcpu_sched_last_ticks);
+    vcpu_sched_last_ticks = now;
+    if (!period_ns) {
+        return;
+    }
+
+    for (cpu = 0; cpu < CONFIG_MP_NUM_CPUS; cpu++) {
+        vcpu_sched_pcpus[cpu].load = 0;
+    }
+
+    SYS_DLIST_FOR_EACH_NODE(&vcpu_sched_list, d_node) {
+        vcpu = CONTAINER_OF(d_node, struct vcpu, sched.node);
+
+        k_thread_runtime_stats_get(vcpu->work->vcpu_thread, &rt_stats);
+        run_ns = k_cyc_to_ns_floor64(rt_stats.execution_cycles -
+                    vcpu->sched.last_run_cycles);
+        vcpu->sched.last_run_cycles = rt_stats.execution_cycles;
+
+        steal_ns = vcpu_steal_time_ns(vcpu);
+        run_ns = MIN(run_ns, period_ns);
+        vcpu->sched.load = (vcpu->sched.load + run_ns * 1000 / period_ns) / 2;
+        vcpu->sched.steal = (vcpu->sched.steal +
+                MIN(steal_ns - vcpu->sched.last_steal_ns, period_ns) * 1000 / period_ns) / 2;
+        vcpu->sched.last_steal_ns = steal_ns;
+
+        if (!vcpu->sched.rt) {
+            vcpu_sched_pcpus[vcpu->sched.pcpu].load +=
+                    vcpu->sched.load + vcpu->sched.steal;
+        }
+    }
+}
+
+static bool vcpu_sched_movable(struct vcpu *vcpu)
+{
+    return !vcpu->sched.rt && !atomic_get(&vcpu->sched.migrate) &&
+        (vcpu->vcpu_state & (_VCPU_STATE_READY | _VCPU_STATE_RUNNING));
+}
+
+/**
+ * @brief Choose a non-rt vcpu to move from the busiest pcpu to the
+ * idlest one. Non-rt vcpus on a pcpu taken by a rt vcpu go first.
+ */
+static struct vcpu *vcpu_sched_pick(uint16_t *target)
+{
+    int cpu, busy = -1, idle = -1;
+    uint32_t diff, load, best_gain = 0;
+    sys_dnode_t *d_node;
+    struct vcpu *vcpu, *best = NULL;
+    struct vcpu_sched_pcpu *pcpus = vcpu_sched_pcpus;
+
+    for (cpu = VCPU_SCHED_FIRST_CPU; cpu < CONFIG_MP_NUM_CPUS; cpu++) {
+        if (pcpus[cpu].rt_vcpus) {
+            continue;
+        }
+        if (busy < 0 || pcpus[cpu].load > pcpus[busy].load) {
+            busy = cpu;
+        }
+        if (idle < 0 || vcpu_sched_pcpu_better(&pcpus[cpu], &pcpus[idle], false)) {
+            idle = cpu;
+        }
+    }
+    if (idle < 0) {
+        return NULL;
+    }
+    *target = idle;
+
+    SYS_DLIST_FOR_EACH_NODE(&vcpu_sched_list, d_node) {
+        vcpu = CONTAINER_OF(d_node, struct vcpu, sched.node);
+        if (vcpu_sched_movable(vcpu) && pcpus[vcpu->sched.pcpu].rt_vcpus) {
+            return vcpu;
+        }
+    }
+
+    if (busy == idle || pcpus[busy].nrt_vcpus < 2 ||
+        pcpus[busy].load - pcpus[idle].load <= CONFIG_ZVM_VCPU_BALANCE_THRESHOLD * 10) {
+        return NULL;
+    }
+    diff = pcpus[busy].load - pcpus[idle].load;
+
+    /* The vcpu closest to half of the difference evens the two best. */
+    SYS_DLIST_FOR_EACH_NODE(&vcpu_sched_list, d_node) {
+        vcpu = CONTAINER_OF(d_node, struct vcpu, sched.node);
+        if (vcpu->sched.pcpu != busy || !vcpu_sched_movable(vcpu)) {
+            continue;
+        }
+        load = vcpu->sched.load + vcpu->sched.steal;
+        if (load == 0 || load >= diff) {
+            continue;
+        }
+        if (MIN(load, diff - load) > best_gain) {
+            best_gain = MIN(load, diff - load);
+            best = vcpu;
+        }
+    }
+
+    return best;
+}
+
+static void vcpu_sched_balance_work(struct k_work *work)
+{
+    uint16_t target;
+    k_spinlock_key_t key;
+    struct vcpu *vcpu, *kick = NULL;
+    k_timeout_t next = K_MSEC(CONFIG_ZVM_VCPU_BALANCE_PERIOD_MS);
+
+    key = k_spin_lock(&vcpu_sched_lock);
+    if (vcpu_sched_migrating) {
+        if (vcpu_sched_migrate_finish(vcpu_sched_migrating)) {
+            vcpu_sched_migrating = NULL;
+        } else {
+            next = K_MSEC(1);
+        }
+        goto out;
+    }
+
+    vcpu_sched_sample();
+    vcpu = vcpu_sched_pick(&target);
+    if (vcpu) {
+        vcpu_sched_migrate_from = vcpu->sched.pcpu;
+        vcpu_sched_migrate_tries = 0;
+        vcpu_sched_move(vcpu, vcpu->sched.pcpu, target);
+        atomic_set(&vcpu->sched.migrate, target + 1);
+        vcpu_sched_migrating = vcpu;
+        kick = vcpu;
+        next = K_MSEC(1);
+    }
+
+out:
+    if (!sys_dlist_is_empty(&vcpu_sched_list)) {
+        k_work_reschedule_for_queue(&vcpu_sched_wq, &vcpu_sched_work, next);
+    } else {
+        atomic_clear(&vcpu_sched_started);
+    }
+    k_spin_unlock(&vcpu_sched_lock, key);
+
+    /* Make the vcpu exit the guest or leave wfi to reach its migrate point. */
+    if (kick) {
+        vgic_vcpu_kick(kick);
+    }
+}
+
+static void vcpu_sched_balance_start(void)
+{
+    static bool wq_started;
+
+    if (!atomic_cas(&vcpu_sched_started, 0, 1)) {
+        return;
+    }
+
+    /* Vcpus are created by the shell thread only. */
+    if (!wq_started) {
+        k_work_init_delayable(&vcpu_sched_work, vcpu_sched_balance_work);
+        k_work_queue_start(&vcpu_sched_wq, vcpu_sched_stack,
+                K_KERNEL_STACK_SIZEOF(vcpu_sched_stack),
+                CONFIG_ZVM_VCPU_BALANCE_WQ_PRIORITY, &vcpu_sched_wq_cfg);
+        wq_started = true;
+    }
+    vcpu_sched_last_ticks = k_uptime_ticks();
+    k_work_schedule_for_queue(&vcpu_sched_wq, &vcpu_sched_work,
+            K_MSEC(CONFIG_ZVM_VCPU_BALANCE_PERIOD_MS));
+}
+
+#endif /* CONFIG_ZVM_VCPU_BALANCE */
@@ -17,6 +17,7 @@
 #include <virtualization/vm.h>
 #include <virtualization/vm_dev.h>
 #include <virtualization/vdev/virt_device.h>
+#include <virtualization/tools/latency_measure.h>
 
 LOG_MODULE_REGISTER(ZVM_MODULE_NAME);
 
@@ -122,8 +123,10 @@ void zvm_info_print(struct zvm_hwsys_info *z_info){
     printk(">---- System's information ----<\n");
     printk("  All phy-cpu: %d\n", z_info->phy_cpu_num);
     printk("  CPU's type : %s\n", z_info->cpu_type);
-    printk("  All phy-mem: %.2fMB\n", (float)(z_info->phy_mem)/DT_MB);
-    printk("  Memory used: %.2fMB\n", (float)(z_info->phy_mem_used)/DT_MB);
+    printk("  All phy-mem: %llu.%02lluMB\n", z_info->phy_mem / DT_MB,
+            (z_info->phy_mem % DT_MB) * 100 / DT_MB);
+    printk("  Memory used: %llu.%02lluMB\n", z_info->phy_mem_used / DT_MB,
+            (z_info->phy_mem_used % DT_MB) * 100 / DT_MB);
     printk(">------------------------------<\n");
 }
 
@@ -305,6 +308,10 @@ static int zvm_init(const struct device *dev)
     /*TODO: ready to init zvm_dev and it's ops */
     zvm_dev_ops_init();
 
+#ifdef CONFIG_ZVM_TIME_MEASURE
+    zvm_init_mtiming();
+#endif
+
     return ret;
 }
 
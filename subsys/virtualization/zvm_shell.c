@@ -13,7 +13,7 @@
 
 #define SHELL_HELP_ZVM "ZVM manager command. " \
     "Some subcommand you can choice as below:"  \
-    "new set run update list delete"
+    "new set run update list delete stat console balloon"
 #define SHELL_HELP_CREATE_NEW_VM "Create a new vm.\n"
 #define SHELL_HELP_RUN_VM "Run vm x.\n"
 #define SHELL_HELP_UPDATE_VM "Update vm x.\n"
@@ -21,6 +21,9 @@
 #define SHELL_HELP_PAUSE_VM "Pause vm x.\n"
 #define SHELL_HELP_DELETE_VM "Delete vm x.\n"
 #define SHELL_HELP_RUN_DEFAULT_VM "Run init zephyr VM here. \n"
+#define SHELL_HELP_STAT_VM "Show exit statistics of vm x, -c clears them.\n"
+#define SHELL_HELP_CONSOLE_VM "Attach to virtio console port y of vm x, Ctrl-] detaches.\n"
+#define SHELL_HELP_BALLOON_VM "Set balloon of vm x to y MB with -m, show guest memory stats.\n"
 
 LOG_MODULE_DECLARE(ZVM_MODULE_NAME);
 
@@ -133,6 +136,55 @@ static int cmd_zvm_info(const struct shell *shell, size_t argc, char **argv)
 }
 
 
+static int cmd_zvm_stat(const struct shell *shell, size_t argc, char **argv)
+{
+    int ret = 0;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&shell_vmops_lock);
+    ret = zvm_stat_guest(argc, argv);
+    if (ret) {
+        shell_fprintf(shell, SHELL_NORMAL,
+            "Show vm exit statistics failured, please follow the message and try again! \n");
+        k_spin_unlock(&shell_vmops_lock, key);
+        return ret;
+    }
+    k_spin_unlock(&shell_vmops_lock, key);
+
+    return 0;
+}
+
+
+static int cmd_zvm_console(const struct shell *shell, size_t argc, char **argv)
+{
+    int ret = 0;
+
+    /* No vm ops lock here, the shell output may block. */
+    ret = zvm_console_guest(shell, argc, argv);
+    if (ret) {
+        shell_fprintf(shell, SHELL_NORMAL,
+            "Attach vm console failured, please follow the message and try again! \n");
+    }
+
+    return ret;
+}
+
+
+static int cmd_zvm_balloon(const struct shell *shell, size_t argc, char **argv)
+{
+    int ret = 0;
+
+    /* No vm ops lock here, the balloon device is looked up under its own lock. */
+    ret = zvm_balloon_guest(shell, argc, argv);
+    if (ret) {
+        shell_fprintf(shell, SHELL_NORMAL,
+            "Set vm balloon failured, please follow the message and try again! \n");
+    }
+
+    return ret;
+}
+
+
 static int cmd_zvm_update(const struct shell *shell, size_t argc, char **argv)
 {
     /* Update vm code. */
@@ -153,6 +205,11 @@ SHELL_STATIC_SUBCMD_SET_CREATE(m_sub_zvm,
     SHELL_CMD(delete, NULL, SHELL_HELP_DELETE_VM, cmd_zvm_delete),
     SHELL_CMD(info, NULL, SHELL_HELP_LIST_VM, cmd_zvm_info) ,
     SHELL_CMD(update, NULL, SHELL_HELP_UPDATE_VM, cmd_zvm_update),
+    SHELL_CMD(stat, NULL, SHELL_HELP_STAT_VM, cmd_zvm_stat),
+    SHELL_COND_CMD(CONFIG_VM_VIRTIO_CONSOLE, console, NULL,
+        SHELL_HELP_CONSOLE_VM, cmd_zvm_console),
+    SHELL_COND_CMD(CONFIG_VM_VIRTIO_BALLOON, balloon, NULL,
+        SHELL_HELP_BALLOON_VM, cmd_zvm_balloon),
     SHELL_SUBCMD_SET_END
 );
 
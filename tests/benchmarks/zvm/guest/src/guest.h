@@ -0,0 +1,19 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ZVM_BENCH_GUEST_H_
+#define ZVM_BENCH_GUEST_H_
+
+#include <stdint.h>
+#include <timing/timing.h>
+
+/**
+ * @brief Read 4K blocks from the virtio-blk device at 0xa000000.
+ * @return the total cycles of @loops reads, or 0 if there is no disk.
+ */
+uint64_t virtio_blk_bench(uint32_t loops);
+
+#endif /* ZVM_BENCH_GUEST_H_ */
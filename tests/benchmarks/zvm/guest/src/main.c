@@ -0,0 +1,212 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file
+ * Benchmark guest of ZVM. It runs each microbenchmark in a loop, and
+ * writes the cycles to the result page that the host reads back.
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <sys/sys_io.h>
+#include <sys/mem_manage.h>
+#include <timing/timing.h>
+#include <arch/arm64/cpu.h>
+#include <arch/arm64/lib_helpers.h>
+#include <drivers/interrupt_controller/gic.h>
+#include <dt-bindings/interrupt-controller/arm-gic.h>
+
+#include <virtualization/vm_hypercall.h>
+
+#include "zvm_bench.h"
+#include "guest.h"
+
+/* SGI used by the virtual SGI benchmark */
+#define BENCH_SGI_ID        (8)
+/* An SPI that no vdev of zephyr vm uses */
+#define BENCH_UNUSED_SPI    (100)
+
+static struct zvm_bench_result *result;
+
+static K_SEM_DEFINE(sgi_sem, 0, 1);
+static K_SEM_DEFINE(timer_sem, 0, 1);
+
+static volatile timing_t sgi_start;
+static volatile uint64_t sgi_cycles;
+static volatile uint64_t timer_cycles;
+
+static void bench_record(enum zvm_bench_id id, uint64_t cycles, uint32_t loops)
+{
+	result->cycles[id] = cycles;
+	result->loops[id] = loops;
+	result->valid |= BIT(id);
+}
+
+/* The version hypercall, which does nothing but fill the results. */
+static ALWAYS_INLINE void bench_hvc(void)
+{
+	register uint64_t x0 __asm__("x0") = ZVM_HC_ID(ZVM_HC_VERSION);
+
+	__asm__ volatile("hvc #0"
+			 : "+r" (x0)
+			 :
+			 : "x1", "x2", "x3", "memory");
+}
+
+static void null_hvc_bench(void)
+{
+	uint32_t i;
+	timing_t start, end;
+
+	start = timing_counter_get();
+	for (i = 0; i < ZVM_BENCH_LOOPS; i++) {
+		bench_hvc();
+	}
+	end = timing_counter_get();
+
+	bench_record(ZVM_BENCH_NULL_HVC, timing_cycles_get(&start, &end),
+		     ZVM_BENCH_LOOPS);
+}
+
+static void mmio_bench(void)
+{
+	uint32_t i;
+	timing_t start, end;
+
+	start = timing_counter_get();
+	for (i = 0; i < ZVM_BENCH_LOOPS; i++) {
+		(void)sys_read32(GICD_TYPER);
+	}
+	end = timing_counter_get();
+	bench_record(ZVM_BENCH_MMIO_READ, timing_cycles_get(&start, &end),
+		     ZVM_BENCH_LOOPS);
+
+	start = timing_counter_get();
+	for (i = 0; i < ZVM_BENCH_LOOPS; i++) {
+		sys_write32(BIT(BENCH_UNUSED_SPI % 32),
+			    GICD_ICENABLERn + (BENCH_UNUSED_SPI / 32) * 4);
+	}
+	end = timing_counter_get();
+	bench_record(ZVM_BENCH_MMIO_WRITE, timing_cycles_get(&start, &end),
+		     ZVM_BENCH_LOOPS);
+}
+
+static void sysreg_bench(void)
+{
+	uint32_t i;
+	timing_t start, end;
+
+	start = timing_counter_get();
+	for (i = 0; i < ZVM_BENCH_LOOPS; i++) {
+		(void)read_cntp_ctl_el0();
+	}
+	end = timing_counter_get();
+
+	bench_record(ZVM_BENCH_SYSREG_CNTP, timing_cycles_get(&start, &end),
+		     ZVM_BENCH_LOOPS);
+}
+
+static void sgi_isr(const void *arg)
+{
+	timing_t end = timing_counter_get();
+
+	ARG_UNUSED(arg);
+	sgi_cycles += timing_cycles_get(&sgi_start, &end);
+	k_sem_give(&sgi_sem);
+}
+
+/* Zephyr vm has a single vcpu, so the SGI targets the sender itself,
+ * which still goes through the ICC_SGI1R_EL1 trap and the vgic flush.
+ */
+static void vsgi_bench(void)
+{
+	uint32_t i;
+	uint64_t mpidr = GET_MPIDR();
+
+	IRQ_CONNECT(BENCH_SGI_ID, IRQ_DEFAULT_PRIORITY, sgi_isr, NULL, 0);
+	irq_enable(BENCH_SGI_ID);
+
+	sgi_cycles = 0;
+	for (i = 0; i < ZVM_BENCH_LOOPS; i++) {
+		sgi_start = timing_counter_get();
+		gic_raise_sgi(BENCH_SGI_ID, mpidr, BIT(MPIDR_TO_CORE(mpidr)));
+		if (k_sem_take(&sgi_sem, K_MSEC(100))) {
+			return;
+		}
+	}
+
+	bench_record(ZVM_BENCH_VSGI, sgi_cycles, ZVM_BENCH_LOOPS);
+}
+
+/* The kernel timer runs on the virtual timer. The compare value is
+ * still the expired one in the expiry function, so the delay covers
+ * the vtimer injection and the guest timer interrupt handling.
+ */
+static void timer_expiry(struct k_timer *timer)
+{
+	ARG_UNUSED(timer);
+	timer_cycles += read_cntvct_el0() - read_cntv_cval_el0();
+	k_sem_give(&timer_sem);
+}
+
+static K_TIMER_DEFINE(bench_timer, timer_expiry, NULL);
+
+static void vtimer_bench(void)
+{
+	uint32_t i;
+
+	timer_cycles = 0;
+	for (i = 0; i < ZVM_BENCH_TIMER_LOOPS; i++) {
+		k_timer_start(&bench_timer, K_MSEC(1), K_NO_WAIT);
+		if (k_sem_take(&timer_sem, K_MSEC(100))) {
+			return;
+		}
+	}
+
+	bench_record(ZVM_BENCH_VTIMER, timer_cycles, ZVM_BENCH_TIMER_LOOPS);
+}
+
+static void virtio_bench(void)
+{
+	uint64_t cycles;
+
+	cycles = virtio_blk_bench(ZVM_BENCH_BLK_LOOPS);
+	if (cycles) {
+		bench_record(ZVM_BENCH_VIRTIO_BLK, cycles, ZVM_BENCH_BLK_LOOPS);
+	}
+}
+
+void main(void)
+{
+	uint8_t *page;
+
+	z_phys_map(&page, ZVM_BENCH_RESULT_GPA, ZVM_BENCH_RESULT_SIZE,
+		   K_MEM_CACHE_NONE | K_MEM_PERM_RW);
+	result = (struct zvm_bench_result *)page;
+
+	timing_init();
+	timing_start();
+
+	result->freq_hz = timing_freq_get();
+
+	null_hvc_bench();
+	mmio_bench();
+	sysreg_bench();
+	vsgi_bench();
+	vtimer_bench();
+	virtio_bench();
+
+	timing_stop();
+
+	/* The host polls the magic, write it after all the results. */
+	__DMB();
+	result->magic = ZVM_BENCH_MAGIC;
+
+	while (1) {
+		k_sleep(K_FOREVER);
+	}
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file
+ * A minimal legacy virtio-mmio block driver for the benchmark. It keeps
+ * one request in flight and polls the used ring, so the numbers are the
+ * round trip of notify exit, backend worker and ring update.
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <sys/sys_io.h>
+#include <sys/device_mmio.h>
+#include <timing/timing.h>
+#include <virtualization/vdev/virtio/virtio_ring.h>
+#include <virtualization/vdev/virtio/virtio_blk.h>
+#include <virtualization/vdev/virtio/virtio_config.h>
+
+#include "zvm_bench.h"
+#include "guest.h"
+
+/* virtio_mmio.h is a host header, only the legacy registers are here. */
+#define VIRTIO_MMIO_BASE                0xa000000
+#define VIRTIO_MMIO_SIZE                0x1000
+#define VIRTIO_MMIO_MAGIC_VALUE         0x000
+#define VIRTIO_MMIO_DEVICE_ID           0x008
+#define VIRTIO_MMIO_GUEST_FEATURES      0x020
+#define VIRTIO_MMIO_GUEST_FEATURES_SEL  0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE     0x028
+#define VIRTIO_MMIO_QUEUE_SEL           0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_MMIO_QUEUE_NUM           0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN         0x03c
+#define VIRTIO_MMIO_QUEUE_PFN           0x040
+#define VIRTIO_MMIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_MMIO_STATUS              0x070
+#define VIRTIO_MMIO_CONFIG              0x100
+
+#define VIRTIO_MMIO_MAGIC               0x74726976
+#define VIRTIO_ID_BLOCK_DEV             2
+
+#define BLK_PAGE_SIZE                   4096
+#define BLK_QUEUE_NUM                   8
+#define BLK_SECTOR_SIZE                 512
+#define BLK_SECTORS                     (ZVM_BENCH_BLK_SIZE / BLK_SECTOR_SIZE)
+/* spin limit of a request, far beyond a normal round trip */
+#define BLK_POLL_LIMIT                  100000000U
+
+static uint8_t blk_ring[2 * BLK_PAGE_SIZE] __aligned(BLK_PAGE_SIZE);
+static uint8_t blk_data[ZVM_BENCH_BLK_SIZE] __aligned(BLK_PAGE_SIZE);
+static struct virtio_blk_outhdr blk_hdr;
+static volatile uint8_t blk_status;
+
+static mm_reg_t blk_base;
+static struct vring blk_vring;
+static uint16_t blk_avail_idx;
+
+static inline uint32_t blk_read(uint32_t offset)
+{
+	return sys_read32(blk_base + offset);
+}
+
+static inline void blk_write(uint32_t offset, uint32_t value)
+{
+	sys_write32(value, blk_base + offset);
+}
+
+static int blk_setup(uint64_t *capacity)
+{
+	uint32_t status;
+
+	device_map(&blk_base, VIRTIO_MMIO_BASE, VIRTIO_MMIO_SIZE, K_MEM_CACHE_NONE);
+
+	if (blk_read(VIRTIO_MMIO_MAGIC_VALUE) != VIRTIO_MMIO_MAGIC ||
+	    blk_read(VIRTIO_MMIO_DEVICE_ID) != VIRTIO_ID_BLOCK_DEV) {
+		return -ENODEV;
+	}
+
+	blk_write(VIRTIO_MMIO_STATUS, 0);
+	status = VIRTIO_CONFIG_S_ACKNOWLEDGE;
+	blk_write(VIRTIO_MMIO_STATUS, status);
+	status |= VIRTIO_CONFIG_S_DRIVER;
+	blk_write(VIRTIO_MMIO_STATUS, status);
+
+	/* No feature is needed by a single 4K read. */
+	blk_write(VIRTIO_MMIO_GUEST_FEATURES_SEL, 0);
+	blk_write(VIRTIO_MMIO_GUEST_FEATURES, 0);
+	blk_write(VIRTIO_MMIO_GUEST_PAGE_SIZE, BLK_PAGE_SIZE);
+
+	blk_write(VIRTIO_MMIO_QUEUE_SEL, 0);
+	if (blk_read(VIRTIO_MMIO_QUEUE_NUM_MAX) < BLK_QUEUE_NUM) {
+		return -ENOSPC;
+	}
+	vring_init(&blk_vring, BLK_QUEUE_NUM, blk_ring, (uintptr_t)blk_ring,
+		   BLK_PAGE_SIZE);
+	/* The used ring is polled, the virq is not needed. */
+	blk_vring.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+	blk_write(VIRTIO_MMIO_QUEUE_NUM, BLK_QUEUE_NUM);
+	blk_write(VIRTIO_MMIO_QUEUE_ALIGN, BLK_PAGE_SIZE);
+	blk_write(VIRTIO_MMIO_QUEUE_PFN, (uintptr_t)blk_ring / BLK_PAGE_SIZE);
+
+	status |= VIRTIO_CONFIG_S_DRIVER_OK;
+	blk_write(VIRTIO_MMIO_STATUS, status);
+
+	*capacity = blk_read(VIRTIO_MMIO_CONFIG);
+
+	return 0;
+}
+
+static int blk_read_block(uint64_t sector)
+{
+	uint32_t i;
+	struct vring_desc *desc = blk_vring.desc;
+	volatile uint16_t *used_idx = &blk_vring.used->idx;
+
+	blk_hdr.type = VIRTIO_BLK_T_IN;
+	blk_hdr.ioprio = 0;
+	blk_hdr.sector = sector;
+	blk_status = 0xff;
+
+	desc[0].addr = (uintptr_t)&blk_hdr;
+	desc[0].len = sizeof(blk_hdr);
+	desc[0].flags = VRING_DESC_F_NEXT;
+	desc[0].next = 1;
+	desc[1].addr = (uintptr_t)blk_data;
+	desc[1].len = ZVM_BENCH_BLK_SIZE;
+	desc[1].flags = VRING_DESC_F_NEXT | VRING_DESC_F_WRITE;
+	desc[1].next = 2;
+	desc[2].addr = (uintptr_t)&blk_status;
+	desc[2].len = sizeof(blk_status);
+	desc[2].flags = VRING_DESC_F_WRITE;
+	desc[2].next = 0;
+
+	blk_vring.avail->ring[blk_avail_idx % BLK_QUEUE_NUM] = 0;
+	__DMB();
+	blk_vring.avail->idx = ++blk_avail_idx;
+	__DSB();
+	blk_write(VIRTIO_MMIO_QUEUE_NOTIFY, 0);
+
+	for (i = 0; i < BLK_POLL_LIMIT; i++) {
+		if (*used_idx == blk_avail_idx) {
+			__DMB();
+			return blk_status == VIRTIO_BLK_S_OK ? 0 : -EIO;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+uint64_t virtio_blk_bench(uint32_t loops)
+{
+	uint32_t i;
+	uint64_t capacity;
+	timing_t start, end;
+
+	if (blk_setup(&capacity) || capacity < BLK_SECTORS) {
+		return 0;
+	}
+
+	start = timing_counter_get();
+	for (i = 0; i < loops; i++) {
+		if (blk_read_block((i * BLK_SECTORS) % (capacity - BLK_SECTORS + 1))) {
+			return 0;
+		}
+	}
+	end = timing_counter_get();
+
+	return timing_cycles_get(&start, &end);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file
+ * Host side of the ZVM benchmark. It boots the benchmark guest as a
+ * zephyr vm, waits for its result page and reports the cycles in the
+ * latency_measure format, followed by the exit statistics of the vm.
+ */
+
+#include <zephyr.h>
+#include <kernel.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <tc_util.h>
+#include <timing/timing.h>
+#include <virtualization/zvm.h>
+#include <virtualization/vm.h>
+#include <virtualization/vm_mm.h>
+#include <virtualization/vm_manager.h>
+#include <virtualization/tools/vm_exit_stat.h>
+
+#include "zvm_bench.h"
+
+#define FORMAT "%-60s:%8u cycles , %8u ns\n"
+
+#define PRINT_F(...)						\
+	{							\
+		char sline[256];				\
+		snprintk(sline, 254, FORMAT, ##__VA_ARGS__);	\
+		printk("%s", sline);				\
+	}
+
+#define PRINT_STATS_AVG(x, y, counter)	\
+	PRINT_F(x, (uint32_t)((y) / (counter)),	\
+		(uint32_t)timing_cycles_to_ns_avg(y, counter))
+
+/* The guest needs a few seconds, most of them in the vtimer loop. */
+#define BENCH_POLL_MS       (100)
+#define BENCH_POLL_TIMES    (600)
+
+static const char *const bench_name[ZVM_BENCH_NUM] = {
+	"Average null hypercall round trip",
+	"Average mmio read exit (vgic GICD_TYPER)",
+	"Average mmio write exit (vgic GICD_ICENABLER)",
+	"Average sysreg trap (CNTP_CTL_EL0)",
+	"Average virtual sgi, raise to guest isr",
+	"Average vtimer injection, expiry to guest callback",
+	"Average virtio-blk 4K read",
+};
+
+static struct zvm_bench_result result;
+
+static struct vm *bench_new_vm(void)
+{
+	int i;
+	char *new_argv[] = {"new", "-t", "zephyr"};
+
+	if (zvm_new_guest(ARRAY_SIZE(new_argv), new_argv)) {
+		return NULL;
+	}
+	for (i = 0; i < CONFIG_MAX_VM_NUM; i++) {
+		if (zvm_overall_info->vms[i]) {
+			return zvm_overall_info->vms[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int bench_run_vm(struct vm *vm)
+{
+	char vmid[2] = { '0' + vm->vmid, '\0' };
+	char *run_argv[] = {"run", "-n", vmid};
+
+	return zvm_run_guest(ARRAY_SIZE(run_argv), run_argv);
+}
+
+static int bench_wait_result(struct vm *vm)
+{
+	int i;
+
+	for (i = 0; i < BENCH_POLL_TIMES; i++) {
+		k_msleep(BENCH_POLL_MS);
+		vm_guest_memory_read(vm, ZVM_BENCH_RESULT_GPA, &result, sizeof(result));
+		if (result.magic == ZVM_BENCH_MAGIC) {
+			return 0;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static void bench_report(void)
+{
+	int i;
+
+	for (i = 0; i < ZVM_BENCH_NUM; i++) {
+		if (!(result.valid & BIT(i)) || !result.loops[i]) {
+			TC_PRINT("%-60s: not supported\n", bench_name[i]);
+			continue;
+		}
+		PRINT_STATS_AVG(bench_name[i], result.cycles[i], result.loops[i]);
+	}
+
+	i = ZVM_BENCH_VIRTIO_BLK;
+	if ((result.valid & BIT(i)) && result.cycles[i] && result.freq_hz) {
+		TC_PRINT("virtio-blk 4K read throughput: %llu KB/s\n",
+			 (uint64_t)result.loops[i] * (ZVM_BENCH_BLK_SIZE / 1024) *
+			 result.freq_hz / result.cycles[i]);
+	}
+}
+
+void main(void)
+{
+	int ret;
+	struct vm *vm;
+
+	timing_init();
+	timing_start();
+
+	TC_START("ZVM Time Measurement");
+	TC_PRINT("Timing results: Clock frequency: %u MHz\n", timing_freq_get_mhz());
+
+	vm = bench_new_vm();
+	if (!vm) {
+		TC_PRINT("Can not create the benchmark vm\n");
+		TC_END_REPORT(TC_FAIL);
+		return;
+	}
+
+	memset(&result, 0, sizeof(result));
+	vm_guest_memory_write(vm, ZVM_BENCH_RESULT_GPA, &result, sizeof(result));
+	vm_exit_stat_reset(vm);
+
+	ret = bench_run_vm(vm);
+	if (!ret) {
+		ret = bench_wait_result(vm);
+	}
+	if (ret) {
+		TC_PRINT("Benchmark vm did not finish: %d\n", ret);
+		TC_END_REPORT(TC_FAIL);
+		return;
+	}
+
+	bench_report();
+	vm_exit_stat_print(vm);
+
+	timing_stop();
+	TC_END_REPORT(TC_PASS);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2021-2022 HNU
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file
+ * Layout of the result page shared by the benchmark guest and the host.
+ */
+
+#ifndef ZVM_BENCH_H_
+#define ZVM_BENCH_H_
+
+#include <stdint.h>
+
+/* The last page of the 2M zephyr vm memory, out of the guest image. */
+#define ZVM_BENCH_RESULT_GPA    (0x40000000UL + 0x200000UL - 0x1000UL)
+#define ZVM_BENCH_RESULT_SIZE   (0x1000UL)
+
+/* "ZVMB" is written when the guest is done with all the benchmarks. */
+#define ZVM_BENCH_MAGIC         (0x424d565aU)
+
+#define ZVM_BENCH_LOOPS         (1000U)
+#define ZVM_BENCH_TIMER_LOOPS   (100U)
+#define ZVM_BENCH_BLK_LOOPS     (256U)
+#define ZVM_BENCH_BLK_SIZE      (4096U)
+
+enum zvm_bench_id {
+	ZVM_BENCH_NULL_HVC = 0,
+	ZVM_BENCH_MMIO_READ,
+	ZVM_BENCH_MMIO_WRITE,
+	ZVM_BENCH_SYSREG_CNTP,
+	ZVM_BENCH_VSGI,
+	ZVM_BENCH_VTIMER,
+	ZVM_BENCH_VIRTIO_BLK,
+	ZVM_BENCH_NUM,
+};
+
+/**
+ * @brief Results of the guest. @cycles is the total of @loops runs in
+ * the guest's timing_counter_get() units, which is the virtual counter.
+ */
+struct zvm_bench_result {
+	uint32_t magic;
+	uint32_t valid;
+	uint64_t freq_hz;
+	uint64_t cycles[ZVM_BENCH_NUM];
+	uint32_t loops[ZVM_BENCH_NUM];
+};
+
+#endif /* ZVM_BENCH_H_ */